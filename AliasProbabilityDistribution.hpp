@@ -0,0 +1,559 @@
+#ifndef NET_CODERODDE_UTIL_ALIAS_PROBABILITY_DISTRIBUTION_HPP
+#define NET_CODERODDE_UTIL_ALIAS_PROBABILITY_DISTRIBUTION_HPP
+
+#include "FlatHashIndex.hpp"
+#include "ProbabilityDistribution.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory_resource>
+#include <random>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Implements the probability distribution via Vose's alias method. The
+    // alias table is built lazily on the first sample_element() following a
+    // modification, after which each sample takes O(1) time. Adding and
+    // removing elements run in O(1) expected time, but only mark the table as
+    // dirty; the next sample rebuilds it in O(n). 'Hash' and 'KeyEqual' hash
+    // and compare the elements in the element index.
+    template<typename T,
+             typename Engine = std::mt19937,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class AliasProbabilityDistribution final :
+    public ProbabilityDistribution<T, Engine> {
+
+    public:
+        AliasProbabilityDistribution()
+        :
+        ProbabilityDistribution<T, Engine>{},
+        m_dirty{false}
+        {}
+
+        AliasProbabilityDistribution(std::random_device::result_type seed)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_dirty{false}
+        {}
+
+        // The storage arrays, the alias table and the element index are
+        // allocated from 'resource'.
+        AliasProbabilityDistribution(std::pmr::memory_resource* resource)
+        :
+        AliasProbabilityDistribution(std::random_device::result_type{},
+                                     resource)
+        {}
+
+        AliasProbabilityDistribution(std::random_device::result_type seed,
+                                     std::pmr::memory_resource* resource)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_element_storage_vector{resource},
+        m_weight_storage_vector{resource},
+        m_handle_index_vector{resource},
+        m_probability_vector{resource},
+        m_alias_vector{resource},
+        m_element_index{resource},
+        m_handle_table{resource},
+        m_dirty{false}
+        {}
+
+        AliasProbabilityDistribution(
+            const AliasProbabilityDistribution& other)
+        :
+        ProbabilityDistribution<T, Engine>{other}
+        {
+            m_element_storage_vector = other.m_element_storage_vector;
+            m_weight_storage_vector  = other.m_weight_storage_vector;
+            m_handle_index_vector    = other.m_handle_index_vector;
+            m_probability_vector     = other.m_probability_vector;
+            m_alias_vector           = other.m_alias_vector;
+            m_element_index          = other.m_element_index;
+            m_handle_table           = other.m_handle_table;
+            m_dirty                  = other.m_dirty;
+        }
+
+        AliasProbabilityDistribution(
+            AliasProbabilityDistribution&& other)
+        :
+        ProbabilityDistribution<T, Engine>{other},
+        m_element_storage_vector(std::move(other.m_element_storage_vector)),
+        m_weight_storage_vector(std::move(other.m_weight_storage_vector)),
+        m_handle_index_vector(std::move(other.m_handle_index_vector)),
+        m_probability_vector(std::move(other.m_probability_vector)),
+        m_alias_vector(std::move(other.m_alias_vector)),
+        m_element_index(std::move(other.m_element_index)),
+        m_handle_table(std::move(other.m_handle_table)),
+        m_dirty{other.m_dirty}
+        {
+            other.clear();
+        }
+
+        AliasProbabilityDistribution& operator=(
+            const AliasProbabilityDistribution& other) {
+            ProbabilityDistribution<T, Engine>::operator=(other);
+            m_element_storage_vector = other.m_element_storage_vector;
+            m_weight_storage_vector  = other.m_weight_storage_vector;
+            m_handle_index_vector    = other.m_handle_index_vector;
+            m_probability_vector     = other.m_probability_vector;
+            m_alias_vector           = other.m_alias_vector;
+            m_element_index          = other.m_element_index;
+            m_handle_table           = other.m_handle_table;
+            m_dirty                  = other.m_dirty;
+            return *this;
+        }
+
+        AliasProbabilityDistribution& operator=(
+            AliasProbabilityDistribution&& other) {
+            if (this == &other) {
+                return *this;
+            }
+
+            ProbabilityDistribution<T, Engine>::operator=(other);
+
+            m_element_storage_vector =
+                std::move(other.m_element_storage_vector);
+
+            m_weight_storage_vector = std::move(other.m_weight_storage_vector);
+            m_handle_index_vector   = std::move(other.m_handle_index_vector);
+            m_probability_vector    = std::move(other.m_probability_vector);
+            m_alias_vector          = std::move(other.m_alias_vector);
+            m_element_index         = std::move(other.m_element_index);
+            m_handle_table          = std::move(other.m_handle_table);
+            m_dirty                 = other.m_dirty;
+
+            other.clear();
+            return *this;
+        }
+
+        virtual bool add_element(T const& element, double weight) {
+            return !insert_element(element, weight).is_null();
+        }
+
+        virtual bool add_element(T&& element, double weight) {
+            return !insert_element(std::move(element), weight).is_null();
+        }
+
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) {
+            return insert_element(element, weight);
+        }
+
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) {
+            return insert_element(std::move(element), weight);
+        }
+
+        virtual T sample_element() {
+            return sample_element_reference();
+        }
+
+        virtual const T& sample_element_reference() {
+            this->check_not_empty();
+
+            if (m_dirty) {
+                build_alias_table();
+            }
+
+            return get_element(sample_index(this->m_generator));
+        }
+
+        virtual ElementHandle sample_handle() {
+            this->check_not_empty();
+
+            if (m_dirty) {
+                build_alias_table();
+            }
+
+            size_t index = sample_index(this->m_generator);
+            return m_handle_table.get_handle(m_handle_index_vector[index]);
+        }
+
+        virtual ElementHandle get_handle(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+
+            return m_handle_table.get_handle(handle_index);
+        }
+
+        virtual bool contains_handle(ElementHandle handle) const {
+            return m_handle_table.contains(handle);
+        }
+
+        virtual const T& get_element(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return get_element(m_handle_table.get_position(handle.index));
+        }
+
+        virtual bool contains_element(T const& element) const {
+            return find_handle_index(element) != index_type::NOT_FOUND;
+        }
+
+        virtual bool remove_element(T const& element) {
+            uint32_t hash = m_element_index.hash(element);
+            uint32_t handle_index = find_handle_index(element, hash);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            m_element_index.erase(hash, handle_index);
+            remove_at(m_handle_table.get_position(handle_index));
+            return true;
+        }
+
+        virtual bool remove_element(ElementHandle handle) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+
+            size_t index = m_handle_table.get_position(handle.index);
+            m_element_index.erase(m_element_index.hash(get_element(index)),
+                                  handle.index);
+            remove_at(index);
+            return true;
+        }
+
+        virtual bool update_weight(T const& element, double weight) {
+            uint32_t handle_index = find_handle_index(element);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            update_weight_at(m_handle_table.get_position(handle_index), weight);
+            return true;
+        }
+
+        virtual bool update_weight(ElementHandle handle, double weight) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+
+            update_weight_at(m_handle_table.get_position(handle.index), weight);
+            return true;
+        }
+
+        virtual double get_weight(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            this->check_contains(handle_index != index_type::NOT_FOUND);
+            return m_weight_storage_vector[
+                        m_handle_table.get_position(handle_index)];
+        }
+
+        virtual double get_weight(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            size_t index = m_handle_table.get_position(handle.index);
+            return m_weight_storage_vector[index];
+        }
+
+        virtual void clear() {
+            this->m_size = 0;
+            this->m_total_weight = 0.0;
+            m_element_storage_vector.clear();
+            m_weight_storage_vector.clear();
+            m_handle_index_vector.clear();
+            m_probability_vector.clear();
+            m_alias_vector.clear();
+            m_element_index.clear();
+            m_handle_table.clear();
+            m_dirty = false;
+        }
+
+    protected:
+
+        virtual const T& sample_element_with(Engine& generator) const {
+            return get_element(sample_index(generator));
+        }
+
+        // Builds the table before the threads of parallel_sample() read it.
+        virtual void prepare_parallel_sampling() {
+            if (m_dirty) {
+                build_alias_table();
+            }
+        }
+
+        // Builds the table once and serves the batch without the virtual
+        // call per sample.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            if (m_dirty) {
+                build_alias_table();
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                samples.push_back(get_element(sample_index(this->m_generator)));
+            }
+        }
+
+        // Tallies the samples while they are fewer than the elements, and
+        // otherwise draws the count of each element from the binomial
+        // distribution conditioned on the counts of the preceding elements,
+        // which takes O(n) time regardless of 'count'.
+        virtual void sample_counts_impl(
+                            size_t count,
+                            std::vector<std::pair<T, size_t>>& counts) {
+            if (count < this->m_size) {
+                ProbabilityDistribution<T, Engine>::sample_counts_impl(count,
+                                                                       counts);
+                return;
+            }
+
+            double remaining_weight = this->m_total_weight;
+
+            for (size_t i = 0; i < this->m_size && count > 0; ++i) {
+                double weight = m_weight_storage_vector[i];
+                size_t element_count =
+                    i == this->m_size - 1 ?
+                    count :
+                    this->generate_binomial(count, weight / remaining_weight);
+
+                if (element_count > 0) {
+                    counts.emplace_back(get_element(i),
+                                        element_count);
+                    count -= element_count;
+                }
+
+                remaining_weight -= weight;
+            }
+        }
+
+        // Masking an element would invalidate the alias table, so the
+        // elements already drawn are rejected instead. Once they hold half of
+        // the total weight, the expected number of rejections per draw
+        // exceeds one, and the remaining draws are finished in a single pass
+        // of exponential keys (Efraimidis and Spirakis).
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            if (m_dirty) {
+                build_alias_table();
+            }
+
+            std::unordered_set<size_t> sampled_indices;
+            double sampled_weight = 0.0;
+
+            while (count > 0 && 2.0 * sampled_weight < this->m_total_weight) {
+                size_t index = sample_index(this->m_generator);
+
+                if (sampled_indices.insert(index).second) {
+                    sampled_weight += m_weight_storage_vector[index];
+                    samples.push_back(get_element(index));
+                    count--;
+                }
+            }
+
+            if (count == 0) {
+                return;
+            }
+
+            // Drawing the rest sequentially is equivalent to taking the
+            // 'count' remaining elements with the smallest keys E / w, where
+            // E is a standard exponential variate:
+            std::vector<std::pair<double, size_t>> keys;
+            keys.reserve(this->m_size - sampled_indices.size());
+
+            for (size_t index = 0; index < this->m_size; ++index) {
+                if (sampled_indices.find(index) == sampled_indices.cend()) {
+                    double exponential = -std::log(1.0 -
+                                                   this->generate_uniform());
+
+                    keys.emplace_back(
+                            exponential / m_weight_storage_vector[index],
+                            index);
+                }
+            }
+
+            std::partial_sort(keys.begin(), keys.begin() + count, keys.end());
+
+            for (size_t i = 0; i < count; ++i) {
+                samples.push_back(get_element(keys[i].second));
+            }
+        }
+
+    private:
+        // Maps each element to its handle index.
+        typedef FlatHashIndex<T, Hash, KeyEqual> index_type;
+
+        std::pmr::vector<T>        m_element_storage_vector;
+        std::pmr::vector<double>   m_weight_storage_vector;
+        std::pmr::vector<uint32_t> m_handle_index_vector;
+        std::pmr::vector<double>   m_probability_vector;
+        std::pmr::vector<size_t>   m_alias_vector;
+        index_type                 m_element_index;
+        HandleTable<size_t>        m_handle_table;
+        bool                       m_dirty;
+
+        const T& get_element(size_t index) const {
+            return m_element_storage_vector[index];
+        }
+
+        uint32_t find_handle_index(T const& element) const {
+            return find_handle_index(element, m_element_index.hash(element));
+        }
+
+        uint32_t find_handle_index(T const& element, uint32_t hash) const {
+            return m_element_index.find(
+                        element,
+                        hash,
+                        [this](uint32_t handle_index) -> const T& {
+                            return get_element(
+                                m_handle_table.get_position(handle_index));
+                        });
+        }
+
+        template<typename Element>
+        ElementHandle insert_element(Element&& element, double weight) {
+            uint32_t hash = m_element_index.hash(element);
+
+            if (find_handle_index(element, hash) != index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+
+            this->check_weight(weight);
+            m_element_storage_vector.push_back(std::forward<Element>(element));
+
+            ElementHandle handle = m_handle_table.acquire(this->m_size);
+            m_handle_index_vector.push_back(handle.index);
+            m_weight_storage_vector.push_back(weight);
+            m_element_index.insert(hash, handle.index);
+            this->m_total_weight += weight;
+            this->m_size++;
+            m_dirty = true;
+            return handle;
+        }
+
+        // Removes the element at 'target_index', which is already erased from
+        // the element index.
+        void remove_at(size_t target_index) {
+            size_t last_index = m_element_storage_vector.size() - 1;
+            double weight     = m_weight_storage_vector[target_index];
+
+            m_handle_table.release(m_handle_index_vector[target_index]);
+
+            // Fill the hole with the last element so that the storage stays
+            // contiguous:
+            if (target_index != last_index) {
+                m_element_storage_vector[target_index] =
+                    std::move(m_element_storage_vector[last_index]);
+
+                m_weight_storage_vector[target_index] =
+                    m_weight_storage_vector[last_index];
+
+                m_handle_index_vector[target_index] =
+                    m_handle_index_vector[last_index];
+
+                m_handle_table.set_position(
+                                    m_handle_index_vector[target_index],
+                                    target_index);
+            }
+
+            m_element_storage_vector.pop_back();
+            m_weight_storage_vector.pop_back();
+            m_handle_index_vector.pop_back();
+
+            this->m_size--;
+            this->m_total_weight -= weight;
+            m_dirty = true;
+        }
+
+        void update_weight_at(size_t index, double weight) {
+            this->check_weight(weight);
+            double& stored_weight = m_weight_storage_vector[index];
+            this->m_total_weight += weight - stored_weight;
+            stored_weight = weight;
+            m_dirty = true;
+        }
+
+        size_t sample_index(Engine& generator) const {
+            // One uniform variate yields both the column (integral part) and
+            // the biased coin toss within the column (fractional part):
+            double value = generate_uniform_double(generator) *
+                           this->m_size;
+
+            size_t index = static_cast<size_t>(value);
+
+            if (index >= this->m_size) {
+                index = this->m_size - 1;
+            }
+
+            if (value - index < m_probability_vector[index]) {
+                return index;
+            }
+
+            return m_alias_vector[index];
+        }
+
+        void build_alias_table() {
+            size_t size = m_weight_storage_vector.size();
+
+            // Recompute the total weight from scratch so that the rounding
+            // errors of the incremental updates do not accumulate:
+            double total_weight = 0.0;
+
+            for (double weight : m_weight_storage_vector) {
+                total_weight += weight;
+            }
+
+            this->m_total_weight = total_weight;
+
+            m_probability_vector.resize(size);
+            m_alias_vector.resize(size);
+
+            std::vector<size_t> small_stack;
+            std::vector<size_t> large_stack;
+
+            for (size_t i = 0; i < size; ++i) {
+                m_probability_vector[i] =
+                    m_weight_storage_vector[i] * size / total_weight;
+
+                if (m_probability_vector[i] < 1.0) {
+                    small_stack.push_back(i);
+                } else {
+                    large_stack.push_back(i);
+                }
+            }
+
+            while (!small_stack.empty() && !large_stack.empty()) {
+                size_t small_index = small_stack.back();
+                size_t large_index = large_stack.back();
+                small_stack.pop_back();
+
+                m_alias_vector[small_index] = large_index;
+                m_probability_vector[large_index] -=
+                    1.0 - m_probability_vector[small_index];
+
+                if (m_probability_vector[large_index] < 1.0) {
+                    large_stack.pop_back();
+                    small_stack.push_back(large_index);
+                }
+            }
+
+            // Whatever is left over is off from 1.0 only due to rounding:
+            for (size_t index : large_stack) {
+                m_probability_vector[index] = 1.0;
+                m_alias_vector[index]       = index;
+            }
+
+            for (size_t index : small_stack) {
+                m_probability_vector[index] = 1.0;
+                m_alias_vector[index]       = index;
+            }
+
+            m_dirty = false;
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_ALIAS_PROBABILITY_DISTRIBUTION_HPP
@@ -1,10 +1,12 @@
 #ifndef NET_CODERODDE_UTIL_ARRAY_PROBABILITY_DISTRIBUTION_HPP
 #define NET_CODERODDE_UTIL_ARRAY_PROBABILITY_DISTRIBUTION_HPP
 
+#include "FlatHashIndex.hpp"
 #include "ProbabilityDistribution.hpp"
-#include <iterator>
+#include "WeightScan.hpp"
+#include <functional>
+#include <memory_resource>
 #include <random>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -12,65 +14,92 @@ namespace net {
 namespace coderodde {
 namespace util {
     
-    template<typename T>
-    class ArrayProbabilityDistribution : public ProbabilityDistribution<T> {
+    // 'Hash' and 'KeyEqual' hash and compare the elements in the element
+    // index.
+    template<typename T,
+             typename Engine = std::mt19937,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class ArrayProbabilityDistribution final :
+    public ProbabilityDistribution<T, Engine> {
     
     public:
-        ArrayProbabilityDistribution() : ProbabilityDistribution<T>() {}
+        ArrayProbabilityDistribution() : ProbabilityDistribution<T, Engine>() {}
         ArrayProbabilityDistribution(std::random_device::result_type seed) :
-        ProbabilityDistribution<T>(seed) {}
+        ProbabilityDistribution<T, Engine>(seed) {}
+        
+        // The storage arrays and the element index are allocated from
+        // 'resource'.
+        ArrayProbabilityDistribution(std::pmr::memory_resource* resource) :
+        ProbabilityDistribution<T, Engine>(),
+        m_element_storage_vector(resource),
+        m_weight_storage_vector(resource),
+        m_handle_index_vector(resource),
+        m_element_index(resource),
+        m_handle_table(resource) {}
+        
+        ArrayProbabilityDistribution(std::random_device::result_type seed,
+                                     std::pmr::memory_resource* resource) :
+        ProbabilityDistribution<T, Engine>(seed),
+        m_element_storage_vector(resource),
+        m_weight_storage_vector(resource),
+        m_handle_index_vector(resource),
+        m_element_index(resource),
+        m_handle_table(resource) {}
         
         ArrayProbabilityDistribution(
-            const ArrayProbabilityDistribution<T>& other) {
-            this->m_size             = other.m_size;
-            this->m_total_weight     = other.m_total_weight;
+            const ArrayProbabilityDistribution& other) :
+        ProbabilityDistribution<T, Engine>(other) {
             m_element_storage_vector = other.m_element_storage_vector;
             m_weight_storage_vector  = other.m_weight_storage_vector;
-            m_filter_set             = other.m_filter_set;
+            m_handle_index_vector    = other.m_handle_index_vector;
+            m_element_index          = other.m_element_index;
+            m_handle_table           = other.m_handle_table;
         }
         
         ArrayProbabilityDistribution(
-            ArrayProbabilityDistribution<T>&& other) {
-            this->m_size             = other.m_size;
-            this->m_total_weight     = other.m_total_weight;
-            m_element_storage_vector =
-                std::move(other.m_element_storage_vector);
-            
-            m_weight_storage_vector  = std::move(other.m_weight_storage_vector);
-            m_filter_set             = std::move(other.m_filter_set);
-            
-            other.m_size         = 0;
-            other.m_total_weight = 0.0;
+            ArrayProbabilityDistribution&& other) :
+        ProbabilityDistribution<T, Engine>(other),
+        m_element_storage_vector(std::move(other.m_element_storage_vector)),
+        m_weight_storage_vector(std::move(other.m_weight_storage_vector)),
+        m_handle_index_vector(std::move(other.m_handle_index_vector)),
+        m_element_index(std::move(other.m_element_index)),
+        m_handle_table(std::move(other.m_handle_table)) {
+            other.clear();
         }
         
         ArrayProbabilityDistribution& operator=(
-            const ArrayProbabilityDistribution<T>& other) {
-            this->m_size             = other.m_size;
-            this->m_total_weight     = other.m_total_weight;
+            const ArrayProbabilityDistribution& other) {
+            if (this == &other) {
+                return *this;
+            }
+            
+            ProbabilityDistribution<T, Engine>::operator=(other);
             m_element_storage_vector = other.m_element_storage_vector;
             m_weight_storage_vector  = other.m_weight_storage_vector;
-            m_filter_set             = other.m_filter_set;
+            m_handle_index_vector    = other.m_handle_index_vector;
+            m_element_index          = other.m_element_index;
+            m_handle_table           = other.m_handle_table;
             return *this;
         }
         
         ArrayProbabilityDistribution& operator=(
-            ArrayProbabilityDistribution<T>&& other) {
+            ArrayProbabilityDistribution&& other) {
             if (this == &other) {
                 return *this;
             }
             
-            this->m_size         = other.m_size;
-            this->m_total_weight = other.m_total_weight;
+            ProbabilityDistribution<T, Engine>::operator=(other);
             
             m_element_storage_vector =
                 std::move(other.m_element_storage_vector);
             
             m_weight_storage_vector = std::move(other.m_weight_storage_vector);
-            m_filter_set            = std::move(other.m_filter_set);
-            
-            other.m_size         = 0;
-            other.m_total_weight = 0.0;
+            m_handle_index_vector   = std::move(other.m_handle_index_vector);
+            m_element_index         = std::move(other.m_element_index);
+            m_handle_table          = std::move(other.m_handle_table);
             
+            other.clear();
             return *this;
         }
         
@@ -83,79 +112,344 @@ namespace util {
         }
         
         virtual bool add_element(T const& element, double weight) {
-            if (m_filter_set.find(element) != m_filter_set.cend()) {
-                return false;
-            }
-            
-            this->check_weight(weight);
-            m_element_storage_vector.push_back(element);
-            m_weight_storage_vector.push_back(weight);
-            m_filter_set.insert(element);
-            this->m_total_weight += weight;
-            this->m_size++;
-            return true;
+            return !insert_element(element, weight).is_null();
+        }
+        
+        virtual bool add_element(T&& element, double weight) {
+            return !insert_element(std::move(element), weight).is_null();
+        }
+        
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) {
+            return insert_element(element, weight);
+        }
+        
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) {
+            return insert_element(std::move(element), weight);
         }
         
         virtual T sample_element() {
+            return sample_element_reference();
+        }
+        
+        virtual const T& sample_element_reference() {
             this->check_not_empty();
-            double value = this->m_real_distribution(this->m_generator) *
-                           this->m_total_weight;
+            return get_element(sample_index(this->m_generator));
+        }
+        
+        virtual ElementHandle sample_handle() {
+            this->check_not_empty();
+            size_t index = sample_index(this->m_generator);
+            return m_handle_table.get_handle(m_handle_index_vector[index]);
+        }
+        
+        virtual ElementHandle get_handle(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
             
-            for (size_t i = 0; i < this->m_size; ++i) {
-                if (value < m_weight_storage_vector[i]) {
-                    return m_element_storage_vector[i];
-                }
-                
-                value -= m_weight_storage_vector[i];
+            if (handle_index == index_type::NOT_FOUND) {
+                return ElementHandle{};
             }
             
-            throw std::logic_error{"Should not get here."};
+            return m_handle_table.get_handle(handle_index);
+        }
+        
+        virtual bool contains_handle(ElementHandle handle) const {
+            return m_handle_table.contains(handle);
+        }
+        
+        virtual const T& get_element(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return get_element(m_handle_table.get_position(handle.index));
         }
         
         virtual bool contains_element(T const& element) const {
-            return m_filter_set.find(element) != m_filter_set.cend();
+            return find_handle_index(element) != index_type::NOT_FOUND;
         }
         
         virtual bool remove_element(T const& element) {
-            if (!contains_element(element)) {
+            uint32_t hash = m_element_index.hash(element);
+            uint32_t handle_index = find_handle_index(element, hash);
+            
+            if (handle_index == index_type::NOT_FOUND) {
                 return false;
             }
             
-            auto target_element_iterator =
-            std::find(m_element_storage_vector.begin(),
-                      m_element_storage_vector.end(),
-                      element);
-            
-            size_t target_index =
-            std::distance(m_element_storage_vector.begin(),
-                          target_element_iterator);
+            m_element_index.erase(hash, handle_index);
+            remove_at(m_handle_table.get_position(handle_index));
+            return true;
+        }
+        
+        virtual bool remove_element(ElementHandle handle) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
             
-            m_element_storage_vector.erase(target_element_iterator);
+            size_t index = m_handle_table.get_position(handle.index);
+            m_element_index.erase(m_element_index.hash(get_element(index)),
+                                  handle.index);
+            remove_at(index);
+            return true;
+        }
+        
+        virtual bool update_weight(T const& element, double weight) {
+            uint32_t handle_index = find_handle_index(element);
             
-            auto target_weight_iterator = m_weight_storage_vector.begin();
-            std::advance(target_weight_iterator, target_index);
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
             
-            double weight = m_weight_storage_vector[target_index];
-            m_weight_storage_vector.erase(target_weight_iterator);
-            m_filter_set.erase(element);
+            update_weight_at(m_handle_table.get_position(handle_index), weight);
+            return true;
+        }
+        
+        virtual bool update_weight(ElementHandle handle, double weight) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
             
-            this->m_size--;
-            this->m_total_weight -= weight;
+            update_weight_at(m_handle_table.get_position(handle.index), weight);
             return true;
         }
         
+        virtual double get_weight(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            this->check_contains(handle_index != index_type::NOT_FOUND);
+            return m_weight_storage_vector[
+                        m_handle_table.get_position(handle_index)];
+        }
+        
+        virtual double get_weight(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            size_t index = m_handle_table.get_position(handle.index);
+            return m_weight_storage_vector[index];
+        }
+        
         virtual void clear() {
             this->m_size = 0;
             this->m_total_weight = 0.0;
             m_element_storage_vector.clear();
             m_weight_storage_vector.clear();
-            m_filter_set.clear();
+            m_handle_index_vector.clear();
+            m_element_index.clear();
+            m_handle_table.clear();
+        }
+        
+    protected:
+        
+        virtual const T& sample_element_with(Engine& generator) const {
+            return get_element(sample_index(generator));
+        }
+        
+        // Sweeps the weight array once for the entire batch of sorted
+        // values, which takes O(count + n) time in total.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<double> values = this->generate_sorted_values(count);
+            size_t last_index = this->m_size - 1;
+            size_t index = 0;
+            double prefix_sum = m_weight_storage_vector[0];
+            
+            for (double value : values) {
+                while (value >= prefix_sum && index < last_index) {
+                    prefix_sum += m_weight_storage_vector[++index];
+                }
+                
+                samples.push_back(get_element(index));
+            }
+            
+            this->shuffle_samples(samples);
+        }
+        
+        // Draws the count of each element from the binomial distribution
+        // conditioned on the counts of the preceding elements. Stops as soon
+        // as the whole count is distributed.
+        virtual void sample_counts_impl(
+                            size_t count,
+                            std::vector<std::pair<T, size_t>>& counts) {
+            double remaining_weight = this->m_total_weight;
+            
+            for (size_t i = 0; i < this->m_size && count > 0; ++i) {
+                double weight = m_weight_storage_vector[i];
+                size_t element_count =
+                    i == this->m_size - 1 ?
+                    count :
+                    this->generate_binomial(count, weight / remaining_weight);
+                
+                if (element_count > 0) {
+                    counts.emplace_back(get_element(i), element_count);
+                    count -= element_count;
+                }
+                
+                remaining_weight -= weight;
+            }
         }
         
+        // Zeroes the weight of each drawn element so that the scan skips it,
+        // and restores the weights afterwards.
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<std::pair<size_t, double>> sampled_weights;
+            sampled_weights.reserve(count);
+            double remaining_weight = this->m_total_weight;
+            
+            for (size_t i = 0; i < count; ++i) {
+                double uniform = this->generate_uniform();
+                size_t index = this->m_size;
+                
+                if (remaining_weight > 0.0) {
+                    index = scan_weights(m_weight_storage_vector.data(),
+                                         this->m_size,
+                                         uniform * remaining_weight);
+                }
+                
+                // Subtracting a weight far above the others may cancel the
+                // remaining weight out, so that the scan runs past the end
+                // or lands on a drawn element; sum the weights not drawn yet
+                // anew then:
+                if (index == this->m_size ||
+                    m_weight_storage_vector[index] == 0.0) {
+                    remaining_weight = sum_weights();
+                    index = scan_weights(m_weight_storage_vector.data(),
+                                         this->m_size,
+                                         uniform * remaining_weight);
+                }
+                
+                // A scan never stops at a weight of zero. Guard against the
+                // rounding errors in the fresh sum by falling back to the
+                // last element not drawn yet:
+                if (index == this->m_size) {
+                    do {
+                        --index;
+                    } while (m_weight_storage_vector[index] == 0.0);
+                }
+                
+                double& weight = m_weight_storage_vector[index];
+                sampled_weights.emplace_back(index, weight);
+                remaining_weight -= weight;
+                weight = 0.0;
+                samples.push_back(get_element(index));
+            }
+            
+            for (const auto& sampled_weight : sampled_weights) {
+                m_weight_storage_vector[sampled_weight.first] =
+                    sampled_weight.second;
+            }
+        }
+    
     private:
-        std::vector<T>        m_element_storage_vector;
-        std::vector<double>   m_weight_storage_vector;
-        std::unordered_set<T> m_filter_set;
+        // Maps each element to its handle index.
+        typedef FlatHashIndex<T, Hash, KeyEqual> index_type;
+        
+        std::pmr::vector<T>        m_element_storage_vector;
+        std::pmr::vector<double>   m_weight_storage_vector;
+        std::pmr::vector<uint32_t> m_handle_index_vector;
+        index_type                 m_element_index;
+        HandleTable<size_t>        m_handle_table;
+        
+        const T& get_element(size_t index) const {
+            return m_element_storage_vector[index];
+        }
+        
+        double sum_weights() const {
+            double sum = 0.0;
+            
+            for (size_t i = 0; i < this->m_size; ++i) {
+                sum += m_weight_storage_vector[i];
+            }
+            
+            return sum;
+        }
+        
+        uint32_t find_handle_index(T const& element) const {
+            return find_handle_index(element, m_element_index.hash(element));
+        }
+        
+        uint32_t find_handle_index(T const& element, uint32_t hash) const {
+            return m_element_index.find(
+                        element,
+                        hash,
+                        [this](uint32_t handle_index) -> const T& {
+                            return get_element(
+                                m_handle_table.get_position(handle_index));
+                        });
+        }
+        
+        template<typename Element>
+        ElementHandle insert_element(Element&& element, double weight) {
+            uint32_t hash = m_element_index.hash(element);
+            
+            if (find_handle_index(element, hash) != index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+            
+            this->check_weight(weight);
+            m_element_storage_vector.push_back(std::forward<Element>(element));
+            
+            ElementHandle handle = m_handle_table.acquire(this->m_size);
+            m_handle_index_vector.push_back(handle.index);
+            m_weight_storage_vector.push_back(weight);
+            m_element_index.insert(hash, handle.index);
+            this->m_total_weight += weight;
+            this->m_size++;
+            return handle;
+        }
+        
+        size_t sample_index(Engine& generator) const {
+            double value = generate_uniform_double(generator) *
+                           this->m_total_weight;
+            
+            size_t index = scan_weights(m_weight_storage_vector.data(),
+                                        this->m_size,
+                                        value);
+            
+            // Guard against the rounding errors in the total weight:
+            if (index == this->m_size) {
+                index = this->m_size - 1;
+            }
+            
+            return index;
+        }
+        
+        // Removes the element at 'target_index', which is already erased from
+        // the element index.
+        void remove_at(size_t target_index) {
+            size_t last_index = m_element_storage_vector.size() - 1;
+            double weight     = m_weight_storage_vector[target_index];
+            
+            m_handle_table.release(m_handle_index_vector[target_index]);
+            
+            // Move the last element into the hole instead of shifting the
+            // tail of the arrays:
+            if (target_index != last_index) {
+                m_element_storage_vector[target_index] =
+                    std::move(m_element_storage_vector[last_index]);
+                
+                m_weight_storage_vector[target_index] =
+                    m_weight_storage_vector[last_index];
+                
+                m_handle_index_vector[target_index] =
+                    m_handle_index_vector[last_index];
+                
+                m_handle_table.set_position(
+                                    m_handle_index_vector[target_index],
+                                    target_index);
+            }
+            
+            m_element_storage_vector.pop_back();
+            m_weight_storage_vector.pop_back();
+            m_handle_index_vector.pop_back();
+            
+            this->m_size--;
+            this->m_total_weight -= weight;
+        }
+        
+        void update_weight_at(size_t index, double weight) {
+            this->check_weight(weight);
+            double& stored_weight = m_weight_storage_vector[index];
+            this->m_total_weight += weight - stored_weight;
+            stored_weight = weight;
+        }
     };
     
 } // End of namespace net::coderodde::util.
@@ -0,0 +1,286 @@
+#ifndef NET_CODERODDE_UTIL_ATOMIC_FENWICK_TREE_PROBABILITY_DISTRIBUTION_HPP
+#define NET_CODERODDE_UTIL_ATOMIC_FENWICK_TREE_PROBABILITY_DISTRIBUTION_HPP
+
+#include "FlatHashIndex.hpp"
+#include "HandleTable.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // A probability distribution over a fixed set of elements whose weights
+    // are non-negative integer counters, safe to update and sample from any
+    // number of threads without locking. add_to_weight() is a handful of
+    // atomic fetch-adds: one on the counter of the element and one on each
+    // Fenwick node on its path. sample_element() descends the Fenwick tree
+    // with plain atomic loads.
+    //
+    // Consistency: a sample drawn while no update is in flight follows the
+    // weights exactly. During concurrent updates the loads of the descent
+    // may see the nodes at different moments, so a sample follows weights
+    // that mix the states before and after each update in flight, and the
+    // skew is bounded by the deltas of those updates. A descent ending at
+    // an element whose counter reads zero is retried, so an element is
+    // never returned unless its weight was positive at some moment during
+    // the call.
+    //
+    // Like ConcurrentProbabilityDistribution, this class does not derive
+    // from ProbabilityDistribution: the elements are fixed on construction
+    // and the sampling threads pass their own random engines. The handles
+    // of the elements never become invalid.
+    template<typename T,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class AtomicFenwickTreeProbabilityDistribution final {
+    public:
+
+        // Takes the elements and their initial weights, which default to
+        // zero. Throws std::invalid_argument if an element repeats or the
+        // sizes of the vectors differ.
+        explicit AtomicFenwickTreeProbabilityDistribution(
+            std::vector<T> elements,
+            std::vector<uint64_t> weights = {})
+        :
+        m_element_vector(std::move(elements)),
+        m_capacity{1}
+        {
+            size_t size = m_element_vector.size();
+
+            if (weights.empty()) {
+                weights.assign(size, 0);
+            } else if (weights.size() != size) {
+                throw std::invalid_argument{
+                    "The numbers of the elements and the weights differ."
+                };
+            }
+
+            for (size_t i = 0; i < size; ++i) {
+                uint32_t hash = m_element_index.hash(m_element_vector[i]);
+
+                if (find_index(m_element_vector[i], hash) !=
+                    index_type::NOT_FOUND) {
+                    throw std::invalid_argument{
+                        "The input elements are not distinct."
+                    };
+                }
+
+                m_element_index.insert(hash, static_cast<uint32_t>(i));
+            }
+
+            while (m_capacity < size) {
+                m_capacity *= 2;
+            }
+
+            // Build the Fenwick tree in linear time by pushing each node
+            // into its parent, before any other thread sees it:
+            std::vector<uint64_t> tree_vector(m_capacity + 1, 0);
+
+            for (size_t i = 1; i <= m_capacity; ++i) {
+                if (i <= size) {
+                    tree_vector[i] += weights[i - 1];
+                }
+
+                size_t parent = i + (i & (~i + 1));
+
+                if (parent <= m_capacity) {
+                    tree_vector[parent] += tree_vector[i];
+                }
+            }
+
+            m_weights.reset(new std::atomic<uint64_t>[size]);
+            m_fenwick_tree.reset(new std::atomic<uint64_t>[m_capacity + 1]);
+
+            for (size_t i = 0; i < size; ++i) {
+                m_weights[i].store(weights[i], std::memory_order_relaxed);
+            }
+
+            for (size_t i = 0; i <= m_capacity; ++i) {
+                m_fenwick_tree[i].store(tree_vector[i],
+                                        std::memory_order_relaxed);
+            }
+        }
+
+        AtomicFenwickTreeProbabilityDistribution(
+            const AtomicFenwickTreeProbabilityDistribution&) = delete;
+
+        AtomicFenwickTreeProbabilityDistribution& operator=(
+            const AtomicFenwickTreeProbabilityDistribution&) = delete;
+
+        size_t size() const {
+            return m_element_vector.size();
+        }
+
+        bool contains_element(T const& element) const {
+            return find_index(element) != index_type::NOT_FOUND;
+        }
+
+        // Returns the handle of the element, or the null handle if the
+        // element is not in the distribution.
+        ElementHandle get_handle(T const& element) const {
+            uint32_t index = find_index(element);
+
+            if (index == index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+
+            return ElementHandle{index, 1};
+        }
+
+        bool contains_handle(ElementHandle handle) const {
+            return handle.index < size() && handle.generation == 1;
+        }
+
+        const T& get_element(ElementHandle handle) const {
+            check_handle(handle);
+            return m_element_vector[handle.index];
+        }
+
+        // Throws std::invalid_argument if the element is not present.
+        uint64_t get_weight(T const& element) const {
+            return get_weight(get_handle(element));
+        }
+
+        uint64_t get_weight(ElementHandle handle) const {
+            check_handle(handle);
+            return m_weights[handle.index].load(std::memory_order_relaxed);
+        }
+
+        uint64_t get_total_weight() const {
+            return m_fenwick_tree[m_capacity].load(std::memory_order_relaxed);
+        }
+
+        // Adds 'delta' to the weight of the element, which must not drop
+        // below zero. Returns false if the element is not present.
+        bool add_to_weight(T const& element, int64_t delta) {
+            uint32_t index = find_index(element);
+
+            if (index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            add_to_weight_at(index, delta);
+            return true;
+        }
+
+        // Throws std::invalid_argument for a handle of no element.
+        void add_to_weight(ElementHandle handle, int64_t delta) {
+            check_handle(handle);
+            add_to_weight_at(handle.index, delta);
+        }
+
+        // Throws std::length_error if all the weights are zero.
+        template<typename Generator>
+        const T& sample_element(Generator& generator) const {
+            return m_element_vector[sample_index(generator)];
+        }
+
+        template<typename Generator>
+        ElementHandle sample_handle(Generator& generator) const {
+            return ElementHandle{sample_index(generator), 1};
+        }
+
+    private:
+
+        // Maps each element to its index.
+        typedef FlatHashIndex<T, Hash, KeyEqual> index_type;
+
+        typedef std::unique_ptr<std::atomic<uint64_t>[]> counter_array;
+
+        std::vector<T> m_element_vector;
+        index_type     m_element_index;
+        size_t         m_capacity;
+        counter_array  m_weights;
+
+        // One-based over the power-of-two capacity, so that the last node
+        // holds the total weight; the entry at index 0 is a dummy.
+        counter_array  m_fenwick_tree;
+
+        uint32_t find_index(T const& element) const {
+            return find_index(element, m_element_index.hash(element));
+        }
+
+        uint32_t find_index(T const& element, uint32_t hash) const {
+            return m_element_index.find(
+                        element,
+                        hash,
+                        [this](uint32_t index) -> const T& {
+                            return m_element_vector[index];
+                        });
+        }
+
+        void check_handle(ElementHandle handle) const {
+            if (!contains_handle(handle)) {
+                throw std::invalid_argument{
+                    "The input handle refers to no element of this "
+                    "probability distribution."
+                };
+            }
+        }
+
+        // The counters wrap around modulo 2^64, so adding the two's
+        // complement of a negative delta subtracts it.
+        void add_to_weight_at(size_t index, int64_t delta) {
+            uint64_t increment = static_cast<uint64_t>(delta);
+            m_weights[index].fetch_add(increment, std::memory_order_relaxed);
+
+            for (size_t i = index + 1; i <= m_capacity; i += i & (~i + 1)) {
+                m_fenwick_tree[i].fetch_add(increment,
+                                            std::memory_order_relaxed);
+            }
+        }
+
+        template<typename Generator>
+        uint32_t sample_index(Generator& generator) const {
+            for (;;) {
+                uint64_t total_weight = get_total_weight();
+
+                if (total_weight == 0) {
+                    throw std::length_error{
+                        "All the weights of this probability distribution "
+                        "are zero."
+                    };
+                }
+
+                uint64_t value =
+                    std::uniform_int_distribution<uint64_t>{
+                        0,
+                        total_weight - 1
+                    }(generator);
+
+                // Find the longest prefix whose sum is at most 'value':
+                size_t index = 0;
+
+                for (size_t step = m_capacity / 2; step != 0; step >>= 1) {
+                    uint64_t node_value =
+                        m_fenwick_tree[index + step].load(
+                                                std::memory_order_relaxed);
+
+                    if (node_value <= value) {
+                        index += step;
+                        value -= node_value;
+                    }
+                }
+
+                // The concurrent updates may have let the descent run past
+                // the elements of positive weight:
+                if (index < size() &&
+                    m_weights[index].load(std::memory_order_relaxed) > 0) {
+                    return static_cast<uint32_t>(index);
+                }
+            }
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_ATOMIC_FENWICK_TREE_PROBABILITY_DISTRIBUTION_HPP
@@ -1,55 +1,80 @@
 #ifndef NET_CODERODDE_UTIL_BINARY_TREE_PROBABILITY_DISTRIBUTION_HPP
 #define NET_CODERODDE_UTIL_BINARY_TREE_PROBABILITY_DISTRIBUTION_HPP
 
+#include "FlatHashIndex.hpp"
+#include "NodePool.hpp"
 #include "ProbabilityDistribution.hpp"
-#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <memory_resource>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace net {
 namespace coderodde {
 namespace util {
     
-    template<typename T>
-    class BinaryTreeProbabilityDistribution :
-    public ProbabilityDistribution<T> {
+    // 'Hash' and 'KeyEqual' hash and compare the elements in the element
+    // index.
+    template<typename T,
+             typename Engine = std::mt19937,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class BinaryTreeProbabilityDistribution final :
+    public ProbabilityDistribution<T, Engine> {
     private:
         
+        // Only a leaf holds an element; in a relay node the element is left
+        // unconstructed.
         class TreeNode {
         private:
             
-            T         m_element;
-            double    m_weight;
-            bool      m_is_relay_node;
-            TreeNode* m_left_child;
-            TreeNode* m_right_child;
-            TreeNode* m_parent;
-            size_t    m_leaf_node_count;
+            union {
+                T m_element;
+            };
+            
+            double       m_weight;
+            bool         m_is_relay_node;
+            TreeNode*    m_left_child;
+            TreeNode*    m_right_child;
+            TreeNode*    m_parent;
+            size_t       m_leaf_node_count;
+            uint32_t     m_handle_index;
             
         public:
             
-            TreeNode(T element, double weight)
+            template<typename Element>
+            TreeNode(Element&& element, double weight)
             :
-            m_element{element},
+            m_element(std::forward<Element>(element)),
             m_weight{weight},
             m_is_relay_node{false},
             m_leaf_node_count{1},
             m_left_child{nullptr},
             m_right_child{nullptr},
-            m_parent{nullptr}
+            m_parent{nullptr},
+            m_handle_index{}
             {}
             
             TreeNode()
             :
-            m_element{},
             m_weight{},
             m_is_relay_node{true},
             m_leaf_node_count{},
             m_left_child{nullptr},
             m_right_child{nullptr},
-            m_parent{nullptr}
+            m_parent{nullptr},
+            m_handle_index{}
             {}
             
-            T get_element() const {
+            ~TreeNode() {
+                if (!m_is_relay_node) {
+                    m_element.~T();
+                }
+            }
+            
+            const T& get_element() const {
                 return m_element;
             }
             
@@ -61,6 +86,14 @@ namespace util {
                 m_weight = weight;
             }
             
+            uint32_t get_handle_index() const {
+                return m_handle_index;
+            }
+            
+            void set_handle_index(uint32_t handle_index) {
+                m_handle_index = handle_index;
+            }
+            
             size_t get_number_of_leaves() const {
                 return m_leaf_node_count;
             }
@@ -111,87 +144,450 @@ namespace util {
         
         BinaryTreeProbabilityDistribution(std::random_device::result_type seed)
         :
-        ProbabilityDistribution<T>{seed},
-        m_root{nullptr}
+        BinaryTreeProbabilityDistribution(seed,
+                                          std::pmr::get_default_resource())
+        {}
+        
+        // The tree nodes and the element index are allocated from 'resource'.
+        BinaryTreeProbabilityDistribution(std::pmr::memory_resource* resource)
+        :
+        BinaryTreeProbabilityDistribution(std::random_device::result_type{},
+                                          resource)
+        {}
+        
+        BinaryTreeProbabilityDistribution(std::random_device::result_type seed,
+                                          std::pmr::memory_resource* resource)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_element_index{resource},
+        m_node_pool{resource},
+        m_handle_table{resource},
+        m_root{nullptr},
+        m_weight_shaped{false},
+        m_modification_count{0}
         {}
         
         BinaryTreeProbabilityDistribution(
-            const BinaryTreeProbabilityDistribution<T>& other) {
-            this->m_size         = other.m_size;
-            this->m_total_weight = other.m_total_weight;
+            const BinaryTreeProbabilityDistribution& other)
+        :
+        ProbabilityDistribution<T, Engine>{other}
+        {
+            m_weight_shaped      = other.m_weight_shaped;
+            m_modification_count = other.m_modification_count;
+            m_element_index      = other.m_element_index;
+            m_handle_table       = other.m_handle_table;
             
             // Copy the internal tree:
             copy_tree(other.m_root);
         }
         
         BinaryTreeProbabilityDistribution(
-            BinaryTreeProbabilityDistribution<T>&& other) {
-            this->m_size         = other.m_size;
-            this->m_total_weight = other.m_total_weight;
-            
-            m_map  = std::move(other.m_map);
-            m_root = other.m_root;
-            
+            BinaryTreeProbabilityDistribution&& other)
+        :
+        ProbabilityDistribution<T, Engine>{other},
+        m_element_index{std::move(other.m_element_index)},
+        m_node_pool{std::move(other.m_node_pool)},
+        m_handle_table{std::move(other.m_handle_table)},
+        m_root{other.m_root},
+        m_weight_shaped{other.m_weight_shaped},
+        m_modification_count{other.m_modification_count}
+        {
+            other.m_element_index.clear();
+            other.m_handle_table.clear();
             other.m_size         = 0;
             other.m_total_weight = 0.0;
             other.m_root         = nullptr;
         }
         
+        ~BinaryTreeProbabilityDistribution() {
+            delete_tree();
+        }
+        
         BinaryTreeProbabilityDistribution& operator=(
-            const BinaryTreeProbabilityDistribution<T>& other) {
+            const BinaryTreeProbabilityDistribution& other) {
             if (this == &other) {
                 return *this;
             }
             
             delete_tree();
+            m_element_index = other.m_element_index;
+            m_handle_table  = other.m_handle_table;
             copy_tree(other.m_root);
             
-            this->m_size         = other.m_size;
-            this->m_total_weight = other.m_total_weight;
+            ProbabilityDistribution<T, Engine>::operator=(other);
+            m_weight_shaped      = other.m_weight_shaped;
+            m_modification_count = other.m_modification_count;
             return *this;
         }
         
         BinaryTreeProbabilityDistribution& operator=(
-            BinaryTreeProbabilityDistribution<T>&& other) {
+            BinaryTreeProbabilityDistribution&& other) {
             if (this == &other) {
                 return *this;
             }
             
             delete_tree();
             
-            this->m_size         = other.m_size;
-            this->m_total_weight = other.m_total_weight;
-            this->m_root         = other.m_root;
-            this->m_map          = std::move(other.m_map);
+            ProbabilityDistribution<T, Engine>::operator=(other);
+            m_weight_shaped      = other.m_weight_shaped;
+            m_modification_count = other.m_modification_count;
+            m_element_index      = std::move(other.m_element_index);
+            m_handle_table       = std::move(other.m_handle_table);
             
-            other.m_size         = 0;
-            other.m_total_weight = 0.0;
-            other.m_root         = nullptr;
+            if (m_node_pool.get_memory_resource() ==
+                other.m_node_pool.get_memory_resource()) {
+                m_node_pool.swap(other.m_node_pool);
+                m_root = other.m_root;
+                other.m_root = nullptr;
+            } else {
+                // The nodes may not migrate to another memory resource:
+                copy_tree(other.m_root);
+            }
             
+            other.clear();
             return *this;
         }
         
         virtual bool add_element(T const& element, double weight) {
-            if (m_map.find(element) != m_map.end()) {
+            return !insert_element(element, weight).is_null();
+        }
+        
+        virtual bool add_element(T&& element, double weight) {
+            return !insert_element(std::move(element), weight).is_null();
+        }
+        
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) {
+            return insert_element(element, weight);
+        }
+        
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) {
+            return insert_element(std::move(element), weight);
+        }
+        
+        virtual bool contains_element(T const& element) const {
+            return find_handle_index(element) != index_type::NOT_FOUND;
+        }
+        
+        virtual T sample_element() {
+            return sample_element_reference();
+        }
+        
+        virtual const T& sample_element_reference() {
+            this->check_not_empty();
+            return sample_leaf_node(this->m_generator)->get_element();
+        }
+        
+        virtual ElementHandle sample_handle() {
+            this->check_not_empty();
+            return m_handle_table.get_handle(
+                                    sample_leaf_node(this->m_generator)
+                                        ->get_handle_index());
+        }
+        
+        virtual ElementHandle get_handle(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            
+            if (handle_index == index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+            
+            return m_handle_table.get_handle(handle_index);
+        }
+        
+        virtual bool contains_handle(ElementHandle handle) const {
+            return m_handle_table.contains(handle);
+        }
+        
+        virtual const T& get_element(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return m_handle_table.get_position(handle.index)->get_element();
+        }
+        
+        virtual bool remove_element(T const& element) {
+            uint32_t hash = m_element_index.hash(element);
+            uint32_t handle_index = find_handle_index(element, hash);
+            
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+            
+            m_element_index.erase(hash, handle_index);
+            remove_leaf_node(m_handle_table.get_position(handle_index));
+            return true;
+        }
+        
+        virtual bool remove_element(ElementHandle handle) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+            
+            TreeNode* node = m_handle_table.get_position(handle.index);
+            m_element_index.erase(m_element_index.hash(node->get_element()),
+                                  handle.index);
+            remove_leaf_node(node);
+            return true;
+        }
+        
+        virtual bool update_weight(T const& element, double weight) {
+            uint32_t handle_index = find_handle_index(element);
+            
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+            
+            set_leaf_weight(m_handle_table.get_position(handle_index), weight);
+            return true;
+        }
+        
+        virtual bool update_weight(ElementHandle handle, double weight) {
+            if (!m_handle_table.contains(handle)) {
                 return false;
             }
             
+            set_leaf_weight(m_handle_table.get_position(handle.index), weight);
+            return true;
+        }
+        
+        virtual double get_weight(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            this->check_contains(handle_index != index_type::NOT_FOUND);
+            return m_handle_table.get_position(handle_index)->get_weight();
+        }
+        
+        virtual double get_weight(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return m_handle_table.get_position(handle.index)->get_weight();
+        }
+        
+        // Returns the length of the longest path from the root to a leaf.
+        size_t get_height() const {
+            return get_height(m_root);
+        }
+        
+        // Returns the length of the path from the root to the leaf of the
+        // element.
+        size_t get_depth(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            this->check_contains(handle_index != index_type::NOT_FOUND);
+            size_t depth = 0;
+            
+            for (TreeNode* node =
+                    m_handle_table.get_position(handle_index)->get_parent();
+                 node != nullptr;
+                 node = node->get_parent()) {
+                depth++;
+            }
+            
+            return depth;
+        }
+        
+        // Returns the expected length of the path that sample_element()
+        // descends. Each relay node is passed by exactly the samples that end
+        // up in its subtree, so this is the sum of the relay weights over the
+        // total weight.
+        double get_expected_depth() const {
+            if (m_root == nullptr) {
+                return 0.0;
+            }
+            
+            return get_relay_weight_sum(m_root) / m_root->get_weight();
+        }
+        
+        // Selects the shape of the tree and rebuilds it accordingly. By
+        // default, the tree is balanced by leaf counts, which keeps every
+        // leaf within ceil(log2(n)) levels of the root. A weight-shaped tree
+        // is shaped like a Huffman code tree instead, and is rebuilt whenever
+        // it has seen as many modifications as it holds elements, which
+        // amortizes the rebuilds to O(log n) time per modification. New
+        // elements descend towards the lighter subtree in the meantime.
+        void set_weight_shaped(bool weight_shaped) {
+            m_weight_shaped = weight_shaped;
+            rebuild();
+        }
+        
+        bool is_weight_shaped() const {
+            return m_weight_shaped;
+        }
+        
+        // Rebuilds the tree in its current shape, for instance after loading
+        // a weight-shaped tree in bulk. Runs in O(n log n) time, reusing the
+        // relay nodes.
+        void rebuild() {
+            if (m_weight_shaped) {
+                rebuild_by_weight();
+            } else {
+                rebuild_by_leaf_count();
+            }
+        }
+        
+        virtual void clear() {
+            delete_tree();
+            m_element_index.clear();
+            m_handle_table.clear();
+            
+            m_root               = nullptr;
+            m_modification_count = 0;
+            this->m_size         = 0;
+            this->m_total_weight = 0.0;
+        }
+        
+    protected:
+        
+        virtual const T& sample_element_with(Engine& generator) const {
+            return sample_leaf_node(generator)->get_element();
+        }
+        
+        // Descends with the whole batch of sorted values at once: each relay
+        // node splits its range of values by the weight of its left subtree,
+        // so every node is visited at most once per batch.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<double> values = this->generate_sorted_values(count);
+            sample_elements_impl(m_root,
+                                 values.data(),
+                                 values.data() + values.size(),
+                                 0.0,
+                                 samples);
+            
+            this->shuffle_samples(samples);
+        }
+        
+        // Splits the count binomially at each relay node according to the
+        // weights of its subtrees. Only the subtrees that receive a positive
+        // count are visited, so the cost is O(k log n) for k distinct
+        // elements drawn, independently of 'count'.
+        virtual void sample_counts_impl(
+                            size_t count,
+                            std::vector<std::pair<T, size_t>>& counts) {
+            sample_counts_impl(m_root, count, counts);
+        }
+        
+        // Zeroes the leaf of each drawn element and recomputes the weights of
+        // its ancestors from their children, saving every overwritten weight.
+        // The masked leaves carry no probability mass at all, and writing the
+        // saved weights back in reverse order restores the tree exactly.
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<std::pair<TreeNode*, double>> saved_weights;
+            
+            while (count > 0) {
+                TreeNode* leaf_node = nullptr;
+                
+                if (m_root->get_weight() > 0.0) {
+                    leaf_node = sample_unmasked_leaf_node(this->m_generator);
+                }
+                
+                // The relay weights off the masked paths keep the rounding
+                // errors of the differences added to them, which may cancel
+                // a weight far above the others out, so that the descent
+                // misses. Sum all the relay weights anew from the leaves
+                // then: the fresh sums are zero exactly over the masked
+                // leaves only, so the second descent may not miss.
+                if (leaf_node == nullptr || leaf_node->get_weight() == 0.0) {
+                    recompute_relay_weights(m_root, saved_weights);
+                    leaf_node = sample_unmasked_leaf_node(this->m_generator);
+                }
+                
+                saved_weights.emplace_back(leaf_node, leaf_node->get_weight());
+                leaf_node->set_weight(0.0);
+                
+                for (TreeNode* node = leaf_node->get_parent();
+                     node != nullptr;
+                     node = node->get_parent()) {
+                    saved_weights.emplace_back(node, node->get_weight());
+                    node->set_weight(node->get_left_child()->get_weight() +
+                                     node->get_right_child()->get_weight());
+                }
+                
+                samples.push_back(leaf_node->get_element());
+                count--;
+            }
+            
+            for (auto it = saved_weights.crbegin();
+                 it != saved_weights.crend();
+                 ++it) {
+                it->first->set_weight(it->second);
+            }
+        }
+        
+    private:
+        
+        uint32_t find_handle_index(T const& element) const {
+            return find_handle_index(element, m_element_index.hash(element));
+        }
+        
+        uint32_t find_handle_index(T const& element, uint32_t hash) const {
+            return m_element_index.find(
+                        element,
+                        hash,
+                        [this](uint32_t handle_index) -> const T& {
+                            return m_handle_table.get_position(handle_index)
+                                                ->get_element();
+                        });
+        }
+        
+        template<typename Element>
+        ElementHandle insert_element(Element&& element, double weight) {
+            uint32_t hash = m_element_index.hash(element);
+            
+            if (find_handle_index(element, hash) != index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+            
             this->check_weight(weight);
-            TreeNode* new_node = new TreeNode{element, weight};
+            TreeNode* new_node =
+                m_node_pool.create(std::forward<Element>(element), weight);
+            
+            ElementHandle handle = m_handle_table.acquire(new_node);
+            new_node->set_handle_index(handle.index);
+            m_element_index.insert(hash, handle.index);
             insert(new_node);
             this->m_size++;
-            this->m_total_weight += weight;
-            m_map[element] = new_node;
-            return true;
+            update_total_weight();
+            count_modification();
+            return handle;
         }
         
-        virtual bool contains_element(T const& element) const {
-            return m_map.find(element) != m_map.end();
+        // Removes the leaf, whose element is already erased from the element
+        // index.
+        void remove_leaf_node(TreeNode* node) {
+            m_handle_table.release(node->get_handle_index());
+            
+            if (m_weight_shaped) {
+                // Splicing the leaf out lifts its sibling subtree by one
+                // level, which never lengthens a path:
+                unlink_leaf_node(node);
+            } else {
+                // Undo the most recent insertion, which restores the balance
+                // of the leaf counts, and let its leaf fill the hole of the
+                // removed one. This keeps the height at ceil(log2(n)) under
+                // any sequence of insertions and removals.
+                TreeNode* last_leaf_node = find_last_leaf_node();
+                unlink_leaf_node(last_leaf_node);
+                
+                if (last_leaf_node != node) {
+                    replace_leaf_node(node, last_leaf_node);
+                }
+            }
+            
+            m_node_pool.destroy(node);
+            this->m_size--;
+            update_total_weight();
+            count_modification();
         }
         
-        virtual T sample_element() {
-            this->check_not_empty();
-            double value = this->m_real_distribution(this->m_generator) *
+        void set_leaf_weight(TreeNode* node, double weight) {
+            this->check_weight(weight);
+            node->set_weight(weight);
+            update_metadata(node->get_parent(), 0);
+            update_total_weight();
+            count_modification();
+        }
+        
+        TreeNode* sample_leaf_node(Engine& generator) const {
+            double value = generate_uniform_double(generator) *
                            this->m_total_weight;
             
             TreeNode* node = m_root;
@@ -205,33 +601,320 @@ namespace util {
                 }
             }
             
-            return node->get_element();
+            return node;
         }
         
-        virtual bool remove_element(T const& element) {
-            if (!contains_element(element)) {
-                return false;
+        // Descends by the weights relative to the root, never into a child
+        // of no weight when its sibling has some, and so never to a masked
+        // leaf while the relay weights are exact.
+        TreeNode* sample_unmasked_leaf_node(Engine& generator) const {
+            double value = generate_uniform_double(generator) *
+                           m_root->get_weight();
+            
+            TreeNode* node = m_root;
+            
+            while (node->is_relay_node()) {
+                double left_weight  = node->get_left_child()->get_weight();
+                double right_weight = node->get_right_child()->get_weight();
+                
+                if (right_weight <= 0.0 ||
+                    (left_weight > 0.0 && value < left_weight)) {
+                    node = node->get_left_child();
+                } else {
+                    value -= left_weight;
+                    node = node->get_right_child();
+                }
             }
             
-            TreeNode* node = m_map[element];
-            delete_node(node);
-            m_map.erase(element);
-            update_metadata(node->get_parent(), -node->get_weight(), -1);
-            this->m_size--;
-            this->m_total_weight -= node->get_weight();
-            return true;
+            return node;
         }
         
-        virtual void clear() {
-            delete_tree();
-            m_map.clear();
+        // Recomputes the weight of each relay node below and at 'node' from
+        // its children, appending every overwritten weight to
+        // 'saved_weights' first.
+        void recompute_relay_weights(
+                    TreeNode* node,
+                    std::vector<std::pair<TreeNode*, double>>& saved_weights) {
+            if (node->is_leaf_node()) {
+                return;
+            }
             
-            m_root               = nullptr;
-            this->m_size         = 0;
-            this->m_total_weight = 0.0;
+            recompute_relay_weights(node->get_left_child(), saved_weights);
+            recompute_relay_weights(node->get_right_child(), saved_weights);
+            saved_weights.emplace_back(node, node->get_weight());
+            node->set_weight(node->get_left_child()->get_weight() +
+                             node->get_right_child()->get_weight());
         }
         
-    private:
+        void sample_elements_impl(TreeNode* node,
+                                  const double* begin,
+                                  const double* end,
+                                  double offset,
+                                  std::vector<T>& samples) {
+            if (begin == end) {
+                return;
+            }
+            
+            if (node->is_leaf_node()) {
+                samples.insert(samples.end(), end - begin, node->get_element());
+                return;
+            }
+            
+            double split_value = offset +
+                                 node->get_left_child()->get_weight();
+            
+            const double* middle = std::lower_bound(begin, end, split_value);
+            
+            sample_elements_impl(node->get_left_child(),
+                                 begin,
+                                 middle,
+                                 offset,
+                                 samples);
+            
+            sample_elements_impl(node->get_right_child(),
+                                 middle,
+                                 end,
+                                 split_value,
+                                 samples);
+        }
+        
+        void sample_counts_impl(TreeNode* node,
+                                size_t count,
+                                std::vector<std::pair<T, size_t>>& counts) {
+            if (count == 0) {
+                return;
+            }
+            
+            if (node->is_leaf_node()) {
+                counts.emplace_back(node->get_element(), count);
+                return;
+            }
+            
+            double left_weight  = node->get_left_child()->get_weight();
+            double right_weight = node->get_right_child()->get_weight();
+            size_t left_count =
+                this->generate_binomial(count,
+                                        left_weight /
+                                        (left_weight + right_weight));
+            
+            sample_counts_impl(node->get_left_child(), left_count, counts);
+            sample_counts_impl(node->get_right_child(),
+                               count - left_count,
+                               counts);
+        }
+        
+        // insert() enters the right subtree on ties, so each right subtree
+        // holds as many leaves as its left sibling or one more, and one more
+        // only if the latest insertion below their parent went right.
+        // Following those insertions leads to the most recent leaf.
+        TreeNode* find_last_leaf_node() const {
+            TreeNode* node = m_root;
+            
+            while (node->is_relay_node()) {
+                if (node->get_right_child()->get_number_of_leaves() >
+                    node->get_left_child()->get_number_of_leaves()) {
+                    node = node->get_right_child();
+                } else {
+                    node = node->get_left_child();
+                }
+            }
+            
+            return node;
+        }
+        
+        // Removes the leaf from the tree. Its sibling takes the place of the
+        // relay node above them, so the relay node is destroyed as well.
+        void unlink_leaf_node(TreeNode* leaf_node) {
+            TreeNode* relay_node = leaf_node->get_parent();
+            delete_node(leaf_node);
+            
+            if (relay_node != nullptr) {
+                update_metadata(relay_node->get_parent(), -1);
+                
+                m_node_pool.destroy(relay_node);
+            }
+        }
+        
+        // Puts 'new_leaf_node' in the place of 'old_leaf_node'.
+        void replace_leaf_node(TreeNode* old_leaf_node,
+                               TreeNode* new_leaf_node) {
+            TreeNode* parent = old_leaf_node->get_parent();
+            new_leaf_node->set_parent(parent);
+            
+            if (parent == nullptr) {
+                m_root = new_leaf_node;
+            } else if (parent->get_left_child() == old_leaf_node) {
+                parent->set_left_child(new_leaf_node);
+            } else {
+                parent->set_right_child(new_leaf_node);
+            }
+            
+            update_metadata(parent, 0);
+        }
+        
+        double get_relay_weight_sum(TreeNode* node) const {
+            if (node->is_leaf_node()) {
+                return 0.0;
+            }
+            
+            return node->get_weight() +
+                   get_relay_weight_sum(node->get_left_child()) +
+                   get_relay_weight_sum(node->get_right_child());
+        }
+        
+        // Destroys the relay nodes and returns the leaf nodes, which are then
+        // free to be assembled into a new tree.
+        std::vector<TreeNode*> detach_leaf_nodes() {
+            std::vector<TreeNode*> leaf_nodes;
+            leaf_nodes.reserve(this->m_size);
+            detach_leaf_nodes(m_root, leaf_nodes);
+            m_root = nullptr;
+            return leaf_nodes;
+        }
+        
+        void detach_leaf_nodes(TreeNode* node,
+                               std::vector<TreeNode*>& leaf_nodes) {
+            if (node == nullptr) {
+                return;
+            }
+            
+            if (node->is_leaf_node()) {
+                node->set_parent(nullptr);
+                leaf_nodes.push_back(node);
+                return;
+            }
+            
+            detach_leaf_nodes(node->get_left_child(), leaf_nodes);
+            detach_leaf_nodes(node->get_right_child(), leaf_nodes);
+            m_node_pool.destroy(node);
+        }
+        
+        // Reshapes the tree like a Huffman code tree by joining the two
+        // lightest subtrees under a new relay node until one tree remains.
+        // The expected depth of a sampled leaf is then less than the entropy
+        // of the distribution (in bits) plus one, so that the heavy elements
+        // of a skewed distribution sit right below the root.
+        void rebuild_by_weight() {
+            m_modification_count = 0;
+            
+            if (m_root == nullptr) {
+                return;
+            }
+            
+            // The joined subtrees come out in the order of their weights, so
+            // a sorted array of the leaves and a FIFO queue of the relay
+            // nodes replace the priority queue. The weights are kept next to
+            // the nodes so that the comparisons do not chase pointers.
+            std::vector<std::pair<double, TreeNode*>> leaf_queue;
+            std::vector<std::pair<double, TreeNode*>> relay_queue;
+            leaf_queue.reserve(this->m_size);
+            relay_queue.reserve(this->m_size - 1);
+            
+            for (TreeNode* leaf_node : detach_leaf_nodes()) {
+                leaf_queue.emplace_back(leaf_node->get_weight(), leaf_node);
+            }
+            
+            std::sort(leaf_queue.begin(),
+                      leaf_queue.end(),
+                      [](const std::pair<double, TreeNode*>& entry1,
+                         const std::pair<double, TreeNode*>& entry2) {
+                          return entry1.first < entry2.first;
+                      });
+            
+            size_t leaf_index  = 0;
+            size_t relay_index = 0;
+            
+            // Ties go to the leaves, so that equal weights still produce a
+            // balanced tree:
+            auto pop_lightest = [&]() {
+                if (relay_index == relay_queue.size() ||
+                    (leaf_index < leaf_queue.size() &&
+                     leaf_queue[leaf_index].first <=
+                     relay_queue[relay_index].first)) {
+                    return leaf_queue[leaf_index++];
+                }
+                
+                return relay_queue[relay_index++];
+            };
+            
+            while (relay_queue.size() + 1 < leaf_queue.size()) {
+                std::pair<double, TreeNode*> left_entry  = pop_lightest();
+                std::pair<double, TreeNode*> right_entry = pop_lightest();
+                relay_queue.emplace_back(
+                                left_entry.first + right_entry.first,
+                                create_relay_node(left_entry.second,
+                                                  right_entry.second));
+            }
+            
+            m_root = relay_queue.empty() ?
+                     leaf_queue[0].second :
+                     relay_queue.back().second;
+            
+            // The sums are fresh, so take the chance to drop the rounding
+            // errors accumulated in the total weight:
+            this->m_total_weight = m_root->get_weight();
+        }
+        
+        void rebuild_by_leaf_count() {
+            m_modification_count = 0;
+            
+            if (m_root == nullptr) {
+                return;
+            }
+            
+            std::vector<TreeNode*> leaf_nodes = detach_leaf_nodes();
+            m_root = build_balanced_tree(leaf_nodes.data(),
+                                         leaf_nodes.data() + leaf_nodes.size());
+            
+            this->m_total_weight = m_root->get_weight();
+        }
+        
+        // Builds a tree over the leaves in the shape that insertions produce:
+        // the left subtree holds the lower half of the leaves and the right
+        // subtree the upper half, which is one leaf larger for odd counts.
+        // This is the shape that find_last_leaf_node() relies on.
+        TreeNode* build_balanced_tree(TreeNode** begin, TreeNode** end) {
+            if (end - begin == 1) {
+                return *begin;
+            }
+            
+            TreeNode** middle = begin + (end - begin) / 2;
+            TreeNode* left_child = build_balanced_tree(begin, middle);
+            TreeNode* right_child = build_balanced_tree(middle, end);
+            return create_relay_node(left_child, right_child);
+        }
+        
+        TreeNode* create_relay_node(TreeNode* left_child,
+                                    TreeNode* right_child) {
+            TreeNode* relay_node = m_node_pool.create();
+            relay_node->set_weight(left_child->get_weight() +
+                                   right_child->get_weight());
+            
+            relay_node->set_number_of_leaves(
+                                left_child->get_number_of_leaves() +
+                                right_child->get_number_of_leaves());
+            
+            relay_node->set_left_child(left_child);
+            relay_node->set_right_child(right_child);
+            left_child->set_parent(relay_node);
+            right_child->set_parent(relay_node);
+            return relay_node;
+        }
+        
+        void count_modification() {
+            if (m_weight_shaped && ++m_modification_count >= this->m_size) {
+                rebuild_by_weight();
+            }
+        }
+        
+        size_t get_height(TreeNode* node) const {
+            if (node == nullptr || node->is_leaf_node()) {
+                return 0;
+            }
+            
+            return 1 + std::max(get_height(node->get_left_child()),
+                                get_height(node->get_right_child()));
+        }
         
         void delete_node(TreeNode* node) {
             TreeNode* relay_node = node->get_parent();
@@ -261,19 +944,28 @@ namespace util {
             sibling_leaf->set_parent(parent_of_relay_node);
         }
         
-        void update_metadata(TreeNode* node,
-                             double weight_delta,
-                             size_t node_count_delta) {
+        // Recomputes the weights on the path to the root from the children
+        // instead of adding the difference, so that no rounding errors
+        // accumulate in them.
+        void update_metadata(TreeNode* node, size_t node_count_delta) {
             while (node != nullptr) {
                 node->set_number_of_leaves(
                             node->get_number_of_leaves() + node_count_delta);
-                node->set_weight(node->get_weight() + weight_delta);
+                node->set_weight(node->get_left_child()->get_weight() +
+                                 node->get_right_child()->get_weight());
                 node = node->get_parent();
             }
         }
         
+        // Takes the total weight from the root, whose weight is a fresh sum.
+        void update_total_weight() {
+            this->m_total_weight = m_root == nullptr ?
+                                   0.0 :
+                                   m_root->get_weight();
+        }
+        
         void bypass_leaf_node(TreeNode* bypass_node, TreeNode* new_node) {
-            TreeNode* relay_node = new TreeNode{};
+            TreeNode* relay_node = m_node_pool.create();
             TreeNode* parent_of_current_node = bypass_node->get_parent();
             
             relay_node->set_number_of_leaves(1);
@@ -295,7 +987,7 @@ namespace util {
                 parent_of_current_node->set_right_child(relay_node);
             }
             
-            update_metadata(relay_node, new_node->get_weight(), 1);
+            update_metadata(relay_node, 1);
         }
         
         void insert(TreeNode* new_node) {
@@ -310,53 +1002,92 @@ namespace util {
             TreeNode* current_node = m_root;
             
             while (current_node->is_relay_node()) {
-                if (current_node->get_left_child()->get_number_of_leaves() <
-                    current_node->get_right_child()->get_number_of_leaves()) {
-                    current_node = current_node->get_left_child();
+                TreeNode* left_child  = current_node->get_left_child();
+                TreeNode* right_child = current_node->get_right_child();
+                
+                if (m_weight_shaped ?
+                    left_child->get_weight() < right_child->get_weight() :
+                    left_child->get_number_of_leaves() <
+                    right_child->get_number_of_leaves()) {
+                    current_node = left_child;
                 } else {
-                    current_node = current_node->get_right_child();
+                    current_node = right_child;
                 }
             }
             
             bypass_leaf_node(current_node, new_node);
         }
         
-        void delete_tree(TreeNode* node) {
-            if (node == nullptr) {
-                return;
+        // Destroys the leaves unless their elements own nothing, and returns
+        // the memory of all the nodes to the resource in one go.
+        void delete_tree() {
+            if (!std::is_trivially_destructible<T>::value) {
+                destroy_leaf_nodes(m_root);
             }
             
-            delete_tree(node->get_left_child());
-            delete_tree(node->get_right_child());
-            delete node;
+            m_node_pool.release();
+            m_root = nullptr;
         }
         
-        void delete_tree() {
-            delete_tree(m_root);
-            m_root = nullptr;
+        void destroy_leaf_nodes(TreeNode* node) {
+            if (node == nullptr) {
+                return;
+            }
+            
+            if (node->is_leaf_node()) {
+                m_node_pool.destroy(node);
+                return;
+            }
+            
+            destroy_leaf_nodes(node->get_left_child());
+            destroy_leaf_nodes(node->get_right_child());
         }
         
-        TreeNode* copy_tree_impl(TreeNode* node) {
+        TreeNode* copy_tree_impl(TreeNode* node, TreeNode* parent) {
             if (node == nullptr) {
                 return nullptr;
             }
             
-            TreeNode* new_node = new TreeNode{node->get_element(),
-                                              node->get_weight()};
+            TreeNode* new_node;
+            
+            if (node->is_relay_node()) {
+                new_node = m_node_pool.create();
+                new_node->set_weight(node->get_weight());
+            } else {
+                new_node = m_node_pool.create(node->get_element(),
+                                              node->get_weight());
+                
+                // The copy takes over the handle of the original leaf:
+                new_node->set_handle_index(node->get_handle_index());
+                m_handle_table.set_position(node->get_handle_index(),
+                                            new_node);
+            }
             
-            m_map[new_node->get_element()] = new_node;
+            new_node->set_number_of_leaves(node->get_number_of_leaves());
+            new_node->set_parent(parent);
+            new_node->set_left_child (copy_tree_impl(node->get_left_child(),
+                                                     new_node));
             
-            new_node->set_left_child (copy_tree_impl(node->get_left_child()));
-            new_node->set_right_child(copy_tree_impl(node->get_right_child()));
+            new_node->set_right_child(copy_tree_impl(node->get_right_child(),
+                                                     new_node));
             return new_node;
         }
         
         void copy_tree(TreeNode* copy_root) {
-            m_root = copy_tree_impl(copy_root);
+            m_root = copy_tree_impl(copy_root, nullptr);
         }
         
-        std::unordered_map<T, TreeNode*> m_map;
-        TreeNode* m_root;
+        // Maps each element to its handle index.
+        typedef FlatHashIndex<T, Hash, KeyEqual> index_type;
+        
+        index_type             m_element_index;
+        NodePool<TreeNode>     m_node_pool;
+        HandleTable<TreeNode*> m_handle_table;
+        TreeNode*              m_root;
+        bool                   m_weight_shaped;
+        
+        // The number of modifications since the last rebuild.
+        size_t                 m_modification_count;
     };
     
 } // End of namespace net::coderodde::util.
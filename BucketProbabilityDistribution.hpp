@@ -0,0 +1,658 @@
+#ifndef NET_CODERODDE_UTIL_BUCKET_PROBABILITY_DISTRIBUTION_HPP
+#define NET_CODERODDE_UTIL_BUCKET_PROBABILITY_DISTRIBUTION_HPP
+
+#include "FlatHashIndex.hpp"
+#include "ProbabilityDistribution.hpp"
+#include <cmath>
+#include <functional>
+#include <memory_resource>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Implements the probability distribution by grouping the elements into
+    // buckets by the binary exponent of their weights: the bucket e holds
+    // the weights in [2^e, 2^(e + 1)). Sampling picks a bucket by its total
+    // weight and then a slot of the bucket uniformly at random, accepting it
+    // with the probability weight / 2^(e + 1), which is at least 1/2. Adding,
+    // removing and updating an element take O(1) expected time, since the
+    // buckets are flat arrays that fill a hole with their last element.
+    // Sampling takes O(1) expected time as well for any fixed range of
+    // weights: the scan of the buckets is bounded by the number of binary
+    // exponents between the lightest and the heaviest weight. 'Hash' and
+    // 'KeyEqual' hash and compare the elements in the element index.
+    template<typename T,
+             typename Engine = std::mt19937,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class BucketProbabilityDistribution final :
+    public ProbabilityDistribution<T, Engine> {
+
+    public:
+        BucketProbabilityDistribution()
+        :
+        ProbabilityDistribution<T, Engine>{},
+        m_minimum_exponent{0}
+        {}
+
+        BucketProbabilityDistribution(std::random_device::result_type seed)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_minimum_exponent{0}
+        {}
+
+        // The buckets and the element index are allocated from 'resource'.
+        BucketProbabilityDistribution(std::pmr::memory_resource* resource)
+        :
+        BucketProbabilityDistribution(std::random_device::result_type{},
+                                      resource)
+        {}
+
+        BucketProbabilityDistribution(std::random_device::result_type seed,
+                                      std::pmr::memory_resource* resource)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_bucket_vector{resource},
+        m_element_index{resource},
+        m_handle_table{resource},
+        m_minimum_exponent{0}
+        {}
+
+        BucketProbabilityDistribution(
+            const BucketProbabilityDistribution& other)
+        :
+        ProbabilityDistribution<T, Engine>{other}
+        {
+            copy_buckets(other);
+            m_element_index    = other.m_element_index;
+            m_handle_table     = other.m_handle_table;
+            m_minimum_exponent = other.m_minimum_exponent;
+        }
+
+        BucketProbabilityDistribution(
+            BucketProbabilityDistribution&& other)
+        :
+        ProbabilityDistribution<T, Engine>{other},
+        m_bucket_vector{std::move(other.m_bucket_vector)},
+        m_element_index{std::move(other.m_element_index)},
+        m_handle_table{std::move(other.m_handle_table)},
+        m_minimum_exponent{other.m_minimum_exponent}
+        {
+            other.clear();
+        }
+
+        BucketProbabilityDistribution& operator=(
+            const BucketProbabilityDistribution& other) {
+            if (this == &other) {
+                return *this;
+            }
+
+            ProbabilityDistribution<T, Engine>::operator=(other);
+            copy_buckets(other);
+            m_element_index    = other.m_element_index;
+            m_handle_table     = other.m_handle_table;
+            m_minimum_exponent = other.m_minimum_exponent;
+            return *this;
+        }
+
+        BucketProbabilityDistribution& operator=(
+            BucketProbabilityDistribution&& other) {
+            if (this == &other) {
+                return *this;
+            }
+
+            ProbabilityDistribution<T, Engine>::operator=(other);
+
+            if (m_bucket_vector.get_allocator() ==
+                other.m_bucket_vector.get_allocator()) {
+                m_bucket_vector = std::move(other.m_bucket_vector);
+            } else {
+                // The buckets would be moved element by element into
+                // buckets of the default resource otherwise:
+                copy_buckets(other);
+            }
+
+            m_element_index    = std::move(other.m_element_index);
+            m_handle_table     = std::move(other.m_handle_table);
+            m_minimum_exponent = other.m_minimum_exponent;
+
+            other.clear();
+            return *this;
+        }
+
+        virtual bool add_element(T const& element, double weight) {
+            return !insert_element(element, weight).is_null();
+        }
+
+        virtual bool add_element(T&& element, double weight) {
+            return !insert_element(std::move(element), weight).is_null();
+        }
+
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) {
+            return insert_element(element, weight);
+        }
+
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) {
+            return insert_element(std::move(element), weight);
+        }
+
+        virtual T sample_element() {
+            return sample_element_reference();
+        }
+
+        virtual const T& sample_element_reference() {
+            this->check_not_empty();
+            return get_element(sample_location(this->m_generator));
+        }
+
+        virtual ElementHandle sample_handle() {
+            this->check_not_empty();
+            return get_handle_at(sample_location(this->m_generator));
+        }
+
+        virtual ElementHandle get_handle(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+
+            return m_handle_table.get_handle(handle_index);
+        }
+
+        virtual bool contains_handle(ElementHandle handle) const {
+            return m_handle_table.contains(handle);
+        }
+
+        virtual const T& get_element(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return get_element(m_handle_table.get_position(handle.index));
+        }
+
+        virtual bool contains_element(T const& element) const {
+            return find_handle_index(element) != index_type::NOT_FOUND;
+        }
+
+        virtual bool remove_element(T const& element) {
+            uint32_t hash = m_element_index.hash(element);
+            uint32_t handle_index = find_handle_index(element, hash);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            m_element_index.erase(hash, handle_index);
+            remove_at(m_handle_table.get_position(handle_index));
+            return true;
+        }
+
+        virtual bool remove_element(ElementHandle handle) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+
+            Location location = m_handle_table.get_position(handle.index);
+            m_element_index.erase(m_element_index.hash(get_element(location)),
+                                  handle.index);
+            remove_at(location);
+            return true;
+        }
+
+        virtual bool update_weight(T const& element, double weight) {
+            uint32_t handle_index = find_handle_index(element);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            update_weight_at(handle_index, weight);
+            return true;
+        }
+
+        virtual bool update_weight(ElementHandle handle, double weight) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+
+            update_weight_at(handle.index, weight);
+            return true;
+        }
+
+        virtual double get_weight(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            this->check_contains(handle_index != index_type::NOT_FOUND);
+            return get_weight_at(m_handle_table.get_position(handle_index));
+        }
+
+        virtual double get_weight(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return get_weight_at(m_handle_table.get_position(handle.index));
+        }
+
+        virtual void clear() {
+            this->m_size = 0;
+            this->m_total_weight = 0.0;
+            m_bucket_vector.clear();
+            m_element_index.clear();
+            m_handle_table.clear();
+            m_minimum_exponent = 0;
+        }
+
+    protected:
+
+        virtual const T& sample_element_with(Engine& generator) const {
+            return get_element(sample_location(generator));
+        }
+
+        // Serves the batch without the virtual call per sample.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            for (size_t i = 0; i < count; ++i) {
+                samples.push_back(
+                    get_element(sample_location(this->m_generator)));
+            }
+        }
+
+        // Masks the weight of each drawn element in place: the slot keeps
+        // its element and handle with the weight of zero, which the
+        // acceptance test always rejects. The weights and the totals are
+        // restored at the end, so no element moves.
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<std::pair<Location, double>> sampled_weights;
+            std::vector<double> bucket_total_weights;
+            std::vector<size_t> masked_counts(m_bucket_vector.size(), 0);
+            double total_weight = this->m_total_weight;
+
+            for (const Bucket& bucket : m_bucket_vector) {
+                bucket_total_weights.push_back(bucket.total_weight);
+            }
+
+            while (count > 0) {
+                size_t bucket_index = sample_bucket_index(this->m_generator);
+                Bucket& bucket = m_bucket_vector[bucket_index];
+
+                // The rounding errors may lead to a bucket whose weights
+                // are all masked; draw again if they did:
+                if (masked_counts[bucket_index] ==
+                    bucket.element_vector.size()) {
+                    continue;
+                }
+
+                Location location = sample_location_in_bucket(
+                                                    bucket_index,
+                                                    this->m_generator);
+
+                double& weight = bucket.weight_vector[location.position];
+                sampled_weights.emplace_back(location, weight);
+
+                // A fully masked bucket must not keep a rounding residue:
+                bucket.total_weight =
+                    ++masked_counts[bucket_index] ==
+                    bucket.element_vector.size() ?
+                    0.0 :
+                    bucket.total_weight - weight;
+
+                // Subtracting a weight far above the others from the total
+                // would cancel it out, while the weights within a bucket are
+                // within a factor of two; sum the few buckets instead:
+                this->m_total_weight = 0.0;
+
+                for (const Bucket& other_bucket : m_bucket_vector) {
+                    this->m_total_weight += other_bucket.total_weight;
+                }
+
+                weight = 0.0;
+                samples.push_back(get_element(location));
+                count--;
+            }
+
+            for (const auto& sampled_weight : sampled_weights) {
+                const Location& location = sampled_weight.first;
+                get_bucket(location.exponent)
+                    .weight_vector[location.position] = sampled_weight.second;
+            }
+
+            for (size_t i = 0; i < m_bucket_vector.size(); ++i) {
+                m_bucket_vector[i].total_weight = bucket_total_weights[i];
+            }
+
+            this->m_total_weight = total_weight;
+        }
+
+    private:
+
+        struct Bucket {
+            std::pmr::vector<T>        element_vector;
+            std::pmr::vector<double>   weight_vector;
+            std::pmr::vector<uint32_t> handle_index_vector;
+            double                     total_weight;
+
+            Bucket(std::pmr::memory_resource* resource)
+            :
+            element_vector{resource},
+            weight_vector{resource},
+            handle_index_vector{resource},
+            total_weight{0.0}
+            {}
+        };
+
+        struct Location {
+            int    exponent;
+            size_t position;
+        };
+
+        // Maps each element to its handle index.
+        typedef FlatHashIndex<T, Hash, KeyEqual> index_type;
+
+        // Covers the exponents from m_minimum_exponent on, without gaps.
+        // The first and the last bucket are never empty.
+        std::pmr::vector<Bucket> m_bucket_vector;
+        index_type               m_element_index;
+
+        // The locations are kept up to date as the elements move between
+        // and within the buckets.
+        HandleTable<Location>    m_handle_table;
+        int                      m_minimum_exponent;
+
+        uint32_t find_handle_index(T const& element) const {
+            return find_handle_index(element, m_element_index.hash(element));
+        }
+
+        uint32_t find_handle_index(T const& element, uint32_t hash) const {
+            return m_element_index.find(
+                        element,
+                        hash,
+                        [this](uint32_t handle_index) -> const T& {
+                            return get_element(
+                                m_handle_table.get_position(handle_index));
+                        });
+        }
+
+        template<typename Element>
+        ElementHandle insert_element(Element&& element, double weight) {
+            uint32_t hash = m_element_index.hash(element);
+
+            if (find_handle_index(element, hash) != index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+
+            this->check_weight(weight);
+            int exponent = std::ilogb(weight);
+            ElementHandle handle =
+                m_handle_table.acquire(Location{exponent, 0});
+
+            try {
+                size_t position = push_back(exponent,
+                                            std::forward<Element>(element),
+                                            handle.index,
+                                            weight);
+
+                m_handle_table.set_position(handle.index,
+                                            Location{exponent, position});
+            } catch (...) {
+                m_handle_table.release(handle.index);
+                throw;
+            }
+
+            m_element_index.insert(hash, handle.index);
+            this->m_total_weight += weight;
+            this->m_size++;
+            return handle;
+        }
+
+        const T& get_element(const Location& location) const {
+            return m_bucket_vector[location.exponent - m_minimum_exponent]
+                   .element_vector[location.position];
+        }
+
+        double get_weight_at(const Location& location) const {
+            return m_bucket_vector[location.exponent - m_minimum_exponent]
+                   .weight_vector[location.position];
+        }
+
+        ElementHandle get_handle_at(const Location& location) const {
+            return m_handle_table.get_handle(
+                        m_bucket_vector[location.exponent - m_minimum_exponent]
+                        .handle_index_vector[location.position]);
+        }
+
+        // Removes the element at 'location', which is already erased from
+        // the element index.
+        void remove_at(Location location) {
+            m_handle_table.release(get_handle_at(location).index);
+            this->m_total_weight -= remove(location);
+            this->m_size--;
+            trim_buckets();
+        }
+
+        // Sets the weight of the element with the handle index, moving the
+        // element to another bucket if the binary exponent changes.
+        void update_weight_at(uint32_t handle_index, double weight) {
+            this->check_weight(weight);
+            Location location = m_handle_table.get_position(handle_index);
+            int exponent = std::ilogb(weight);
+            double old_weight;
+
+            if (exponent == location.exponent) {
+                Bucket& bucket = get_bucket(exponent);
+                double& stored_weight = bucket.weight_vector[location.position];
+                old_weight = stored_weight;
+                stored_weight = weight;
+                bucket.total_weight += weight - old_weight;
+            } else {
+                // The bucket of the new weight is created before the old one
+                // is trimmed, so that the buckets in between stay in place:
+                T element = std::move(get_bucket(location.exponent)
+                                      .element_vector[location.position]);
+
+                size_t position = push_back(exponent,
+                                            std::move(element),
+                                            handle_index,
+                                            weight);
+
+                m_handle_table.set_position(handle_index,
+                                            Location{exponent, position});
+                old_weight = remove(location);
+                trim_buckets();
+            }
+
+            this->m_total_weight += weight - old_weight;
+        }
+
+        Location sample_location(Engine& generator) const {
+            return sample_location_in_bucket(sample_bucket_index(generator),
+                                             generator);
+        }
+
+        // Samples a slot of the bucket by rejection. The bucket must hold a
+        // positive weight.
+        Location sample_location_in_bucket(size_t bucket_index,
+                                           Engine& generator) const {
+            const Bucket& bucket = m_bucket_vector[bucket_index];
+            int exponent = m_minimum_exponent + static_cast<int>(bucket_index);
+            size_t bucket_size = bucket.element_vector.size();
+
+            while (true) {
+                // As in the alias method, one uniform variate yields both the
+                // slot (integral part) and the acceptance test (fractional
+                // part):
+                double value = generate_uniform_double(generator) * bucket_size;
+                size_t position = static_cast<size_t>(value);
+
+                if (position >= bucket_size) {
+                    position = bucket_size - 1;
+                }
+
+                // Scaling the weight instead of the fraction keeps the test
+                // exact at both ends of the exponent range:
+                if (value - position <
+                    std::ldexp(bucket.weight_vector[position],
+                               -exponent - 1)) {
+                    return Location{exponent, position};
+                }
+            }
+        }
+
+        // Scans the buckets from the heaviest exponent down, since those
+        // tend to carry most of the weight.
+        size_t sample_bucket_index(Engine& generator) const {
+            double value = generate_uniform_double(generator) *
+                           this->m_total_weight;
+
+            size_t bucket_index = m_bucket_vector.size() - 1;
+
+            for (size_t i = m_bucket_vector.size(); i-- > 0;) {
+                const Bucket& bucket = m_bucket_vector[i];
+
+                if (bucket.element_vector.empty()) {
+                    continue;
+                }
+
+                // Fall back to the last nonempty bucket when the rounding
+                // errors in the totals lead past it:
+                bucket_index = i;
+
+                if (value < bucket.total_weight) {
+                    break;
+                }
+
+                value -= bucket.total_weight;
+            }
+
+            return bucket_index;
+        }
+
+        Bucket& get_bucket(int exponent) {
+            return m_bucket_vector[exponent - m_minimum_exponent];
+        }
+
+        // Appends the element to the bucket of 'exponent', creating the
+        // bucket if needed, and returns its position in the bucket.
+        template<typename Element>
+        size_t push_back(int exponent,
+                         Element&& element,
+                         uint32_t handle_index,
+                         double weight) {
+            std::pmr::memory_resource* resource =
+                m_bucket_vector.get_allocator().resource();
+
+            if (m_bucket_vector.empty()) {
+                m_minimum_exponent = exponent;
+            }
+
+            while (exponent < m_minimum_exponent) {
+                m_bucket_vector.emplace(m_bucket_vector.begin(), resource);
+                m_minimum_exponent--;
+            }
+
+            while (exponent - m_minimum_exponent >=
+                   static_cast<int>(m_bucket_vector.size())) {
+                m_bucket_vector.emplace_back(resource);
+            }
+
+            Bucket& bucket = get_bucket(exponent);
+            bucket.element_vector.push_back(std::forward<Element>(element));
+            bucket.weight_vector.push_back(weight);
+            bucket.handle_index_vector.push_back(handle_index);
+            bucket.total_weight += weight;
+            return bucket.element_vector.size() - 1;
+        }
+
+        // Removes the element at 'location' by moving the last element of
+        // its bucket into the hole, and returns the weight of the removed
+        // element. The handle of the removed element is left as it is.
+        double remove(const Location& location) {
+            Bucket& bucket = get_bucket(location.exponent);
+            double weight = bucket.weight_vector[location.position];
+            size_t last_position = bucket.element_vector.size() - 1;
+
+            if (location.position != last_position) {
+                bucket.element_vector[location.position] =
+                    std::move(bucket.element_vector[last_position]);
+
+                bucket.weight_vector[location.position] =
+                    bucket.weight_vector[last_position];
+
+                bucket.handle_index_vector[location.position] =
+                    bucket.handle_index_vector[last_position];
+
+                m_handle_table.set_position(
+                        bucket.handle_index_vector[location.position],
+                        location);
+            }
+
+            bucket.element_vector.pop_back();
+            bucket.weight_vector.pop_back();
+            bucket.handle_index_vector.pop_back();
+
+            // An empty bucket must not keep a rounding residue, or it could
+            // be sampled:
+            bucket.total_weight = bucket.element_vector.empty() ?
+                                  0.0 :
+                                  bucket.total_weight - weight;
+            return weight;
+        }
+
+        // Drops the empty buckets at both ends.
+        void trim_buckets() {
+            while (!m_bucket_vector.empty() &&
+                   m_bucket_vector.back().element_vector.empty()) {
+                m_bucket_vector.pop_back();
+            }
+
+            size_t empty_bucket_count = 0;
+
+            while (empty_bucket_count < m_bucket_vector.size() &&
+                   m_bucket_vector[empty_bucket_count]
+                   .element_vector.empty()) {
+                empty_bucket_count++;
+            }
+
+            m_bucket_vector.erase(m_bucket_vector.begin(),
+                                  m_bucket_vector.begin() +
+                                  empty_bucket_count);
+
+            m_minimum_exponent += static_cast<int>(empty_bucket_count);
+        }
+
+        // Copies the buckets into buckets of this distribution's resource.
+        void copy_buckets(const BucketProbabilityDistribution&
+                          other) {
+            std::pmr::memory_resource* resource =
+                m_bucket_vector.get_allocator().resource();
+
+            m_bucket_vector.clear();
+            m_bucket_vector.reserve(other.m_bucket_vector.size());
+
+            for (const Bucket& other_bucket : other.m_bucket_vector) {
+                m_bucket_vector.emplace_back(resource);
+                Bucket& bucket = m_bucket_vector.back();
+                bucket.element_vector.assign(
+                                    other_bucket.element_vector.cbegin(),
+                                    other_bucket.element_vector.cend());
+
+                bucket.weight_vector.assign(
+                                    other_bucket.weight_vector.cbegin(),
+                                    other_bucket.weight_vector.cend());
+
+                bucket.handle_index_vector.assign(
+                                    other_bucket.handle_index_vector.cbegin(),
+                                    other_bucket.handle_index_vector.cend());
+
+                bucket.total_weight = other_bucket.total_weight;
+            }
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_BUCKET_PROBABILITY_DISTRIBUTION_HPP
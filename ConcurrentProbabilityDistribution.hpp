@@ -0,0 +1,590 @@
+#ifndef NET_CODERODDE_UTIL_CONCURRENT_PROBABILITY_DISTRIBUTION_HPP
+#define NET_CODERODDE_UTIL_CONCURRENT_PROBABILITY_DISTRIBUTION_HPP
+
+#include "FlatHashIndex.hpp"
+#include "RandomEngines.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // A probability distribution shared by one writer thread and any number
+    // of sampler threads. The writer modifies its own copy of the
+    // distribution, a flat sum tree kept up to date in O(log n) time per
+    // change, and publish() hands an immutable snapshot of it over to the
+    // samplers by swapping a single atomic pointer. The samplers never
+    // lock: each one has its own random engine and announces the epoch in
+    // which it reads, so that the writer frees a replaced snapshot only
+    // once every sampler that could still see it has left; the freed
+    // snapshots are reused for the next publish().
+    //
+    // publish() is incremental in the common case: when the reused
+    // snapshot is the one replaced by the previous publish(), only the
+    // elements and the sum tree paths changed since it was published are
+    // copied into it, in O(k log n) time for k changes. It falls back to
+    // copying the whole arrays, in O(n) time, when no such snapshot is free
+    // because a sampler still reads it, after the capacity grows or the
+    // distribution is cleared, and when the changes outnumber a fraction of
+    // the capacity.
+    //
+    // Unlike the other distributions, this class does not derive from
+    // ProbabilityDistribution: sampling goes through a Sampler obtained
+    // from get_sampler(), which can be called from any thread, and the
+    // samplers see the changes only once they are published. Only one
+    // thread at a time may call the other functions. All the samplers must
+    // be destroyed before the distribution.
+    template<typename T,
+             typename Engine = std::mt19937,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class ConcurrentProbabilityDistribution final {
+
+        struct Snapshot;
+        struct ReaderSlot;
+
+    public:
+        typedef Engine engine_type;
+
+        // Draws samples from the latest published snapshot. A sampler may
+        // be moved to another thread, but used by only one at a time.
+        class Sampler {
+        public:
+            Sampler(Sampler&& other)
+            :
+            m_distribution{other.m_distribution},
+            m_reader_slot{other.m_reader_slot},
+            m_generator{std::move(other.m_generator)}
+            {
+                other.m_reader_slot = nullptr;
+            }
+
+            Sampler(const Sampler&) = delete;
+            Sampler& operator=(const Sampler&) = delete;
+            Sampler& operator=(Sampler&&) = delete;
+
+            ~Sampler() {
+                if (m_reader_slot != nullptr) {
+                    m_reader_slot->in_use.store(false,
+                                                std::memory_order_release);
+                }
+            }
+
+            // Throws std::length_error if the published snapshot is empty.
+            T sample_element() {
+                ReadGuard guard(*this);
+                return guard.get_snapshot().sample(generate_uniform());
+            }
+
+            // Draws 'count' samples from the same snapshot and writes them
+            // to 'output'. Returns the output iterator past the last one.
+            template<typename OutputIterator>
+            OutputIterator sample_elements(size_t count,
+                                           OutputIterator output) {
+                if (count == 0) {
+                    return output;
+                }
+
+                ReadGuard guard(*this);
+                const Snapshot& snapshot = guard.get_snapshot();
+
+                for (size_t i = 0; i < count; ++i) {
+                    *output++ = snapshot.sample(generate_uniform());
+                }
+
+                return output;
+            }
+
+        private:
+            friend class ConcurrentProbabilityDistribution;
+
+            // Announces the current epoch for as long as it lives, which
+            // keeps the snapshot it loaded from being freed.
+            class ReadGuard {
+            public:
+                explicit ReadGuard(Sampler& sampler)
+                :
+                m_reader_slot{sampler.m_reader_slot}
+                {
+                    ConcurrentProbabilityDistribution& distribution =
+                        *sampler.m_distribution;
+
+                    m_reader_slot->epoch.store(distribution.m_epoch.load());
+                    m_snapshot = distribution.m_snapshot.load();
+
+                    if (m_snapshot->element_vector.empty()) {
+                        m_reader_slot->epoch.store(
+                                            0,
+                                            std::memory_order_release);
+
+                        throw std::length_error{
+                            "This probability distribution is empty."
+                        };
+                    }
+                }
+
+                ReadGuard(const ReadGuard&) = delete;
+                ReadGuard& operator=(const ReadGuard&) = delete;
+
+                ~ReadGuard() {
+                    m_reader_slot->epoch.store(0, std::memory_order_release);
+                }
+
+                const Snapshot& get_snapshot() const {
+                    return *m_snapshot;
+                }
+
+            private:
+                ReaderSlot*     m_reader_slot;
+                const Snapshot* m_snapshot;
+            };
+
+            ConcurrentProbabilityDistribution* m_distribution;
+            ReaderSlot*                        m_reader_slot;
+            Engine                             m_generator;
+
+            Sampler(ConcurrentProbabilityDistribution* distribution,
+                    ReaderSlot* reader_slot,
+                    std::random_device::result_type seed)
+            :
+            m_distribution{distribution},
+            m_reader_slot{reader_slot},
+            m_generator{seed}
+            {}
+
+            double generate_uniform() {
+                return generate_uniform_double(m_generator);
+            }
+        };
+
+        // At most 'maximum_sampler_count' samplers may exist at a time.
+        explicit ConcurrentProbabilityDistribution(
+            size_t maximum_sampler_count = DEFAULT_MAXIMUM_SAMPLER_COUNT)
+        :
+        m_reader_slots{new ReaderSlot[maximum_sampler_count]},
+        m_reader_slot_count{maximum_sampler_count},
+        m_epoch{1},
+        m_snapshot{new Snapshot},
+        m_capacity{1},
+        m_tree_vector(2, 0.0),
+        m_version{0},
+        m_previous_dirty_all{false},
+        m_dirty_all{false}
+        {}
+
+        ConcurrentProbabilityDistribution(
+            const ConcurrentProbabilityDistribution&) = delete;
+
+        ConcurrentProbabilityDistribution& operator=(
+            const ConcurrentProbabilityDistribution&) = delete;
+
+        ~ConcurrentProbabilityDistribution() {
+            delete m_snapshot.load();
+        }
+
+        // Returns a sampler seeded with 'seed'. Throws std::length_error if
+        // the maximum number of samplers exist already.
+        Sampler get_sampler(std::random_device::result_type seed) {
+            for (size_t i = 0; i < m_reader_slot_count; ++i) {
+                bool in_use = false;
+
+                if (m_reader_slots[i].in_use.compare_exchange_strong(
+                                                                in_use,
+                                                                true)) {
+                    return Sampler{this, &m_reader_slots[i], seed};
+                }
+            }
+
+            throw std::length_error{"All the sampler slots are in use."};
+        }
+
+        Sampler get_sampler() {
+            return get_sampler(std::random_device{}());
+        }
+
+        bool is_empty() const {
+            return m_element_vector.empty();
+        }
+
+        size_t size() const {
+            return m_element_vector.size();
+        }
+
+        bool add_element(T const& element, double weight) {
+            return insert_element(element, weight);
+        }
+
+        bool add_element(T&& element, double weight) {
+            return insert_element(std::move(element), weight);
+        }
+
+        bool contains_element(T const& element) const {
+            return find_index(element) != index_type::NOT_FOUND;
+        }
+
+        bool remove_element(T const& element) {
+            uint32_t hash = m_element_index.hash(element);
+            uint32_t index = find_index(element, hash);
+
+            if (index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            m_element_index.erase(hash, index);
+            uint32_t last_index =
+                static_cast<uint32_t>(m_element_vector.size() - 1);
+
+            // Move the last element into the hole:
+            if (index != last_index) {
+                m_element_vector[index] =
+                    std::move(m_element_vector[last_index]);
+
+                set_leaf(index, m_tree_vector[m_capacity + last_index]);
+                m_element_index.replace(
+                                m_element_index.hash(m_element_vector[index]),
+                                last_index,
+                                index);
+            }
+
+            set_leaf(last_index, 0.0);
+            m_element_vector.pop_back();
+            return true;
+        }
+
+        bool update_weight(T const& element, double weight) {
+            uint32_t index = find_index(element);
+
+            if (index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            check_weight(weight);
+            set_leaf(index, weight);
+            return true;
+        }
+
+        // Throws std::invalid_argument if the element is not present.
+        double get_weight(T const& element) const {
+            uint32_t index = find_index(element);
+
+            if (index == index_type::NOT_FOUND) {
+                throw std::invalid_argument{
+                    "The input element is not in this probability distribution."
+                };
+            }
+
+            return m_tree_vector[m_capacity + index];
+        }
+
+        void clear() {
+            m_element_vector.clear();
+            m_element_index.clear();
+            m_capacity = 1;
+            m_tree_vector.assign(2, 0.0);
+            mark_all_dirty();
+        }
+
+        // Makes the changes made so far visible to the samplers. Copies only
+        // the changes into the freed snapshot replaced by the previous
+        // publish() when there is one, and the whole arrays otherwise.
+        void publish() {
+            std::unique_ptr<Snapshot> snapshot = std::move(m_spare_snapshot);
+
+            if (snapshot &&
+                snapshot->version + 1 == m_version &&
+                snapshot->capacity == m_capacity &&
+                !m_previous_dirty_all &&
+                !m_dirty_all) {
+                copy_changes(*snapshot, m_previous_dirty_index_vector);
+                copy_changes(*snapshot, m_dirty_index_vector);
+            } else {
+                if (!snapshot) {
+                    snapshot.reset(new Snapshot);
+                }
+
+                snapshot->element_vector = m_element_vector;
+                snapshot->tree_vector    = m_tree_vector;
+                snapshot->capacity       = m_capacity;
+            }
+
+            snapshot->version = ++m_version;
+            m_previous_dirty_index_vector.swap(m_dirty_index_vector);
+            m_dirty_index_vector.clear();
+            m_previous_dirty_all = m_dirty_all;
+            m_dirty_all = false;
+
+            // A sampler announcing an epoch after the increment is bound to
+            // load the new snapshot:
+            Snapshot* old_snapshot = m_snapshot.exchange(snapshot.release());
+            m_retired_snapshot_vector.emplace_back(
+                                        m_epoch.fetch_add(1),
+                                        std::unique_ptr<Snapshot>{
+                                            old_snapshot
+                                        });
+
+            reclaim_snapshots();
+        }
+
+        // Returns the number of replaced snapshots not freed yet because a
+        // sampler could still be reading them.
+        size_t get_retired_snapshot_count() const {
+            return m_retired_snapshot_vector.size();
+        }
+
+    private:
+
+        static constexpr size_t DEFAULT_MAXIMUM_SAMPLER_COUNT = 256;
+
+        // Maps each element to its index.
+        typedef FlatHashIndex<T, Hash, KeyEqual> index_type;
+
+        // The sum tree is implicit: the node i has the children 2i and
+        // 2i + 1, and the weight of the element at index j is at the leaf
+        // 'capacity' + j. The capacity is a power of two.
+        struct Snapshot {
+            std::vector<T>      element_vector;
+            std::vector<double> tree_vector{0.0, 0.0};
+            size_t              capacity = 1;
+            uint64_t            version  = 0;
+
+            const T& sample(double uniform) const {
+                double value = uniform * tree_vector[1];
+                size_t node  = 1;
+
+                while (node < capacity) {
+                    double left_weight = tree_vector[2 * node];
+
+                    if (value < left_weight) {
+                        node = 2 * node;
+                    } else {
+                        value -= left_weight;
+                        node = 2 * node + 1;
+                    }
+                }
+
+                // Guard against the rounding errors in the sums:
+                size_t index = std::min(node - capacity,
+                                        element_vector.size() - 1);
+
+                return element_vector[index];
+            }
+        };
+
+        // Each slot has a cache line of its own, so that the samplers do
+        // not contend for the lines of each other. An epoch of 0 means that
+        // the sampler is not reading.
+        struct alignas(64) ReaderSlot {
+            std::atomic<uint64_t> epoch{0};
+            std::atomic<bool>     in_use{false};
+        };
+
+        std::unique_ptr<ReaderSlot[]> m_reader_slots;
+        size_t                        m_reader_slot_count;
+
+        // Read by every sampler and written only by publish(), so they get
+        // a cache line apart from the state of the writer.
+        alignas(64) std::atomic<uint64_t> m_epoch;
+        std::atomic<Snapshot*>            m_snapshot;
+
+        // The snapshots replaced by publish(), each with the epoch in which
+        // it was replaced.
+        alignas(64)
+        std::vector<std::pair<uint64_t, std::unique_ptr<Snapshot>>>
+                                  m_retired_snapshot_vector;
+        std::unique_ptr<Snapshot> m_spare_snapshot;
+
+        // The state of the writer, copied into the snapshots.
+        std::vector<T>      m_element_vector;
+        size_t              m_capacity;
+        std::vector<double> m_tree_vector;
+        index_type          m_element_index;
+
+        // The version of the published snapshot, and the indices of the
+        // leaves set since the previous and since the latest publish(). A
+        // flag set means that the whole arrays must be copied instead.
+        uint64_t              m_version;
+        std::vector<uint32_t> m_previous_dirty_index_vector;
+        std::vector<uint32_t> m_dirty_index_vector;
+        bool                  m_previous_dirty_all;
+        bool                  m_dirty_all;
+
+        uint32_t find_index(T const& element) const {
+            return find_index(element, m_element_index.hash(element));
+        }
+
+        uint32_t find_index(T const& element, uint32_t hash) const {
+            return m_element_index.find(
+                        element,
+                        hash,
+                        [this](uint32_t index) -> const T& {
+                            return m_element_vector[index];
+                        });
+        }
+
+        template<typename Element>
+        bool insert_element(Element&& element, double weight) {
+            uint32_t hash = m_element_index.hash(element);
+
+            if (find_index(element, hash) != index_type::NOT_FOUND) {
+                return false;
+            }
+
+            check_weight(weight);
+
+            if (m_element_vector.size() == m_capacity) {
+                grow();
+            }
+
+            uint32_t index = static_cast<uint32_t>(m_element_vector.size());
+            m_element_vector.push_back(std::forward<Element>(element));
+            set_leaf(index, weight);
+            m_element_index.insert(hash, index);
+            return true;
+        }
+
+        // Recomputes the sums on the path to the root instead of adding the
+        // difference, so that no rounding errors accumulate.
+        void set_leaf(size_t index, double weight) {
+            size_t node = m_capacity + index;
+            m_tree_vector[node] = weight;
+
+            for (node /= 2; node != 0; node /= 2) {
+                m_tree_vector[node] = m_tree_vector[2 * node] +
+                                      m_tree_vector[2 * node + 1];
+            }
+
+            mark_dirty(index);
+        }
+
+        // Past an eighth of the capacity, copying the paths of the changed
+        // leaves costs about as much as copying the whole tree.
+        void mark_dirty(size_t index) {
+            if (m_dirty_all) {
+                return;
+            }
+
+            if (m_dirty_index_vector.size() >= m_capacity / 8) {
+                mark_all_dirty();
+                return;
+            }
+
+            m_dirty_index_vector.push_back(static_cast<uint32_t>(index));
+        }
+
+        void mark_all_dirty() {
+            m_dirty_all = true;
+            m_dirty_index_vector.clear();
+        }
+
+        // Brings the size of 'snapshot' up to date and copies the elements
+        // and the tree paths of the leaves in 'dirty_index_vector' into it.
+        void copy_changes(Snapshot& snapshot,
+                          const std::vector<uint32_t>& dirty_index_vector) {
+            size_t size = m_element_vector.size();
+            size_t snapshot_size = snapshot.element_vector.size();
+
+            if (snapshot_size > size) {
+                snapshot.element_vector.erase(
+                    snapshot.element_vector.begin() + size,
+                    snapshot.element_vector.end());
+            } else if (snapshot_size < size) {
+                snapshot.element_vector.insert(
+                    snapshot.element_vector.end(),
+                    m_element_vector.begin() + snapshot_size,
+                    m_element_vector.end());
+            }
+
+            for (uint32_t index : dirty_index_vector) {
+                if (index < size) {
+                    snapshot.element_vector[index] = m_element_vector[index];
+                }
+
+                for (size_t node = m_capacity + index; node != 0; node /= 2) {
+                    snapshot.tree_vector[node] = m_tree_vector[node];
+                }
+            }
+        }
+
+        void grow() {
+            std::vector<double> tree_vector(4 * m_capacity, 0.0);
+
+            std::copy(m_tree_vector.begin() + m_capacity,
+                      m_tree_vector.end(),
+                      tree_vector.begin() + 2 * m_capacity);
+
+            m_capacity *= 2;
+            m_tree_vector.swap(tree_vector);
+            mark_all_dirty();
+
+            for (size_t node = m_capacity - 1; node != 0; --node) {
+                m_tree_vector[node] = m_tree_vector[2 * node] +
+                                      m_tree_vector[2 * node + 1];
+            }
+        }
+
+        // Frees the retired snapshots that no sampler can be reading: those
+        // replaced before the earliest epoch announced by a sampler. The
+        // latest of them is kept for the next publish(), which then has the
+        // fewest changes to copy into it.
+        void reclaim_snapshots() {
+            uint64_t minimum_epoch = UINT64_MAX;
+
+            for (size_t i = 0; i < m_reader_slot_count; ++i) {
+                uint64_t epoch = m_reader_slots[i].epoch.load();
+
+                if (epoch != 0) {
+                    minimum_epoch = std::min(minimum_epoch, epoch);
+                }
+            }
+
+            auto end = std::remove_if(
+                        m_retired_snapshot_vector.begin(),
+                        m_retired_snapshot_vector.end(),
+                        [this, minimum_epoch](
+                            std::pair<uint64_t,
+                                      std::unique_ptr<Snapshot>>& retired) {
+                            if (retired.first >= minimum_epoch) {
+                                return false;
+                            }
+
+                            m_spare_snapshot = std::move(retired.second);
+                            return true;
+                        });
+
+            m_retired_snapshot_vector.erase(end,
+                                            m_retired_snapshot_vector.end());
+        }
+
+        void check_weight(double weight) const {
+            if (std::isnan(weight)) {
+                throw std::invalid_argument("The input weight is NaN.");
+            }
+
+            if (weight <= 0.0) {
+                std::stringstream ss;
+                ss << "The input weight is non-positive: " << weight << ".";
+                throw std::invalid_argument(ss.str());
+            }
+
+            if (std::isinf(weight)) {
+                throw std::invalid_argument(
+                                    "The input weight is positive infinity.");
+            }
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_CONCURRENT_PROBABILITY_DISTRIBUTION_HPP
@@ -0,0 +1,584 @@
+#ifndef NET_CODERODDE_UTIL_DENSE_ID_PROBABILITY_DISTRIBUTION_HPP
+#define NET_CODERODDE_UTIL_DENSE_ID_PROBABILITY_DISTRIBUTION_HPP
+
+#include "ProbabilityDistribution.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Implements the probability distribution over dense integral ids, that
+    // is, the elements are the integers 0, 1, 2, ... up to some moderate
+    // bound, such as the indices of another array. Every array is indexed
+    // by the id itself: a bitmap marks the ids present, and a Fenwick tree
+    // over the weights of all the ids, zero for the absent ones, serves the
+    // sampling. There is no element index to hash into and no per-element
+    // allocation; contains_element() is a bit test, and adding, removing and
+    // sampling take O(log m) time, where m is the capacity. The capacity
+    // is the smallest power of two above the largest id ever added, so the
+    // memory is proportional to that id rather than to the size. The handle
+    // of an element is its id together with a generation kept per id.
+    template<typename T, typename Engine = std::mt19937>
+    class DenseIdProbabilityDistribution final :
+    public ProbabilityDistribution<T, Engine> {
+
+        static_assert(std::is_integral<T>::value,
+                      "The elements must be integral ids.");
+
+    public:
+        DenseIdProbabilityDistribution()
+        :
+        ProbabilityDistribution<T, Engine>{},
+        m_fenwick_tree_vector(1, 0.0)
+        {}
+
+        DenseIdProbabilityDistribution(std::random_device::result_type seed)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_fenwick_tree_vector(1, 0.0)
+        {}
+
+        // All the arrays are allocated from 'resource'.
+        DenseIdProbabilityDistribution(std::pmr::memory_resource* resource)
+        :
+        DenseIdProbabilityDistribution(std::random_device::result_type{},
+                                       resource)
+        {}
+
+        DenseIdProbabilityDistribution(std::random_device::result_type seed,
+                                       std::pmr::memory_resource* resource)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_weight_vector(resource),
+        m_presence_bitmap(resource),
+        m_id_vector(resource),
+        m_generation_vector(resource),
+        m_fenwick_tree_vector(1, 0.0, resource)
+        {}
+
+        DenseIdProbabilityDistribution(
+            const DenseIdProbabilityDistribution& other)
+        :
+        ProbabilityDistribution<T, Engine>{other}
+        {
+            m_weight_vector       = other.m_weight_vector;
+            m_presence_bitmap     = other.m_presence_bitmap;
+            m_id_vector           = other.m_id_vector;
+            m_generation_vector   = other.m_generation_vector;
+            m_fenwick_tree_vector = other.m_fenwick_tree_vector;
+        }
+
+        DenseIdProbabilityDistribution(
+            DenseIdProbabilityDistribution&& other)
+        :
+        ProbabilityDistribution<T, Engine>{other},
+        m_weight_vector(std::move(other.m_weight_vector)),
+        m_presence_bitmap(std::move(other.m_presence_bitmap)),
+        m_id_vector(std::move(other.m_id_vector)),
+        m_generation_vector(std::move(other.m_generation_vector)),
+        m_fenwick_tree_vector(std::move(other.m_fenwick_tree_vector))
+        {
+            other.clear();
+        }
+
+        DenseIdProbabilityDistribution& operator=(
+            const DenseIdProbabilityDistribution& other) {
+            ProbabilityDistribution<T, Engine>::operator=(other);
+            m_weight_vector       = other.m_weight_vector;
+            m_presence_bitmap     = other.m_presence_bitmap;
+            m_id_vector           = other.m_id_vector;
+            m_generation_vector   = other.m_generation_vector;
+            m_fenwick_tree_vector = other.m_fenwick_tree_vector;
+            return *this;
+        }
+
+        DenseIdProbabilityDistribution& operator=(
+            DenseIdProbabilityDistribution&& other) {
+            if (this == &other) {
+                return *this;
+            }
+
+            ProbabilityDistribution<T, Engine>::operator=(other);
+            m_weight_vector       = std::move(other.m_weight_vector);
+            m_presence_bitmap     = std::move(other.m_presence_bitmap);
+            m_id_vector           = std::move(other.m_id_vector);
+            m_generation_vector   = std::move(other.m_generation_vector);
+            m_fenwick_tree_vector = std::move(other.m_fenwick_tree_vector);
+
+            other.clear();
+            return *this;
+        }
+
+        virtual bool add_element(T const& element, double weight) {
+            return !insert_element(element, weight).is_null();
+        }
+
+        virtual bool add_element(T&& element, double weight) {
+            return !insert_element(element, weight).is_null();
+        }
+
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) {
+            return insert_element(element, weight);
+        }
+
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) {
+            return insert_element(element, weight);
+        }
+
+        virtual T sample_element() {
+            this->check_not_empty();
+            return m_id_vector[sample_id(this->m_generator)];
+        }
+
+        virtual const T& sample_element_reference() {
+            this->check_not_empty();
+            return m_id_vector[sample_id(this->m_generator)];
+        }
+
+        virtual ElementHandle sample_handle() {
+            this->check_not_empty();
+            return get_handle_of_id(sample_id(this->m_generator));
+        }
+
+        virtual ElementHandle get_handle(T const& element) const {
+            if (!contains_element(element)) {
+                return ElementHandle{};
+            }
+
+            return get_handle_of_id(static_cast<size_t>(element));
+        }
+
+        virtual bool contains_handle(ElementHandle handle) const {
+            return handle.index < get_capacity() &&
+                   is_present(handle.index) &&
+                   m_generation_vector[handle.index] == handle.generation;
+        }
+
+        virtual const T& get_element(ElementHandle handle) const {
+            this->check_handle(contains_handle(handle));
+            return m_id_vector[handle.index];
+        }
+
+        virtual bool contains_element(T const& element) const {
+            return is_valid_id(element) &&
+                   static_cast<size_t>(element) < get_capacity() &&
+                   is_present(static_cast<size_t>(element));
+        }
+
+        virtual bool remove_element(T const& element) {
+            if (!contains_element(element)) {
+                return false;
+            }
+
+            remove_id(static_cast<size_t>(element));
+            return true;
+        }
+
+        virtual bool remove_element(ElementHandle handle) {
+            if (!contains_handle(handle)) {
+                return false;
+            }
+
+            remove_id(handle.index);
+            return true;
+        }
+
+        virtual bool update_weight(T const& element, double weight) {
+            if (!contains_element(element)) {
+                return false;
+            }
+
+            update_weight_at(static_cast<size_t>(element), weight);
+            return true;
+        }
+
+        virtual bool update_weight(ElementHandle handle, double weight) {
+            if (!contains_handle(handle)) {
+                return false;
+            }
+
+            update_weight_at(handle.index, weight);
+            return true;
+        }
+
+        virtual double get_weight(T const& element) const {
+            this->check_contains(contains_element(element));
+            return m_weight_vector[static_cast<size_t>(element)];
+        }
+
+        virtual double get_weight(ElementHandle handle) const {
+            this->check_handle(contains_handle(handle));
+            return m_weight_vector[handle.index];
+        }
+
+        // Removes all the elements but keeps the capacity, so that the
+        // handles of the removed elements stay rejected.
+        virtual void clear() {
+            for (size_t id = 0; id < get_capacity(); ++id) {
+                if (is_present(id)) {
+                    advance_generation(id);
+                }
+            }
+
+            this->m_size = 0;
+            this->m_total_weight = 0.0;
+            std::fill(m_weight_vector.begin(), m_weight_vector.end(), 0.0);
+            std::fill(m_presence_bitmap.begin(), m_presence_bitmap.end(), 0);
+            m_fenwick_tree_vector.assign(get_capacity() + 1, 0.0);
+        }
+
+        // Returns the number of ids the arrays currently span.
+        size_t get_capacity() const {
+            return m_weight_vector.size();
+        }
+
+    protected:
+
+        virtual const T& sample_element_with(Engine& generator) const {
+            return m_id_vector[sample_id(generator)];
+        }
+
+        // Serves the batch without the virtual call per sample.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            for (size_t i = 0; i < count; ++i) {
+                samples.push_back(m_id_vector[sample_id(this->m_generator)]);
+            }
+        }
+
+        // Splits the count binomially at the midpoints of the power-of-two
+        // ranges of ids like the Fenwick tree distribution does; the
+        // capacity is a power of two, so the node in the middle of each
+        // range holds the sum of its left half.
+        virtual void sample_counts_impl(
+                            size_t count,
+                            std::vector<std::pair<T, size_t>>& counts) {
+            sample_counts_impl(0,
+                               get_capacity(),
+                               this->m_total_weight,
+                               count,
+                               counts);
+        }
+
+        // Subtracts the weight of each drawn id from the prefix sums, saving
+        // every overwritten entry, and writes the entries back in reverse
+        // order afterwards.
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<std::pair<size_t, double>> sampled_weights;
+            std::vector<std::pair<size_t, double>> saved_entries;
+            double total_weight = this->m_total_weight;
+            size_t capacity = get_capacity();
+
+            while (count > 0) {
+                size_t id = sample_id(this->m_generator);
+
+                // The sums may cancel out to a residue as in the Fenwick tree
+                // distribution; sum the weights anew then, and fall back to
+                // the nearest id not drawn yet if the fresh sums miss too:
+                if (m_weight_vector[id] == 0.0) {
+                    rebuild_prefix_sums(saved_entries);
+                    id = sample_id(this->m_generator);
+
+                    while (m_weight_vector[id] == 0.0) {
+                        id = (id == 0 ? capacity : id) - 1;
+                    }
+                }
+
+                double weight = m_weight_vector[id];
+
+                for (size_t i = id + 1; i <= capacity; i += i & (~i + 1)) {
+                    saved_entries.emplace_back(i, m_fenwick_tree_vector[i]);
+                    m_fenwick_tree_vector[i] -= weight;
+                }
+
+                sampled_weights.emplace_back(id, weight);
+                m_weight_vector[id] = 0.0;
+                this->m_total_weight -= weight;
+                samples.push_back(m_id_vector[id]);
+                count--;
+            }
+
+            for (auto it = saved_entries.crbegin();
+                 it != saved_entries.crend();
+                 ++it) {
+                m_fenwick_tree_vector[it->first] = it->second;
+            }
+
+            for (const auto& sampled_weight : sampled_weights) {
+                m_weight_vector[sampled_weight.first] = sampled_weight.second;
+            }
+
+            this->m_total_weight = total_weight;
+        }
+
+    private:
+
+        static constexpr size_t BITS_PER_WORD    = 64;
+        static constexpr size_t MINIMUM_CAPACITY = 64;
+
+        // The ids must fit the index of a handle.
+        static constexpr size_t MAXIMUM_CAPACITY = size_t{1} << 31;
+
+        // Zero for the absent ids.
+        std::pmr::vector<double>   m_weight_vector;
+        std::pmr::vector<uint64_t> m_presence_bitmap;
+
+        // Holds each id at its own index, so that get_element() and
+        // sample_element_reference() have an element to refer to.
+        std::pmr::vector<T>        m_id_vector;
+        std::pmr::vector<uint32_t> m_generation_vector;
+
+        // One-based; the entry at index 0 is a dummy.
+        std::pmr::vector<double>   m_fenwick_tree_vector;
+
+        static bool is_valid_id(T element) {
+            return !(element < T{}) &&
+                   static_cast<uint64_t>(element) < MAXIMUM_CAPACITY;
+        }
+
+        void check_id(T element) const {
+            if (!is_valid_id(element)) {
+                std::stringstream ss;
+                ss << "The input element is not an id below "
+                   << MAXIMUM_CAPACITY << ": " << +element << ".";
+                throw std::invalid_argument(ss.str());
+            }
+        }
+
+        bool is_present(size_t id) const {
+            return (m_presence_bitmap[id / BITS_PER_WORD] >>
+                    (id % BITS_PER_WORD)) & 1;
+        }
+
+        ElementHandle get_handle_of_id(size_t id) const {
+            return ElementHandle{static_cast<uint32_t>(id),
+                                 m_generation_vector[id]};
+        }
+
+        void advance_generation(size_t id) {
+            // Generation 0 is reserved for the null handle:
+            if (++m_generation_vector[id] == 0) {
+                m_generation_vector[id] = 1;
+            }
+        }
+
+        ElementHandle insert_element(T const& element, double weight) {
+            if (contains_element(element)) {
+                return ElementHandle{};
+            }
+
+            this->check_weight(weight);
+            check_id(element);
+
+            size_t id = static_cast<size_t>(element);
+
+            if (id >= get_capacity()) {
+                grow(id);
+            }
+
+            add_to_prefix_sums(id, weight);
+            m_weight_vector[id] = weight;
+            m_presence_bitmap[id / BITS_PER_WORD] |=
+                uint64_t{1} << (id % BITS_PER_WORD);
+
+            this->m_total_weight += weight;
+            this->m_size++;
+            return get_handle_of_id(id);
+        }
+
+        void remove_id(size_t id) {
+            double weight = m_weight_vector[id];
+            add_to_prefix_sums(id, -weight);
+            m_weight_vector[id] = 0.0;
+            m_presence_bitmap[id / BITS_PER_WORD] &=
+                ~(uint64_t{1} << (id % BITS_PER_WORD));
+
+            advance_generation(id);
+            this->m_total_weight -= weight;
+            this->m_size--;
+        }
+
+        void update_weight_at(size_t id, double weight) {
+            this->check_weight(weight);
+            double weight_delta = weight - m_weight_vector[id];
+            add_to_prefix_sums(id, weight_delta);
+            m_weight_vector[id] = weight;
+            this->m_total_weight += weight_delta;
+        }
+
+        // Doubles the capacity until it exceeds 'id'. With power-of-two
+        // capacities the existing Fenwick nodes keep their ranges, and of the
+        // new nodes only those at the powers of two cover any present id:
+        // their ranges start at id 0, so they all hold the total weight.
+        void grow(size_t id) {
+            size_t capacity     = get_capacity();
+            size_t new_capacity = std::max(capacity, MINIMUM_CAPACITY);
+
+            while (new_capacity <= id) {
+                new_capacity *= 2;
+            }
+
+            m_weight_vector.resize(new_capacity, 0.0);
+            m_presence_bitmap.resize(new_capacity / BITS_PER_WORD, 0);
+            m_generation_vector.resize(new_capacity, 1);
+            m_id_vector.reserve(new_capacity);
+
+            for (size_t i = m_id_vector.size(); i < new_capacity; ++i) {
+                m_id_vector.push_back(static_cast<T>(i));
+            }
+
+            m_fenwick_tree_vector.resize(new_capacity + 1, 0.0);
+
+            if (capacity > 0) {
+                for (size_t i = 2 * capacity; i <= new_capacity; i *= 2) {
+                    m_fenwick_tree_vector[i] = m_fenwick_tree_vector[capacity];
+                }
+            }
+        }
+
+        void add_to_prefix_sums(size_t id, double weight_delta) {
+            size_t capacity = get_capacity();
+
+            for (size_t i = id + 1; i <= capacity; i += i & (~i + 1)) {
+                m_fenwick_tree_vector[i] += weight_delta;
+            }
+        }
+
+        // Recomputes the prefix sums and the total weight from the weights
+        // in O(capacity) time, appending every entry to 'saved_entries'
+        // first.
+        void rebuild_prefix_sums(
+                        std::vector<std::pair<size_t, double>>& saved_entries) {
+            size_t capacity = get_capacity();
+            this->m_total_weight = 0.0;
+
+            for (size_t i = 1; i <= capacity; ++i) {
+                saved_entries.emplace_back(i, m_fenwick_tree_vector[i]);
+                m_fenwick_tree_vector[i] = m_weight_vector[i - 1];
+                this->m_total_weight += m_weight_vector[i - 1];
+            }
+
+            for (size_t i = 1; i <= capacity; ++i) {
+                size_t parent = i + (i & (~i + 1));
+
+                if (parent <= capacity) {
+                    m_fenwick_tree_vector[parent] += m_fenwick_tree_vector[i];
+                }
+            }
+        }
+
+        size_t sample_id(Engine& generator) const {
+            double value = generate_uniform_double(generator) *
+                           this->m_total_weight;
+
+            // Find the longest prefix of ids whose weights sum to at most
+            // 'value'; the absent ids weigh nothing, so they are skipped:
+            size_t capacity = get_capacity();
+            size_t id       = 0;
+
+            for (size_t step = capacity / 2; step != 0; step >>= 1) {
+                size_t next_id = id + step;
+
+                if (m_fenwick_tree_vector[next_id] <= value) {
+                    id = next_id;
+                    value -= m_fenwick_tree_vector[next_id];
+                }
+            }
+
+            // Guard against the rounding errors in the prefix sums:
+            if (!is_present(id)) {
+                id = find_nearest_present_id(id);
+            }
+
+            return id;
+        }
+
+        // Returns the closest present id below or at 'id', or above it if
+        // there is none. Only reached through rounding errors.
+        size_t find_nearest_present_id(size_t id) const {
+            size_t word_index = id / BITS_PER_WORD;
+            uint64_t word = m_presence_bitmap[word_index] &
+                            (~uint64_t{0} >>
+                             (BITS_PER_WORD - 1 - id % BITS_PER_WORD));
+
+            while (word == 0 && word_index > 0) {
+                word = m_presence_bitmap[--word_index];
+            }
+
+            if (word != 0) {
+                size_t bit = BITS_PER_WORD - 1;
+
+                while ((word >> bit) == 0) {
+                    bit--;
+                }
+
+                return word_index * BITS_PER_WORD + bit;
+            }
+
+            for (size_t next_id = id + 1; ; ++next_id) {
+                if (is_present(next_id)) {
+                    return next_id;
+                }
+            }
+        }
+
+        // Distributes 'count' over the ids in [id, id + width), whose
+        // weights sum to 'range_weight'.
+        void sample_counts_impl(size_t id,
+                                size_t width,
+                                double range_weight,
+                                size_t count,
+                                std::vector<std::pair<T, size_t>>& counts) {
+            if (count == 0) {
+                return;
+            }
+
+            if (width == 1) {
+                if (!is_present(id)) {
+                    id = find_nearest_present_id(id);
+                }
+
+                counts.emplace_back(m_id_vector[id], count);
+                return;
+            }
+
+            size_t half_width   = width / 2;
+            size_t middle       = id + half_width;
+            double left_weight  = m_fenwick_tree_vector[middle];
+            double right_weight = std::max(range_weight - left_weight, 0.0);
+            size_t left_count =
+                this->generate_binomial(count,
+                                        left_weight /
+                                        (left_weight + right_weight));
+
+            sample_counts_impl(id,
+                               half_width,
+                               left_weight,
+                               left_count,
+                               counts);
+
+            sample_counts_impl(middle,
+                               half_width,
+                               right_weight,
+                               count - left_count,
+                               counts);
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_DENSE_ID_PROBABILITY_DISTRIBUTION_HPP
@@ -0,0 +1,563 @@
+#ifndef NET_CODERODDE_UTIL_FENWICK_TREE_PROBABILITY_DISTRIBUTION_HPP
+#define NET_CODERODDE_UTIL_FENWICK_TREE_PROBABILITY_DISTRIBUTION_HPP
+
+#include "FlatHashIndex.hpp"
+#include "ProbabilityDistribution.hpp"
+#include <algorithm>
+#include <functional>
+#include <memory_resource>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Implements the probability distribution via a Fenwick tree (a binary
+    // indexed tree) of weight prefix sums. All the data resides in flat
+    // arrays: adding, removing and sampling take O(log n) time without any
+    // per-element heap allocation. 'Hash' and 'KeyEqual' hash and compare
+    // the elements in the element index.
+    template<typename T,
+             typename Engine = std::mt19937,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class FenwickTreeProbabilityDistribution final :
+    public ProbabilityDistribution<T, Engine> {
+
+    public:
+        FenwickTreeProbabilityDistribution()
+        :
+        ProbabilityDistribution<T, Engine>{},
+        m_fenwick_tree_vector(1, 0.0)
+        {}
+
+        FenwickTreeProbabilityDistribution(
+            std::random_device::result_type seed)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_fenwick_tree_vector(1, 0.0)
+        {}
+
+        // The storage arrays, the Fenwick tree and the element index are
+        // allocated from 'resource'.
+        FenwickTreeProbabilityDistribution(
+            std::pmr::memory_resource* resource)
+        :
+        FenwickTreeProbabilityDistribution(std::random_device::result_type{},
+                                           resource)
+        {}
+
+        FenwickTreeProbabilityDistribution(
+            std::random_device::result_type seed,
+            std::pmr::memory_resource* resource)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_element_storage_vector(resource),
+        m_weight_storage_vector(resource),
+        m_handle_index_vector(resource),
+        m_fenwick_tree_vector(1, 0.0, resource),
+        m_element_index(resource),
+        m_handle_table(resource)
+        {}
+
+        FenwickTreeProbabilityDistribution(
+            const FenwickTreeProbabilityDistribution& other)
+        :
+        ProbabilityDistribution<T, Engine>{other}
+        {
+            m_element_storage_vector = other.m_element_storage_vector;
+            m_weight_storage_vector  = other.m_weight_storage_vector;
+            m_handle_index_vector    = other.m_handle_index_vector;
+            m_fenwick_tree_vector    = other.m_fenwick_tree_vector;
+            m_element_index          = other.m_element_index;
+            m_handle_table           = other.m_handle_table;
+        }
+
+        FenwickTreeProbabilityDistribution(
+            FenwickTreeProbabilityDistribution&& other)
+        :
+        ProbabilityDistribution<T, Engine>{other},
+        m_element_storage_vector(std::move(other.m_element_storage_vector)),
+        m_weight_storage_vector(std::move(other.m_weight_storage_vector)),
+        m_handle_index_vector(std::move(other.m_handle_index_vector)),
+        m_fenwick_tree_vector(std::move(other.m_fenwick_tree_vector)),
+        m_element_index(std::move(other.m_element_index)),
+        m_handle_table(std::move(other.m_handle_table))
+        {
+            other.clear();
+        }
+
+        FenwickTreeProbabilityDistribution& operator=(
+            const FenwickTreeProbabilityDistribution& other) {
+            ProbabilityDistribution<T, Engine>::operator=(other);
+            m_element_storage_vector = other.m_element_storage_vector;
+            m_weight_storage_vector  = other.m_weight_storage_vector;
+            m_handle_index_vector    = other.m_handle_index_vector;
+            m_fenwick_tree_vector    = other.m_fenwick_tree_vector;
+            m_element_index          = other.m_element_index;
+            m_handle_table           = other.m_handle_table;
+            return *this;
+        }
+
+        FenwickTreeProbabilityDistribution& operator=(
+            FenwickTreeProbabilityDistribution&& other) {
+            if (this == &other) {
+                return *this;
+            }
+
+            ProbabilityDistribution<T, Engine>::operator=(other);
+
+            m_element_storage_vector =
+                std::move(other.m_element_storage_vector);
+
+            m_weight_storage_vector = std::move(other.m_weight_storage_vector);
+            m_handle_index_vector   = std::move(other.m_handle_index_vector);
+            m_fenwick_tree_vector   = std::move(other.m_fenwick_tree_vector);
+            m_element_index         = std::move(other.m_element_index);
+            m_handle_table          = std::move(other.m_handle_table);
+
+            other.clear();
+            return *this;
+        }
+
+        virtual bool add_element(T const& element, double weight) {
+            return !insert_element(element, weight).is_null();
+        }
+
+        virtual bool add_element(T&& element, double weight) {
+            return !insert_element(std::move(element), weight).is_null();
+        }
+
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) {
+            return insert_element(element, weight);
+        }
+
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) {
+            return insert_element(std::move(element), weight);
+        }
+
+        virtual T sample_element() {
+            return sample_element_reference();
+        }
+
+        virtual const T& sample_element_reference() {
+            this->check_not_empty();
+            return get_element(sample_index(this->m_generator));
+        }
+
+        virtual ElementHandle sample_handle() {
+            this->check_not_empty();
+            size_t index = sample_index(this->m_generator);
+            return m_handle_table.get_handle(m_handle_index_vector[index]);
+        }
+
+        virtual ElementHandle get_handle(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+
+            return m_handle_table.get_handle(handle_index);
+        }
+
+        virtual bool contains_handle(ElementHandle handle) const {
+            return m_handle_table.contains(handle);
+        }
+
+        virtual const T& get_element(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return get_element(m_handle_table.get_position(handle.index));
+        }
+
+        virtual bool contains_element(T const& element) const {
+            return find_handle_index(element) != index_type::NOT_FOUND;
+        }
+
+        virtual bool remove_element(T const& element) {
+            uint32_t hash = m_element_index.hash(element);
+            uint32_t handle_index = find_handle_index(element, hash);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            m_element_index.erase(hash, handle_index);
+            remove_at(m_handle_table.get_position(handle_index));
+            return true;
+        }
+
+        virtual bool remove_element(ElementHandle handle) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+
+            size_t index = m_handle_table.get_position(handle.index);
+            m_element_index.erase(m_element_index.hash(get_element(index)),
+                                  handle.index);
+            remove_at(index);
+            return true;
+        }
+
+        virtual bool update_weight(T const& element, double weight) {
+            uint32_t handle_index = find_handle_index(element);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            update_weight_at(m_handle_table.get_position(handle_index), weight);
+            return true;
+        }
+
+        virtual bool update_weight(ElementHandle handle, double weight) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+
+            update_weight_at(m_handle_table.get_position(handle.index), weight);
+            return true;
+        }
+
+        virtual double get_weight(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            this->check_contains(handle_index != index_type::NOT_FOUND);
+            return m_weight_storage_vector[
+                        m_handle_table.get_position(handle_index)];
+        }
+
+        virtual double get_weight(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            size_t index = m_handle_table.get_position(handle.index);
+            return m_weight_storage_vector[index];
+        }
+
+        virtual void clear() {
+            this->m_size = 0;
+            this->m_total_weight = 0.0;
+            m_element_storage_vector.clear();
+            m_weight_storage_vector.clear();
+            m_handle_index_vector.clear();
+            m_fenwick_tree_vector.assign(1, 0.0);
+            m_element_index.clear();
+            m_handle_table.clear();
+        }
+
+    protected:
+
+        virtual const T& sample_element_with(Engine& generator) const {
+            return get_element(sample_index(generator));
+        }
+
+        // Serves the batch without the virtual call per sample.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            for (size_t i = 0; i < count; ++i) {
+                samples.push_back(get_element(sample_index(this->m_generator)));
+            }
+        }
+
+        // The descent of sample_index() is a binary search over ranges of
+        // power-of-two widths, and the Fenwick node in the middle of such a
+        // range holds the sum of its left half. Splitting the count
+        // binomially at each midpoint visits only the ranges that receive a
+        // positive count.
+        virtual void sample_counts_impl(
+                            size_t count,
+                            std::vector<std::pair<T, size_t>>& counts) {
+            size_t width = 1;
+
+            while (width < this->m_size) {
+                width <<= 1;
+            }
+
+            sample_counts_impl(0, width, this->m_total_weight, count, counts);
+        }
+
+        // Subtracts the weight of each drawn element from the prefix sums,
+        // saving every overwritten entry. Writing the entries back in reverse
+        // order restores the tree exactly, free of rounding errors.
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<std::pair<size_t, double>> sampled_weights;
+            std::vector<std::pair<size_t, double>> saved_entries;
+            double total_weight = this->m_total_weight;
+            size_t size = this->m_size;
+
+            while (count > 0) {
+                size_t index = sample_index(this->m_generator);
+
+                // Subtracting a weight far above the others may cancel the
+                // sums out to a residue, leading the search to an element
+                // drawn earlier. Sum the weights not drawn yet anew then;
+                // only the rounding errors of the fresh sums may still miss,
+                // so fall back to the nearest element not drawn yet:
+                if (m_weight_storage_vector[index] == 0.0) {
+                    rebuild_prefix_sums(saved_entries);
+                    index = sample_index(this->m_generator);
+
+                    while (m_weight_storage_vector[index] == 0.0) {
+                        index = (index == 0 ? size : index) - 1;
+                    }
+                }
+
+                double weight = m_weight_storage_vector[index];
+
+                for (size_t i = index + 1; i <= size; i += i & (~i + 1)) {
+                    saved_entries.emplace_back(i, m_fenwick_tree_vector[i]);
+                    m_fenwick_tree_vector[i] -= weight;
+                }
+
+                sampled_weights.emplace_back(index, weight);
+                m_weight_storage_vector[index] = 0.0;
+                this->m_total_weight -= weight;
+                samples.push_back(get_element(index));
+                count--;
+            }
+
+            for (auto it = saved_entries.crbegin();
+                 it != saved_entries.crend();
+                 ++it) {
+                m_fenwick_tree_vector[it->first] = it->second;
+            }
+
+            for (const auto& sampled_weight : sampled_weights) {
+                m_weight_storage_vector[sampled_weight.first] =
+                    sampled_weight.second;
+            }
+
+            this->m_total_weight = total_weight;
+        }
+
+    private:
+        // Maps each element to its handle index.
+        typedef FlatHashIndex<T, Hash, KeyEqual> index_type;
+
+        std::pmr::vector<T>        m_element_storage_vector;
+        std::pmr::vector<double>   m_weight_storage_vector;
+        std::pmr::vector<uint32_t> m_handle_index_vector;
+
+        // One-based; the entry at index 0 is a dummy.
+        std::pmr::vector<double>   m_fenwick_tree_vector;
+        index_type                 m_element_index;
+        HandleTable<size_t>        m_handle_table;
+
+        const T& get_element(size_t index) const {
+            return m_element_storage_vector[index];
+        }
+
+        uint32_t find_handle_index(T const& element) const {
+            return find_handle_index(element, m_element_index.hash(element));
+        }
+
+        uint32_t find_handle_index(T const& element, uint32_t hash) const {
+            return m_element_index.find(
+                        element,
+                        hash,
+                        [this](uint32_t handle_index) -> const T& {
+                            return get_element(
+                                m_handle_table.get_position(handle_index));
+                        });
+        }
+
+        template<typename Element>
+        ElementHandle insert_element(Element&& element, double weight) {
+            uint32_t hash = m_element_index.hash(element);
+
+            if (find_handle_index(element, hash) != index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+
+            this->check_weight(weight);
+
+            // The new Fenwick node covers the range (i - lowbit(i), i], so its
+            // value is the new weight plus the nodes covering the rest of the
+            // range:
+            size_t index      = m_element_storage_vector.size() + 1;
+            size_t lowest_bit = index & (~index + 1);
+            double node_value = weight;
+
+            for (size_t step = 1; step < lowest_bit; step <<= 1) {
+                node_value += m_fenwick_tree_vector[index - step];
+            }
+
+            m_element_storage_vector.push_back(std::forward<Element>(element));
+
+            ElementHandle handle = m_handle_table.acquire(this->m_size);
+            m_handle_index_vector.push_back(handle.index);
+            m_weight_storage_vector.push_back(weight);
+            m_fenwick_tree_vector.push_back(node_value);
+            m_element_index.insert(hash, handle.index);
+            this->m_total_weight += weight;
+            this->m_size++;
+            return handle;
+        }
+
+        // Removes the element at 'target_index', which is already erased from
+        // the element index.
+        void remove_at(size_t target_index) {
+            size_t last_index = m_element_storage_vector.size() - 1;
+            double weight     = m_weight_storage_vector[target_index];
+
+            m_handle_table.release(m_handle_index_vector[target_index]);
+
+            // Move the last element into the hole. No other Fenwick node
+            // covers the last slot, so the prefix sums of the remaining
+            // slots never read its node, which may be simply popped
+            // afterwards:
+            if (target_index != last_index) {
+                double last_weight = m_weight_storage_vector[last_index];
+
+                add_to_prefix_sums(target_index, last_weight - weight);
+
+                m_element_storage_vector[target_index] =
+                    std::move(m_element_storage_vector[last_index]);
+
+                m_handle_index_vector[target_index] =
+                    m_handle_index_vector[last_index];
+
+                m_weight_storage_vector[target_index] = last_weight;
+                m_handle_table.set_position(
+                                    m_handle_index_vector[target_index],
+                                    target_index);
+            }
+
+            m_element_storage_vector.pop_back();
+            m_weight_storage_vector.pop_back();
+            m_handle_index_vector.pop_back();
+            m_fenwick_tree_vector.pop_back();
+
+            this->m_size--;
+            this->m_total_weight -= weight;
+        }
+
+        void update_weight_at(size_t index, double weight) {
+            this->check_weight(weight);
+            double weight_delta = weight - m_weight_storage_vector[index];
+            add_to_prefix_sums(index, weight_delta);
+            m_weight_storage_vector[index] = weight;
+            this->m_total_weight += weight_delta;
+        }
+
+        size_t sample_index(Engine& generator) const {
+            double value = generate_uniform_double(generator) *
+                           this->m_total_weight;
+
+            // Descend from the largest power of two not exceeding the size,
+            // finding the longest prefix whose sum is at most 'value':
+            size_t size  = this->m_size;
+            size_t index = 0;
+            size_t step  = 1;
+
+            while (step <= size / 2) {
+                step <<= 1;
+            }
+
+            for (; step != 0; step >>= 1) {
+                size_t next_index = index + step;
+
+                if (next_index <= size &&
+                    m_fenwick_tree_vector[next_index] <= value) {
+                    index = next_index;
+                    value -= m_fenwick_tree_vector[next_index];
+                }
+            }
+
+            // Guard against the rounding errors in the prefix sums:
+            if (index >= size) {
+                index = size - 1;
+            }
+
+            return index;
+        }
+
+        // Distributes 'count' over the elements at indices
+        // [index, index + width), whose weights sum to 'range_weight'.
+        void sample_counts_impl(size_t index,
+                                size_t width,
+                                double range_weight,
+                                size_t count,
+                                std::vector<std::pair<T, size_t>>& counts) {
+            if (count == 0) {
+                return;
+            }
+
+            if (width == 1) {
+                counts.emplace_back(get_element(index), count);
+                return;
+            }
+
+            size_t half_width = width / 2;
+            size_t middle     = index + half_width;
+
+            // No element lies in the right half:
+            if (middle >= this->m_size) {
+                sample_counts_impl(index,
+                                   half_width,
+                                   range_weight,
+                                   count,
+                                   counts);
+                return;
+            }
+
+            double left_weight  = m_fenwick_tree_vector[middle];
+            double right_weight = std::max(range_weight - left_weight, 0.0);
+            size_t left_count =
+                this->generate_binomial(count,
+                                        left_weight /
+                                        (left_weight + right_weight));
+
+            sample_counts_impl(index,
+                               half_width,
+                               left_weight,
+                               left_count,
+                               counts);
+
+            sample_counts_impl(middle,
+                               half_width,
+                               right_weight,
+                               count - left_count,
+                               counts);
+        }
+
+        void add_to_prefix_sums(size_t index, double weight_delta) {
+            size_t size = m_element_storage_vector.size();
+
+            for (size_t i = index + 1; i <= size; i += i & (~i + 1)) {
+                m_fenwick_tree_vector[i] += weight_delta;
+            }
+        }
+
+        // Recomputes the prefix sums and the total weight from the weights
+        // in O(n) time, appending every entry to 'saved_entries' first.
+        void rebuild_prefix_sums(
+                        std::vector<std::pair<size_t, double>>& saved_entries) {
+            size_t size = this->m_size;
+            this->m_total_weight = 0.0;
+
+            for (size_t i = 1; i <= size; ++i) {
+                saved_entries.emplace_back(i, m_fenwick_tree_vector[i]);
+                m_fenwick_tree_vector[i] = m_weight_storage_vector[i - 1];
+                this->m_total_weight += m_weight_storage_vector[i - 1];
+            }
+
+            // Each node adds its sum to the node covering it next:
+            for (size_t i = 1; i <= size; ++i) {
+                size_t parent = i + (i & (~i + 1));
+
+                if (parent <= size) {
+                    m_fenwick_tree_vector[parent] += m_fenwick_tree_vector[i];
+                }
+            }
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_FENWICK_TREE_PROBABILITY_DISTRIBUTION_HPP
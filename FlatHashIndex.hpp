@@ -0,0 +1,220 @@
+#ifndef NET_CODERODDE_UTIL_FLAT_HASH_INDEX_HPP
+#define NET_CODERODDE_UTIL_FLAT_HASH_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Maps the elements of a distribution to 32-bit values, namely their
+    // handle indices, by open addressing with Robin Hood probing. The index
+    // holds no elements: each entry is just the hash of an element and its
+    // value, 8 bytes in total, in a single array. The lookups are given a
+    // function mapping a value to its element, which is only called for the
+    // entries whose full hash matches. A removal shifts the following
+    // entries of the cluster back by one instead of leaving a tombstone, so
+    // the probe sequences stay as short as after a fresh build.
+    template<typename T,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class FlatHashIndex {
+    public:
+
+        static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+        explicit FlatHashIndex(std::pmr::memory_resource* resource =
+                                   std::pmr::get_default_resource())
+        :
+        m_entry_vector{resource},
+        m_size{0},
+        m_shift{32}
+        {}
+
+        // Mixes the hash of the element by Fibonacci hashing, so that the
+        // identity hash of the integers spreads over the whole table.
+        uint32_t hash(const T& element) const {
+            uint64_t hash = static_cast<uint64_t>(m_hash(element));
+            return static_cast<uint32_t>((hash * 0x9e3779b97f4a7c15ULL) >> 32);
+        }
+
+        template<typename GetElement>
+        uint32_t find(const T& element, const GetElement& get_element) const {
+            return find(element, hash(element), get_element);
+        }
+
+        // Returns the value of the element, or NOT_FOUND. 'hash' is the
+        // result of hash(element).
+        template<typename GetElement>
+        uint32_t find(const T& element,
+                      uint32_t hash,
+                      const GetElement& get_element) const {
+            if (m_size == 0) {
+                return NOT_FOUND;
+            }
+
+            size_t mask = m_entry_vector.size() - 1;
+            size_t distance = 0;
+
+            for (size_t i = get_home(hash); ; i = (i + 1) & mask, ++distance) {
+                const Entry& entry = m_entry_vector[i];
+
+                // An entry closer to its home than the probe would have been
+                // displaced by the element:
+                if (entry.value == EMPTY ||
+                    ((i - get_home(entry.hash)) & mask) < distance) {
+                    return NOT_FOUND;
+                }
+
+                if (entry.hash == hash &&
+                    m_key_equal(get_element(entry.value), element)) {
+                    return entry.value;
+                }
+            }
+        }
+
+        // Adds the value of an element known not to be in the index.
+        void insert(uint32_t hash, uint32_t value) {
+            // Grow at the load factor of 0.8:
+            if (5 * (m_size + 1) > 4 * m_entry_vector.size()) {
+                rehash(m_entry_vector.empty() ?
+                       MINIMUM_CAPACITY :
+                       2 * m_entry_vector.size());
+            }
+
+            place(Entry{hash, value});
+            m_size++;
+        }
+
+        // Removes the value of an element. 'hash' is the hash of the
+        // element, which must be in the index.
+        void erase(uint32_t hash, uint32_t value) {
+            size_t mask = m_entry_vector.size() - 1;
+            size_t i = get_home(hash);
+
+            while (m_entry_vector[i].value != value) {
+                i = (i + 1) & mask;
+            }
+
+            // Shift the rest of the cluster back until an entry at its home
+            // or an empty entry:
+            for (size_t next = (i + 1) & mask;
+                 m_entry_vector[next].value != EMPTY &&
+                 get_home(m_entry_vector[next].hash) != next;
+                 next = (next + 1) & mask) {
+                m_entry_vector[i] = m_entry_vector[next];
+                i = next;
+            }
+
+            m_entry_vector[i].value = EMPTY;
+            m_size--;
+        }
+
+        // Changes the value of an element in the index from 'value' to
+        // 'new_value'. 'hash' is the hash of the element.
+        void replace(uint32_t hash, uint32_t value, uint32_t new_value) {
+            size_t mask = m_entry_vector.size() - 1;
+            size_t i = get_home(hash);
+
+            while (m_entry_vector[i].value != value) {
+                i = (i + 1) & mask;
+            }
+
+            m_entry_vector[i].value = new_value;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+        // Returns the number of entries, which is a power of two.
+        size_t capacity() const {
+            return m_entry_vector.size();
+        }
+
+        void clear() {
+            m_entry_vector.clear();
+            m_size = 0;
+            m_shift = 32;
+        }
+
+    private:
+
+        static constexpr uint32_t EMPTY = UINT32_MAX;
+        static constexpr size_t MINIMUM_CAPACITY = 8;
+
+        struct Entry {
+            uint32_t hash;
+            uint32_t value;
+        };
+
+        std::pmr::vector<Entry> m_entry_vector;
+        size_t                  m_size;
+
+        // The home of a hash is in its uppermost bits, which Fibonacci
+        // hashing mixes best.
+        unsigned                m_shift;
+        Hash                    m_hash;
+        KeyEqual                m_key_equal;
+
+        size_t get_home(uint32_t hash) const {
+            return m_shift == 32 ? 0 : hash >> m_shift;
+        }
+
+        // Puts the entry in place, displacing the entries closer to their
+        // homes.
+        void place(Entry entry) {
+            size_t mask = m_entry_vector.size() - 1;
+            size_t distance = 0;
+
+            for (size_t i = get_home(entry.hash); ; i = (i + 1) & mask) {
+                Entry& current_entry = m_entry_vector[i];
+
+                if (current_entry.value == EMPTY) {
+                    current_entry = entry;
+                    return;
+                }
+
+                size_t current_distance =
+                    (i - get_home(current_entry.hash)) & mask;
+
+                if (current_distance < distance) {
+                    std::swap(current_entry, entry);
+                    distance = current_distance;
+                }
+
+                distance++;
+            }
+        }
+
+        void rehash(size_t capacity) {
+            std::pmr::vector<Entry> entry_vector(
+                                        capacity,
+                                        Entry{0, EMPTY},
+                                        m_entry_vector.get_allocator());
+
+            entry_vector.swap(m_entry_vector);
+            m_shift = 32;
+
+            for (size_t c = capacity; c > 1; c >>= 1) {
+                m_shift--;
+            }
+
+            for (const Entry& entry : entry_vector) {
+                if (entry.value != EMPTY) {
+                    place(entry);
+                }
+            }
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_FLAT_HASH_INDEX_HPP
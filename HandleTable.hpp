@@ -0,0 +1,140 @@
+#ifndef NET_CODERODDE_UTIL_HANDLE_TABLE_HPP
+#define NET_CODERODDE_UTIL_HANDLE_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Refers to an element of a probability distribution by the slot it was
+    // given on insertion. The generation tells apart the successive elements
+    // of a slot, so a handle outliving its element is rejected instead of
+    // referring to whatever element reuses the slot. A default-constructed
+    // handle refers to no element.
+    struct ElementHandle {
+        uint32_t index      = 0;
+        uint32_t generation = 0;
+
+        bool is_null() const {
+            return generation == 0;
+        }
+    };
+
+    inline bool operator==(ElementHandle handle1, ElementHandle handle2) {
+        return handle1.index == handle2.index &&
+               handle1.generation == handle2.generation;
+    }
+
+    inline bool operator!=(ElementHandle handle1, ElementHandle handle2) {
+        return !(handle1 == handle2);
+    }
+
+    // Maps the handles of a distribution to the current positions of their
+    // elements, such as an array index or a node pointer. The distribution
+    // keeps the handle index of each element next to it, so that it can
+    // update the position when it moves the element and release the slot
+    // when it removes it. The released slots are threaded into a free list
+    // and reused, so the table stops growing once it reaches the peak number
+    // of elements.
+    template<typename Position>
+    class HandleTable {
+    public:
+        explicit HandleTable(std::pmr::memory_resource* resource =
+                                 std::pmr::get_default_resource())
+        :
+        m_slot_vector{resource},
+        m_free_list{END_OF_LIST}
+        {}
+
+        // Returns a new handle of the element at 'position'.
+        ElementHandle acquire(const Position& position) {
+            uint32_t index;
+
+            if (m_free_list != END_OF_LIST) {
+                index = m_free_list;
+                m_free_list = m_slot_vector[index].next_free;
+            } else {
+                index = static_cast<uint32_t>(m_slot_vector.size());
+                m_slot_vector.push_back(Slot{});
+            }
+
+            Slot& slot = m_slot_vector[index];
+            slot.position = position;
+            slot.next_free = IN_USE;
+            return ElementHandle{index, slot.generation};
+        }
+
+        // Invalidates the handle of the slot and puts the slot on the free
+        // list.
+        void release(uint32_t index) {
+            Slot& slot = m_slot_vector[index];
+
+            // Generation 0 is reserved for the null handle:
+            if (++slot.generation == 0) {
+                slot.generation = 1;
+            }
+
+            slot.next_free = m_free_list;
+            m_free_list = index;
+        }
+
+        bool contains(ElementHandle handle) const {
+            return handle.index < m_slot_vector.size() &&
+                   m_slot_vector[handle.index].generation ==
+                   handle.generation &&
+                   m_slot_vector[handle.index].next_free == IN_USE;
+        }
+
+        ElementHandle get_handle(uint32_t index) const {
+            return ElementHandle{index, m_slot_vector[index].generation};
+        }
+
+        const Position& get_position(uint32_t index) const {
+            return m_slot_vector[index].position;
+        }
+
+        void set_position(uint32_t index, const Position& position) {
+            m_slot_vector[index].position = position;
+        }
+
+        // Invalidates all the handles, keeping the slots for reuse.
+        void clear() {
+            m_free_list = END_OF_LIST;
+
+            for (size_t i = m_slot_vector.size(); i-- > 0;) {
+                uint32_t index = static_cast<uint32_t>(i);
+
+                if (m_slot_vector[index].next_free == IN_USE) {
+                    release(index);
+                } else {
+                    m_slot_vector[index].next_free = m_free_list;
+                    m_free_list = index;
+                }
+            }
+        }
+
+    private:
+
+        // The values of 'next_free' that are not slot indices.
+        static constexpr uint32_t IN_USE      = UINT32_MAX;
+        static constexpr uint32_t END_OF_LIST = UINT32_MAX - 1;
+
+        struct Slot {
+            Position position{};
+            uint32_t generation = 1;
+            uint32_t next_free  = IN_USE;
+        };
+
+        std::pmr::vector<Slot> m_slot_vector;
+        uint32_t               m_free_list;
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_HANDLE_TABLE_HPP
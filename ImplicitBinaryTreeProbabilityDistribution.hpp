@@ -0,0 +1,520 @@
+#ifndef NET_CODERODDE_UTIL_IMPLICIT_BINARY_TREE_PROBABILITY_DISTRIBUTION_HPP
+#define NET_CODERODDE_UTIL_IMPLICIT_BINARY_TREE_PROBABILITY_DISTRIBUTION_HPP
+
+#include "FlatHashIndex.hpp"
+#include "ProbabilityDistribution.hpp"
+#include <algorithm>
+#include <functional>
+#include <memory_resource>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Implements the probability distribution via a complete binary sum tree
+    // stored in a single array in heap (Eytzinger) order: the children of
+    // the node at index k reside at 2k and 2k + 1, and the leaf of the i-th
+    // element resides at m_capacity + i. The elements are kept in a parallel
+    // array. The descent of sample_element() is plain index arithmetic over
+    // contiguous memory, and adding, removing and updating run in O(log n).
+    // 'Hash' and 'KeyEqual' hash and compare the elements in the element
+    // index.
+    template<typename T,
+             typename Engine = std::mt19937,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class ImplicitBinaryTreeProbabilityDistribution final :
+    public ProbabilityDistribution<T, Engine> {
+
+    public:
+        ImplicitBinaryTreeProbabilityDistribution()
+        :
+        ProbabilityDistribution<T, Engine>{},
+        m_sum_tree_vector(2, 0.0),
+        m_capacity{1}
+        {}
+
+        ImplicitBinaryTreeProbabilityDistribution(
+            std::random_device::result_type seed)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_sum_tree_vector(2, 0.0),
+        m_capacity{1}
+        {}
+
+        // The element array, the sum tree and the element index are
+        // allocated from 'resource'.
+        ImplicitBinaryTreeProbabilityDistribution(
+            std::pmr::memory_resource* resource)
+        :
+        ImplicitBinaryTreeProbabilityDistribution(
+            std::random_device::result_type{},
+            resource)
+        {}
+
+        ImplicitBinaryTreeProbabilityDistribution(
+            std::random_device::result_type seed,
+            std::pmr::memory_resource* resource)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_element_storage_vector(resource),
+        m_handle_index_vector(resource),
+        m_sum_tree_vector(2, 0.0, resource),
+        m_element_index(resource),
+        m_handle_table(resource),
+        m_capacity{1}
+        {}
+
+        ImplicitBinaryTreeProbabilityDistribution(
+            const ImplicitBinaryTreeProbabilityDistribution& other)
+        :
+        ProbabilityDistribution<T, Engine>{other}
+        {
+            m_element_storage_vector = other.m_element_storage_vector;
+            m_handle_index_vector    = other.m_handle_index_vector;
+            m_sum_tree_vector        = other.m_sum_tree_vector;
+            m_element_index          = other.m_element_index;
+            m_handle_table           = other.m_handle_table;
+            m_capacity               = other.m_capacity;
+        }
+
+        ImplicitBinaryTreeProbabilityDistribution(
+            ImplicitBinaryTreeProbabilityDistribution&& other)
+        :
+        ProbabilityDistribution<T, Engine>{other},
+        m_element_storage_vector(std::move(other.m_element_storage_vector)),
+        m_handle_index_vector(std::move(other.m_handle_index_vector)),
+        m_sum_tree_vector(std::move(other.m_sum_tree_vector)),
+        m_element_index(std::move(other.m_element_index)),
+        m_handle_table(std::move(other.m_handle_table)),
+        m_capacity{other.m_capacity}
+        {
+            other.clear();
+        }
+
+        ImplicitBinaryTreeProbabilityDistribution& operator=(
+            const ImplicitBinaryTreeProbabilityDistribution& other) {
+            ProbabilityDistribution<T, Engine>::operator=(other);
+            m_element_storage_vector = other.m_element_storage_vector;
+            m_handle_index_vector    = other.m_handle_index_vector;
+            m_sum_tree_vector        = other.m_sum_tree_vector;
+            m_element_index          = other.m_element_index;
+            m_handle_table           = other.m_handle_table;
+            m_capacity               = other.m_capacity;
+            return *this;
+        }
+
+        ImplicitBinaryTreeProbabilityDistribution& operator=(
+            ImplicitBinaryTreeProbabilityDistribution&& other) {
+            if (this == &other) {
+                return *this;
+            }
+
+            ProbabilityDistribution<T, Engine>::operator=(other);
+
+            m_element_storage_vector =
+                std::move(other.m_element_storage_vector);
+
+            m_handle_index_vector = std::move(other.m_handle_index_vector);
+            m_sum_tree_vector     = std::move(other.m_sum_tree_vector);
+            m_element_index       = std::move(other.m_element_index);
+            m_handle_table        = std::move(other.m_handle_table);
+            m_capacity            = other.m_capacity;
+
+            other.clear();
+            return *this;
+        }
+
+        virtual bool add_element(T const& element, double weight) {
+            return !insert_element(element, weight).is_null();
+        }
+
+        virtual bool add_element(T&& element, double weight) {
+            return !insert_element(std::move(element), weight).is_null();
+        }
+
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) {
+            return insert_element(element, weight);
+        }
+
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) {
+            return insert_element(std::move(element), weight);
+        }
+
+        virtual T sample_element() {
+            return sample_element_reference();
+        }
+
+        virtual const T& sample_element_reference() {
+            this->check_not_empty();
+            return get_element(sample_index(this->m_generator));
+        }
+
+        virtual ElementHandle sample_handle() {
+            this->check_not_empty();
+            size_t index = sample_index(this->m_generator);
+            return m_handle_table.get_handle(m_handle_index_vector[index]);
+        }
+
+        virtual ElementHandle get_handle(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+
+            return m_handle_table.get_handle(handle_index);
+        }
+
+        virtual bool contains_handle(ElementHandle handle) const {
+            return m_handle_table.contains(handle);
+        }
+
+        virtual const T& get_element(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return get_element(m_handle_table.get_position(handle.index));
+        }
+
+        virtual bool contains_element(T const& element) const {
+            return find_handle_index(element) != index_type::NOT_FOUND;
+        }
+
+        virtual bool remove_element(T const& element) {
+            uint32_t hash = m_element_index.hash(element);
+            uint32_t handle_index = find_handle_index(element, hash);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            m_element_index.erase(hash, handle_index);
+            remove_at(m_handle_table.get_position(handle_index));
+            return true;
+        }
+
+        virtual bool remove_element(ElementHandle handle) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+
+            size_t index = m_handle_table.get_position(handle.index);
+            m_element_index.erase(m_element_index.hash(get_element(index)),
+                                  handle.index);
+            remove_at(index);
+            return true;
+        }
+
+        virtual bool update_weight(T const& element, double weight) {
+            uint32_t handle_index = find_handle_index(element);
+
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+
+            this->check_weight(weight);
+            set_leaf_weight(m_handle_table.get_position(handle_index), weight);
+            return true;
+        }
+
+        virtual bool update_weight(ElementHandle handle, double weight) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+
+            this->check_weight(weight);
+            set_leaf_weight(m_handle_table.get_position(handle.index), weight);
+            return true;
+        }
+
+        virtual double get_weight(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            this->check_contains(handle_index != index_type::NOT_FOUND);
+            return m_sum_tree_vector[
+                        m_capacity + m_handle_table.get_position(handle_index)];
+        }
+
+        virtual double get_weight(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            size_t index = m_handle_table.get_position(handle.index);
+            return m_sum_tree_vector[m_capacity + index];
+        }
+
+        virtual void clear() {
+            this->m_size = 0;
+            this->m_total_weight = 0.0;
+            m_element_storage_vector.clear();
+            m_handle_index_vector.clear();
+            m_sum_tree_vector.assign(2, 0.0);
+            m_element_index.clear();
+            m_handle_table.clear();
+            m_capacity = 1;
+        }
+
+    protected:
+
+        virtual const T& sample_element_with(Engine& generator) const {
+            return get_element(sample_index(generator));
+        }
+
+        // Descends with the whole batch of sorted values at once, splitting
+        // the range of values at each internal node.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<double> values = this->generate_sorted_values(count);
+            sample_elements_impl(1,
+                                 values.data(),
+                                 values.data() + values.size(),
+                                 0.0,
+                                 samples);
+
+            this->shuffle_samples(samples);
+        }
+
+        // Splits the count binomially at each internal node according to the
+        // sums of its children, visiting only the subtrees that receive a
+        // positive count.
+        virtual void sample_counts_impl(
+                            size_t count,
+                            std::vector<std::pair<T, size_t>>& counts) {
+            sample_counts_impl(1, count, counts);
+        }
+
+        // Zeroes the leaf of each drawn element and restores the leaves
+        // afterwards. Since the sums are recomputed rather than adjusted, the
+        // masked leaves carry no probability mass at all, and the restored
+        // tree is identical to the original one.
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<std::pair<size_t, double>> sampled_weights;
+            sampled_weights.reserve(count);
+
+            for (size_t i = 0; i < count; ++i) {
+                size_t index = sample_index(this->m_generator);
+                sampled_weights.emplace_back(
+                                    index,
+                                    m_sum_tree_vector[m_capacity + index]);
+
+                set_leaf_weight(index, 0.0);
+                samples.push_back(get_element(index));
+            }
+
+            for (const auto& sampled_weight : sampled_weights) {
+                set_leaf_weight(sampled_weight.first, sampled_weight.second);
+            }
+        }
+
+    private:
+        // Maps each element to its handle index.
+        typedef FlatHashIndex<T, Hash, KeyEqual> index_type;
+
+        std::pmr::vector<T>        m_element_storage_vector;
+        std::pmr::vector<uint32_t> m_handle_index_vector;
+
+        // One-based; the entry at index 0 is unused. The internal node k
+        // holds the sum of the nodes 2k and 2k + 1.
+        std::pmr::vector<double>   m_sum_tree_vector;
+        index_type                 m_element_index;
+        HandleTable<size_t>        m_handle_table;
+
+        // The number of leaves; always a power of two.
+        size_t                     m_capacity;
+
+        const T& get_element(size_t index) const {
+            return m_element_storage_vector[index];
+        }
+
+        uint32_t find_handle_index(T const& element) const {
+            return find_handle_index(element, m_element_index.hash(element));
+        }
+
+        uint32_t find_handle_index(T const& element, uint32_t hash) const {
+            return m_element_index.find(
+                        element,
+                        hash,
+                        [this](uint32_t handle_index) -> const T& {
+                            return get_element(
+                                m_handle_table.get_position(handle_index));
+                        });
+        }
+
+        template<typename Element>
+        ElementHandle insert_element(Element&& element, double weight) {
+            uint32_t hash = m_element_index.hash(element);
+
+            if (find_handle_index(element, hash) != index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+
+            this->check_weight(weight);
+
+            if (this->m_size == m_capacity) {
+                resize(2 * m_capacity);
+            }
+
+            size_t index = this->m_size;
+            m_element_storage_vector.push_back(std::forward<Element>(element));
+
+            ElementHandle handle = m_handle_table.acquire(index);
+            m_handle_index_vector.push_back(handle.index);
+            m_element_index.insert(hash, handle.index);
+            this->m_size++;
+            set_leaf_weight(index, weight);
+            return handle;
+        }
+
+        // Removes the element at 'target_index', which is already erased from
+        // the element index.
+        void remove_at(size_t target_index) {
+            size_t last_index = this->m_size - 1;
+
+            m_handle_table.release(m_handle_index_vector[target_index]);
+
+            // Move the last leaf into the hole so that the occupied leaves
+            // stay contiguous:
+            if (target_index != last_index) {
+                m_element_storage_vector[target_index] =
+                    std::move(m_element_storage_vector[last_index]);
+
+                m_handle_index_vector[target_index] =
+                    m_handle_index_vector[last_index];
+
+                set_leaf_weight(target_index,
+                                m_sum_tree_vector[m_capacity + last_index]);
+
+                m_handle_table.set_position(
+                                    m_handle_index_vector[target_index],
+                                    target_index);
+            }
+
+            set_leaf_weight(last_index, 0.0);
+            m_element_storage_vector.pop_back();
+            m_handle_index_vector.pop_back();
+            this->m_size--;
+
+            if (m_capacity > 1 && this->m_size <= m_capacity / 4) {
+                resize(m_capacity / 2);
+            }
+        }
+
+        size_t sample_index(Engine& generator) const {
+            double value = generate_uniform_double(generator) *
+                           m_sum_tree_vector[1];
+
+            size_t node = 1;
+
+            while (node < m_capacity) {
+                size_t left_child = 2 * node;
+                double left_sum = m_sum_tree_vector[left_child];
+
+                // The test of the right sibling shields the unoccupied leaves
+                // against the rounding errors of 'value':
+                if (value < left_sum ||
+                    m_sum_tree_vector[left_child + 1] == 0.0) {
+                    node = left_child;
+                } else {
+                    value -= left_sum;
+                    node = left_child + 1;
+                }
+            }
+
+            return node - m_capacity;
+        }
+
+        void sample_elements_impl(size_t node,
+                                  const double* begin,
+                                  const double* end,
+                                  double offset,
+                                  std::vector<T>& samples) {
+            if (begin == end) {
+                return;
+            }
+
+            if (node >= m_capacity) {
+                samples.insert(samples.end(),
+                               end - begin,
+                               get_element(node - m_capacity));
+                return;
+            }
+
+            size_t left_child = 2 * node;
+            double split_value = offset + m_sum_tree_vector[left_child];
+            const double* middle =
+                m_sum_tree_vector[left_child + 1] == 0.0 ?
+                end :
+                std::lower_bound(begin, end, split_value);
+
+            sample_elements_impl(left_child, begin, middle, offset, samples);
+            sample_elements_impl(left_child + 1,
+                                 middle,
+                                 end,
+                                 split_value,
+                                 samples);
+        }
+
+        void sample_counts_impl(size_t node,
+                                size_t count,
+                                std::vector<std::pair<T, size_t>>& counts) {
+            if (count == 0) {
+                return;
+            }
+
+            if (node >= m_capacity) {
+                counts.emplace_back(get_element(node - m_capacity), count);
+                return;
+            }
+
+            double left_sum   = m_sum_tree_vector[2 * node];
+            double right_sum  = m_sum_tree_vector[2 * node + 1];
+            size_t left_count =
+                this->generate_binomial(count,
+                                        left_sum / (left_sum + right_sum));
+
+            sample_counts_impl(2 * node, left_count, counts);
+            sample_counts_impl(2 * node + 1, count - left_count, counts);
+        }
+
+        // Sets the weight of a leaf and recomputes the sums on the path to
+        // the root. Recomputing (instead of adding a delta) keeps the sums
+        // free of accumulated rounding errors.
+        void set_leaf_weight(size_t index, double weight) {
+            size_t node = m_capacity + index;
+            m_sum_tree_vector[node] = weight;
+
+            for (node >>= 1; node != 0; node >>= 1) {
+                m_sum_tree_vector[node] = m_sum_tree_vector[2 * node] +
+                                          m_sum_tree_vector[2 * node + 1];
+            }
+
+            this->m_total_weight = m_sum_tree_vector[1];
+        }
+
+        void resize(size_t capacity) {
+            std::pmr::vector<double> sum_tree_vector(
+                                        2 * capacity,
+                                        0.0,
+                                        m_sum_tree_vector.get_allocator());
+
+            std::copy(m_sum_tree_vector.cbegin() + m_capacity,
+                      m_sum_tree_vector.cbegin() + m_capacity + this->m_size,
+                      sum_tree_vector.begin() + capacity);
+
+            for (size_t node = capacity - 1; node != 0; --node) {
+                sum_tree_vector[node] = sum_tree_vector[2 * node] +
+                                        sum_tree_vector[2 * node + 1];
+            }
+
+            m_sum_tree_vector = std::move(sum_tree_vector);
+            m_capacity = capacity;
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_IMPLICIT_BINARY_TREE_PROBABILITY_DISTRIBUTION_HPP
@@ -1,20 +1,30 @@
 #ifndef NET_CODERODDE_UTIL_LINKED_LIST_PROBABILITY_DISTRIBUTION_HPP
 #define NET_CODERODDE_UTIL_LINKED_LIST_PROBABILITY_DISTRIBUTION_HPP
 
+#include "FlatHashIndex.hpp"
+#include "NodePool.hpp"
 #include "ProbabilityDistribution.hpp"
+#include <functional>
 #include <iterator>
+#include <memory_resource>
 #include <random>
-#include <unordered_map>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace net {
 namespace coderodde {
 namespace util {
     
-    template<typename T>
-    class LinkedListProbabilityDistribution :
-    public ProbabilityDistribution<T> {
-
+    // 'Hash' and 'KeyEqual' hash and compare the elements in the element
+    // index.
+    template<typename T,
+             typename Engine = std::mt19937,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>>
+    class LinkedListProbabilityDistribution final :
+    public ProbabilityDistribution<T, Engine> {
+        
         class LinkedListNode {
         private:
             
@@ -22,15 +32,18 @@ namespace util {
             double          m_weight;
             LinkedListNode* m_prev_node;
             LinkedListNode* m_next_node;
+            uint32_t        m_handle_index;
             
         public:
             
-            LinkedListNode(T element, double weight) {
-                m_element = element;
-                m_weight  = weight;
-            }
+            template<typename Element>
+            LinkedListNode(Element&& element, double weight)
+            :
+            m_element(std::forward<Element>(element)),
+            m_weight{weight}
+            {}
             
-            T get_element() const {
+            const T& get_element() const {
                 return m_element;
             }
             
@@ -38,6 +51,18 @@ namespace util {
                 return m_weight;
             }
             
+            void set_weight(double weight) {
+                m_weight = weight;
+            }
+            
+            uint32_t get_handle_index() const {
+                return m_handle_index;
+            }
+            
+            void set_handle_index(uint32_t handle_index) {
+                m_handle_index = handle_index;
+            }
+            
             LinkedListNode* get_prev_linked_list_node() const {
                 return m_prev_node;
             }
@@ -58,35 +83,63 @@ namespace util {
     public:
         LinkedListProbabilityDistribution()
         :
-        ProbabilityDistribution<T>{},
+        ProbabilityDistribution<T, Engine>{},
         m_head{nullptr},
         m_tail{nullptr}
         {}
         
         LinkedListProbabilityDistribution(std::random_device::result_type seed)
         :
-        ProbabilityDistribution<T>{seed},
+        LinkedListProbabilityDistribution(seed,
+                                          std::pmr::get_default_resource())
+        {}
+        
+        // The list nodes and the element index are allocated from 'resource'.
+        LinkedListProbabilityDistribution(std::pmr::memory_resource* resource)
+        :
+        ProbabilityDistribution<T, Engine>{},
+        m_element_index{resource},
+        m_node_pool{resource},
+        m_handle_table{resource},
+        m_head{nullptr},
+        m_tail{nullptr}
+        {}
+        
+        LinkedListProbabilityDistribution(std::random_device::result_type seed,
+                                          std::pmr::memory_resource* resource)
+        :
+        ProbabilityDistribution<T, Engine>{seed},
+        m_element_index{resource},
+        m_node_pool{resource},
+        m_handle_table{resource},
         m_head{nullptr},
         m_tail{nullptr}
         {}
         
         LinkedListProbabilityDistribution(
-            const LinkedListProbabilityDistribution<T>& other) {
-            this->m_size             = other.m_size;
-            this->m_total_weight     = other.m_total_weight;
+            const LinkedListProbabilityDistribution& other)
+        :
+        ProbabilityDistribution<T, Engine>{other}
+        {
+            m_element_index = other.m_element_index;
+            m_handle_table  = other.m_handle_table;
             
             // Copy the internal linked list:
             copy_linked_list(other.m_head);
         }
         
         LinkedListProbabilityDistribution(
-            LinkedListProbabilityDistribution<T>&& other) {
-            this->m_size             = other.m_size;
-            this->m_total_weight     = other.m_total_weight;
-            m_map                    = std::move(other.m_map);
-            m_head                   = other.m_head;
-            m_tail                   = other.m_tail;
-            
+            LinkedListProbabilityDistribution&& other)
+        :
+        ProbabilityDistribution<T, Engine>{other},
+        m_element_index{std::move(other.m_element_index)},
+        m_node_pool{std::move(other.m_node_pool)},
+        m_handle_table{std::move(other.m_handle_table)},
+        m_head{other.m_head},
+        m_tail{other.m_tail}
+        {
+            other.m_element_index.clear();
+            other.m_handle_table.clear();
             other.m_size         = 0;
             other.m_total_weight = 0.0;
             other.m_head         = nullptr;
@@ -94,34 +147,45 @@ namespace util {
         }
         
         LinkedListProbabilityDistribution& operator=(
-            const LinkedListProbabilityDistribution<T>& other) {
+            const LinkedListProbabilityDistribution& other) {
+            if (this == &other) {
+                return *this;
+            }
+            
             delete_linked_list();
+            m_element_index = other.m_element_index;
+            m_handle_table  = other.m_handle_table;
             copy_linked_list(other.m_head);
             
-            this->m_size         = other.m_size;
-            this->m_total_weight = other.m_total_weight;
+            ProbabilityDistribution<T, Engine>::operator=(other);
             return *this;
         }
         
         LinkedListProbabilityDistribution& operator=(
-            LinkedListProbabilityDistribution<T>&& other) {
+            LinkedListProbabilityDistribution&& other) {
             if (this == &other) {
                 return *this;
             }
             
             delete_linked_list();
             
-            this->m_size         = other.m_size;
-            this->m_total_weight = other.m_total_weight;
-            this->m_head         = other.m_head;
-            this->m_tail         = other.m_tail;
-            this->m_map          = std::move(other.m_map);
+            ProbabilityDistribution<T, Engine>::operator=(other);
+            m_element_index = std::move(other.m_element_index);
+            m_handle_table  = std::move(other.m_handle_table);
             
-            other.m_size         = 0;
-            other.m_total_weight = 0.0;
-            other.m_head         = nullptr;
-            other.m_tail         = nullptr;
+            if (m_node_pool.get_memory_resource() ==
+                other.m_node_pool.get_memory_resource()) {
+                m_node_pool.swap(other.m_node_pool);
+                this->m_head = other.m_head;
+                this->m_tail = other.m_tail;
+                other.m_head = nullptr;
+                other.m_tail = nullptr;
+            } else {
+                // The nodes may not migrate to another memory resource:
+                copy_linked_list(other.m_head);
+            }
             
+            other.clear();
             return *this;
         }
 
@@ -130,12 +194,261 @@ namespace util {
         }
         
         virtual bool add_element(T const& element, double weight) {
-            if (m_map.find(element) != m_map.end()) {
+            return !insert_element(element, weight).is_null();
+        }
+        
+        virtual bool add_element(T&& element, double weight) {
+            return !insert_element(std::move(element), weight).is_null();
+        }
+        
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) {
+            return insert_element(element, weight);
+        }
+        
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) {
+            return insert_element(std::move(element), weight);
+        }
+        
+        virtual T sample_element() {
+            return sample_element_reference();
+        }
+        
+        virtual const T& sample_element_reference() {
+            this->check_not_empty();
+            return sample_node(this->m_generator)->get_element();
+        }
+        
+        virtual ElementHandle sample_handle() {
+            this->check_not_empty();
+            return m_handle_table.get_handle(
+                                    sample_node(this->m_generator)
+                                        ->get_handle_index());
+        }
+        
+        virtual ElementHandle get_handle(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            
+            if (handle_index == index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+            
+            return m_handle_table.get_handle(handle_index);
+        }
+        
+        virtual bool contains_handle(ElementHandle handle) const {
+            return m_handle_table.contains(handle);
+        }
+        
+        virtual const T& get_element(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return m_handle_table.get_position(handle.index)->get_element();
+        }
+                
+        virtual bool contains_element(T const& element) const {
+            return find_handle_index(element) != index_type::NOT_FOUND;
+        }
+                
+        virtual bool remove_element(T const& element) {
+            uint32_t hash = m_element_index.hash(element);
+            uint32_t handle_index = find_handle_index(element, hash);
+            
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+            
+            m_element_index.erase(hash, handle_index);
+            remove_node(m_handle_table.get_position(handle_index));
+            return true;
+        }
+        
+        virtual bool remove_element(ElementHandle handle) {
+            if (!m_handle_table.contains(handle)) {
                 return false;
             }
             
+            LinkedListNode* node = m_handle_table.get_position(handle.index);
+            m_element_index.erase(m_element_index.hash(node->get_element()),
+                                  handle.index);
+            remove_node(node);
+            return true;
+        }
+                
+        virtual bool update_weight(T const& element, double weight) {
+            uint32_t handle_index = find_handle_index(element);
+            
+            if (handle_index == index_type::NOT_FOUND) {
+                return false;
+            }
+            
+            set_node_weight(m_handle_table.get_position(handle_index), weight);
+            return true;
+        }
+        
+        virtual bool update_weight(ElementHandle handle, double weight) {
+            if (!m_handle_table.contains(handle)) {
+                return false;
+            }
+            
+            set_node_weight(m_handle_table.get_position(handle.index), weight);
+            return true;
+        }
+        
+        virtual double get_weight(T const& element) const {
+            uint32_t handle_index = find_handle_index(element);
+            this->check_contains(handle_index != index_type::NOT_FOUND);
+            return m_handle_table.get_position(handle_index)->get_weight();
+        }
+        
+        virtual double get_weight(ElementHandle handle) const {
+            this->check_handle(m_handle_table.contains(handle));
+            return m_handle_table.get_position(handle.index)->get_weight();
+        }
+        
+        virtual void clear() {
+            this->m_size = 0;
+            this->m_total_weight = 0.0;
+            delete_linked_list();
+            m_element_index.clear();
+            m_handle_table.clear();
+        }
+                
+    protected:
+        
+        virtual const T& sample_element_with(Engine& generator) const {
+            return sample_node(generator)->get_element();
+        }
+        
+        // Walks the list once for the entire batch of sorted values.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<double> values = this->generate_sorted_values(count);
+            LinkedListNode* node = m_head;
+            double prefix_sum = node->get_weight();
+            
+            for (double value : values) {
+                while (value >= prefix_sum &&
+                       node->get_next_linked_list_node() != nullptr) {
+                    node = node->get_next_linked_list_node();
+                    prefix_sum += node->get_weight();
+                }
+                
+                samples.push_back(node->get_element());
+            }
+            
+            this->shuffle_samples(samples);
+        }
+        
+        // Draws the count of each element from the binomial distribution
+        // conditioned on the counts of the preceding elements. Stops as soon
+        // as the whole count is distributed.
+        virtual void sample_counts_impl(
+                            size_t count,
+                            std::vector<std::pair<T, size_t>>& counts) {
+            double remaining_weight = this->m_total_weight;
+            
+            for (LinkedListNode* node = m_head;
+                 node != nullptr && count > 0;
+                 node = node->get_next_linked_list_node()) {
+                size_t element_count =
+                    node == m_tail ?
+                    count :
+                    this->generate_binomial(count,
+                                            node->get_weight() /
+                                            remaining_weight);
+                
+                if (element_count > 0) {
+                    counts.emplace_back(node->get_element(), element_count);
+                    count -= element_count;
+                }
+                
+                remaining_weight -= node->get_weight();
+            }
+        }
+        
+        // Zeroes the weight of each drawn node so that the walk skips it,
+        // and restores the weights afterwards.
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<std::pair<LinkedListNode*, double>> sampled_weights;
+            sampled_weights.reserve(count);
+            double total_weight = this->m_total_weight;
+            
+            for (size_t i = 0; i < count; ++i) {
+                double value = this->generate_uniform() *
+                               this->m_total_weight;
+                
+                LinkedListNode* sampled_node = nullptr;
+                
+                // Falls back to the last node not drawn yet if the rounding
+                // errors in the total weight make 'value' overshoot:
+                for (LinkedListNode* node = m_head;
+                     node != nullptr;
+                     node = node->get_next_linked_list_node()) {
+                    if (node->get_weight() == 0.0) {
+                        continue;
+                    }
+                    
+                    sampled_node = node;
+                    
+                    if (value < node->get_weight()) {
+                        break;
+                    }
+                    
+                    value -= node->get_weight();
+                }
+                
+                sampled_weights.emplace_back(sampled_node,
+                                             sampled_node->get_weight());
+                
+                this->m_total_weight -= sampled_node->get_weight();
+                sampled_node->set_weight(0.0);
+                samples.push_back(sampled_node->get_element());
+            }
+            
+            for (const auto& sampled_weight : sampled_weights) {
+                sampled_weight.first->set_weight(sampled_weight.second);
+            }
+            
+            this->m_total_weight = total_weight;
+        }
+    
+    private:
+        // Maps each element to its handle index.
+        typedef FlatHashIndex<T, Hash, KeyEqual> index_type;
+        
+        index_type                   m_element_index;
+        NodePool<LinkedListNode>     m_node_pool;
+        HandleTable<LinkedListNode*> m_handle_table;
+        LinkedListNode*              m_head;
+        LinkedListNode*              m_tail;
+        
+        uint32_t find_handle_index(T const& element) const {
+            return find_handle_index(element, m_element_index.hash(element));
+        }
+        
+        uint32_t find_handle_index(T const& element, uint32_t hash) const {
+            return m_element_index.find(
+                        element,
+                        hash,
+                        [this](uint32_t handle_index) -> const T& {
+                            return m_handle_table.get_position(handle_index)
+                                                ->get_element();
+                        });
+        }
+        
+        template<typename Element>
+        ElementHandle insert_element(Element&& element, double weight) {
+            uint32_t hash = m_element_index.hash(element);
+            
+            if (find_handle_index(element, hash) != index_type::NOT_FOUND) {
+                return ElementHandle{};
+            }
+            
             this->check_weight(weight);
-            LinkedListNode* new_node = new LinkedListNode{element, weight};
+            LinkedListNode* new_node =
+                m_node_pool.create(std::forward<Element>(element), weight);
             
             if (m_head == nullptr) {
                 m_head = new_node;
@@ -149,22 +462,23 @@ namespace util {
                 m_tail = new_node;
             }
             
-            m_map[element] = new_node;
+            ElementHandle handle = m_handle_table.acquire(new_node);
+            new_node->set_handle_index(handle.index);
+            m_element_index.insert(hash, handle.index);
             this->m_size++;
             this->m_total_weight += weight;
-            return true;
+            return handle;
         }
-                
-        virtual T sample_element() {
-            this->check_not_empty();
-            double value = this->m_real_distribution(this->m_generator) *
+        
+        LinkedListNode* sample_node(Engine& generator) const {
+            double value = generate_uniform_double(generator) *
                            this->m_total_weight;
             
             for (LinkedListNode* node = m_head;
                  ;
                  node = node->get_next_linked_list_node()) {
                 if (value < node->get_weight()) {
-                    return node->get_element();
+                    return node;
                 }
                 
                 value -= node->get_weight();
@@ -172,39 +486,22 @@ namespace util {
             
             throw std::logic_error{"Should not get here."};
         }
-                
-        virtual bool contains_element(T const& element) const {
-            return m_map.find(element) != m_map.end();
-        }
-                
-        virtual bool remove_element(T const& element) {
-            if (!contains_element(element)) {
-                return false;
-            }
-            
-            LinkedListNode* node = m_map[element];
-            
-            m_map.erase(element);
+        
+        // Removes the node, whose element is already erased from the element
+        // index.
+        void remove_node(LinkedListNode* node) {
+            m_handle_table.release(node->get_handle_index());
             this->m_size--;
             this->m_total_weight -= node->get_weight();
             unlink(node);
-            delete node;
-            return true;
+            m_node_pool.destroy(node);
         }
-                
-        virtual void clear() {
-            this->m_size = 0;
-            this->m_total_weight = 0.0;
-            m_map.clear();
-            delete_linked_list();
-            m_head = nullptr;
-            m_tail = nullptr;
+        
+        void set_node_weight(LinkedListNode* node, double weight) {
+            this->check_weight(weight);
+            this->m_total_weight += weight - node->get_weight();
+            node->set_weight(weight);
         }
-                
-    private:
-        std::unordered_map<T, LinkedListNode*> m_map;
-        LinkedListNode* m_head;
-        LinkedListNode* m_tail;
         
         void unlink(LinkedListNode* node) {
             LinkedListNode* prev_node = node->get_prev_linked_list_node();
@@ -233,12 +530,32 @@ namespace util {
             }
         }
         
+        // Destroys the nodes unless they own nothing, and returns their
+        // memory to the resource in one go.
         void delete_linked_list() {
-            for (LinkedListNode* node = m_head, *next; node != nullptr;) {
-                next = node->get_next_linked_list_node();
-                delete node;
-                node = next;
+            if (!std::is_trivially_destructible<T>::value) {
+                while (m_head != nullptr) {
+                    LinkedListNode* next_node =
+                        m_head->get_next_linked_list_node();
+                    
+                    m_node_pool.destroy(m_head);
+                    m_head = next_node;
+                }
             }
+            
+            m_node_pool.release();
+            m_head = nullptr;
+            m_tail = nullptr;
+        }
+        
+        // Creates a copy of 'node', which takes over the handle of 'node'.
+        LinkedListNode* copy_node(LinkedListNode* node) {
+            LinkedListNode* new_node =
+                m_node_pool.create(node->get_element(), node->get_weight());
+            
+            new_node->set_handle_index(node->get_handle_index());
+            m_handle_table.set_position(node->get_handle_index(), new_node);
+            return new_node;
         }
         
         void copy_linked_list(LinkedListNode* source_head) {
@@ -248,25 +565,18 @@ namespace util {
                 return;
             }
             
-            m_head = m_tail = new LinkedListNode{source_head->get_element(),
-                                                 source_head->get_weight()};
-            
+            m_head = m_tail = copy_node(source_head);
             m_head->set_prev_linked_list_node(nullptr);
-            m_map[m_head->get_element()] = m_head;
             
             for (LinkedListNode* node =
                     source_head->get_next_linked_list_node();
                  node != nullptr;
                  node = node->get_next_linked_list_node()) {
-                LinkedListNode* new_node =
-                    new LinkedListNode(node->get_element(),
-                                          node->get_weight());
+                LinkedListNode* new_node = copy_node(node);
                 
                 m_tail->set_next_linked_list_node(new_node);
                 new_node->set_prev_linked_list_node(m_tail);
                 m_tail = new_node;
-                
-                m_map[new_node->get_element()] = new_node;
             }
             
             m_tail->set_next_linked_list_node(nullptr);
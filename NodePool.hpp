@@ -0,0 +1,176 @@
+#ifndef NET_CODERODDE_UTIL_NODE_POOL_HPP
+#define NET_CODERODDE_UTIL_NODE_POOL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Allocates the nodes of a linked data structure from slabs of
+    // contiguous slots obtained from a memory resource. Destroyed nodes go to
+    // a free list and are reused by the next create(), so a workload of
+    // interleaved insertions and removals stops allocating once the pool has
+    // grown to the peak number of live nodes. release() returns all the slabs
+    // to the memory resource at once.
+    template<typename Node>
+    class NodePool {
+    public:
+        explicit NodePool(std::pmr::memory_resource* resource =
+                                std::pmr::get_default_resource())
+        :
+        m_resource{resource},
+        m_slab_vector{resource},
+        m_free_list{nullptr},
+        m_used_slots_in_last_slab{0},
+        m_capacity{0}
+        {}
+
+        NodePool(const NodePool&) = delete;
+        NodePool& operator=(const NodePool&) = delete;
+
+        NodePool(NodePool&& other)
+        :
+        m_resource{other.m_resource},
+        m_slab_vector{std::move(other.m_slab_vector)},
+        m_free_list{other.m_free_list},
+        m_used_slots_in_last_slab{other.m_used_slots_in_last_slab},
+        m_capacity{other.m_capacity}
+        {
+            other.m_slab_vector.clear();
+            other.m_free_list = nullptr;
+            other.m_used_slots_in_last_slab = 0;
+            other.m_capacity = 0;
+        }
+
+        ~NodePool() {
+            release();
+        }
+
+        // Exchanges the slabs of two pools drawing from the same resource.
+        void swap(NodePool& other) {
+            std::swap(m_slab_vector, other.m_slab_vector);
+            std::swap(m_free_list, other.m_free_list);
+            std::swap(m_used_slots_in_last_slab,
+                      other.m_used_slots_in_last_slab);
+
+            std::swap(m_capacity, other.m_capacity);
+        }
+
+        template<typename... Args>
+        Node* create(Args&&... args) {
+            Slot* slot = allocate_slot();
+
+            try {
+                return new (slot->storage) Node(std::forward<Args>(args)...);
+            } catch (...) {
+                slot->next = m_free_list;
+                m_free_list = slot;
+                throw;
+            }
+        }
+
+        // Destroys the node and puts its slot on the free list.
+        void destroy(Node* node) {
+            node->~Node();
+            Slot* slot = reinterpret_cast<Slot*>(node);
+            slot->next = m_free_list;
+            m_free_list = slot;
+        }
+
+        // Returns all the slabs to the memory resource. The nodes must have
+        // been destroyed or be trivially destructible.
+        void release() {
+            for (const Slab& slab : m_slab_vector) {
+                m_resource->deallocate(slab.slots,
+                                       slab.slot_count * sizeof(Slot),
+                                       alignof(Slot));
+            }
+
+            m_slab_vector.clear();
+            m_free_list = nullptr;
+            m_used_slots_in_last_slab = 0;
+            m_capacity = 0;
+        }
+
+        // Returns the number of slots allocated from the memory resource.
+        size_t capacity() const {
+            return m_capacity;
+        }
+
+        std::pmr::memory_resource* get_memory_resource() const {
+            return m_resource;
+        }
+
+    private:
+
+        union Slot {
+            Slot* next;
+            alignas(Node) unsigned char storage[sizeof(Node)];
+        };
+
+        struct Slab {
+            Slot*  slots;
+            size_t slot_count;
+        };
+
+        static constexpr size_t MINIMUM_SLAB_SLOT_COUNT = 32;
+        static constexpr size_t MAXIMUM_SLAB_SLOT_COUNT = 4096;
+
+        std::pmr::memory_resource* m_resource;
+        std::pmr::vector<Slab>     m_slab_vector;
+        Slot*                      m_free_list;
+        size_t                     m_used_slots_in_last_slab;
+        size_t                     m_capacity;
+
+        Slot* allocate_slot() {
+            if (m_free_list != nullptr) {
+                Slot* slot = m_free_list;
+                m_free_list = slot->next;
+                return slot;
+            }
+
+            if (m_slab_vector.empty() ||
+                m_used_slots_in_last_slab ==
+                    m_slab_vector.back().slot_count) {
+                allocate_slab();
+            }
+
+            return m_slab_vector.back().slots + m_used_slots_in_last_slab++;
+        }
+
+        // Grows the slabs geometrically so that small pools stay small and
+        // large ones need few allocations.
+        void allocate_slab() {
+            size_t slot_count =
+                std::min(std::max(m_capacity, MINIMUM_SLAB_SLOT_COUNT),
+                         MAXIMUM_SLAB_SLOT_COUNT);
+
+            Slot* slots = static_cast<Slot*>(
+                            m_resource->allocate(slot_count * sizeof(Slot),
+                                                 alignof(Slot)));
+
+            try {
+                m_slab_vector.push_back(Slab{slots, slot_count});
+            } catch (...) {
+                m_resource->deallocate(slots,
+                                       slot_count * sizeof(Slot),
+                                       alignof(Slot));
+                throw;
+            }
+
+            m_used_slots_in_last_slab = 0;
+            m_capacity += slot_count;
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_NODE_POOL_HPP
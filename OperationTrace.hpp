@@ -0,0 +1,291 @@
+#ifndef NET_CODERODDE_UTIL_OPERATION_TRACE_HPP
+#define NET_CODERODDE_UTIL_OPERATION_TRACE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // A trace is a binary log of the calls changing or sampling a
+    // probability distribution, recorded by RecordingProbabilityDistribution
+    // and replayed against any backend. It starts with the magic bytes
+    // "PDTRACE1" and the size of an element as a 32-bit integer, followed by
+    // the records. Each record is an operation code byte followed by its
+    // operands: the element for ADD, REMOVE and UPDATE, the weight as a
+    // double for ADD and UPDATE, and the count as a 32-bit integer for
+    // SAMPLE_ELEMENTS, SAMPLE_DISTINCT and SAMPLE_COUNTS, the batches of
+    // sample_elements(), sample_distinct() and sample_counts(). A plain
+    // sample thus takes a single byte. The elements
+    // are stored as their bytes, so they must be trivially copyable, and all
+    // the values are in the byte order of the recording machine.
+    enum class TraceOperation : uint8_t {
+        ADD             = 1,
+        REMOVE          = 2,
+        UPDATE          = 3,
+        SAMPLE          = 4,
+        SAMPLE_ELEMENTS = 5,
+        CLEAR           = 6,
+        SAMPLE_DISTINCT = 7,
+        SAMPLE_COUNTS   = 8,
+    };
+
+    template<typename T>
+    struct TraceRecord {
+        TraceOperation operation;
+        T              element;
+        double         weight;
+        uint32_t       count;
+
+        // Makes the call of the record on 'distribution', passing each
+        // sampled element to 'consume_sample'; an element counted k times
+        // by sample_counts() is passed k times.
+        template<typename Distribution, typename SampleConsumer>
+        void apply(Distribution& distribution,
+                   SampleConsumer& consume_sample) const {
+            switch (operation) {
+                case TraceOperation::ADD:
+                    distribution.add_element(element, weight);
+                    break;
+
+                case TraceOperation::REMOVE:
+                    distribution.remove_element(element);
+                    break;
+
+                case TraceOperation::UPDATE:
+                    distribution.update_weight(element, weight);
+                    break;
+
+                case TraceOperation::SAMPLE:
+                    consume_sample(distribution.sample_element_reference());
+                    break;
+
+                case TraceOperation::SAMPLE_ELEMENTS: {
+                    std::vector<T> samples;
+                    samples.reserve(count);
+                    distribution.sample_elements(count,
+                                                 std::back_inserter(samples));
+
+                    for (const T& sample : samples) {
+                        consume_sample(sample);
+                    }
+
+                    break;
+                }
+
+                case TraceOperation::CLEAR:
+                    distribution.clear();
+                    break;
+
+                case TraceOperation::SAMPLE_DISTINCT: {
+                    std::vector<T> samples;
+                    samples.reserve(count);
+                    distribution.sample_distinct(count,
+                                                 std::back_inserter(samples));
+
+                    for (const T& sample : samples) {
+                        consume_sample(sample);
+                    }
+
+                    break;
+                }
+
+                case TraceOperation::SAMPLE_COUNTS:
+                    for (const auto& element_count :
+                         distribution.sample_counts(count)) {
+                        for (size_t i = 0; i < element_count.second; ++i) {
+                            consume_sample(element_count.first);
+                        }
+                    }
+
+                    break;
+            }
+        }
+    };
+
+    constexpr char TRACE_MAGIC[8] = {
+        'P', 'D', 'T', 'R', 'A', 'C', 'E', '1'
+    };
+
+    // Reads the header of a trace and returns the size of its elements.
+    // Throws std::runtime_error if the stream does not start with a trace
+    // header.
+    inline uint32_t read_trace_header(std::istream& in) {
+        char magic[sizeof(TRACE_MAGIC)];
+        uint32_t element_size;
+
+        if (!in.read(magic, sizeof(magic)) ||
+            std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+            !in.read(reinterpret_cast<char*>(&element_size),
+                     sizeof(element_size))) {
+            throw std::runtime_error{"The input is not an operation trace."};
+        }
+
+        return element_size;
+    }
+
+    template<typename T>
+    class TraceWriter {
+    public:
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "The traced elements must be trivially copyable.");
+
+        // Writes the header to 'out'.
+        explicit TraceWriter(std::ostream& out)
+        :
+        m_out(out),
+        m_record_count{0}
+        {
+            uint32_t element_size = sizeof(T);
+            m_out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+            write_value(element_size);
+        }
+
+        void write(const TraceRecord<T>& record) {
+            write_value(record.operation);
+
+            switch (record.operation) {
+                case TraceOperation::ADD:
+                case TraceOperation::UPDATE:
+                    write_value(record.element);
+                    write_value(record.weight);
+                    break;
+
+                case TraceOperation::REMOVE:
+                    write_value(record.element);
+                    break;
+
+                case TraceOperation::SAMPLE_ELEMENTS:
+                case TraceOperation::SAMPLE_DISTINCT:
+                case TraceOperation::SAMPLE_COUNTS:
+                    write_value(record.count);
+                    break;
+
+                case TraceOperation::SAMPLE:
+                case TraceOperation::CLEAR:
+                    break;
+            }
+
+            m_record_count++;
+        }
+
+        void write(TraceOperation operation,
+                   T const& element = T(),
+                   double weight = 0.0,
+                   uint32_t count = 0) {
+            write(TraceRecord<T>{operation, element, weight, count});
+        }
+
+        uint64_t get_record_count() const {
+            return m_record_count;
+        }
+
+    private:
+        std::ostream& m_out;
+        uint64_t      m_record_count;
+
+        template<typename Value>
+        void write_value(const Value& value) {
+            m_out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+    };
+
+    template<typename T>
+    class TraceReader {
+    public:
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "The traced elements must be trivially copyable.");
+
+        // Reads the header from 'in'. Throws std::runtime_error if the
+        // stream is not a trace of elements of the size of T.
+        explicit TraceReader(std::istream& in)
+        :
+        m_in(in)
+        {
+            if (read_trace_header(m_in) != sizeof(T)) {
+                throw std::runtime_error{
+                    "The elements of the trace are of another size."
+                };
+            }
+        }
+
+        // Reads the next record. Returns false at the end of the trace, and
+        // throws std::runtime_error if the record is malformed or cut short.
+        bool read(TraceRecord<T>& record) {
+            uint8_t operation;
+
+            if (!m_in.read(reinterpret_cast<char*>(&operation),
+                           sizeof(operation))) {
+                return false;
+            }
+
+            record = TraceRecord<T>{static_cast<TraceOperation>(operation),
+                                    T(),
+                                    0.0,
+                                    0};
+
+            switch (record.operation) {
+                case TraceOperation::ADD:
+                case TraceOperation::UPDATE:
+                    read_value(record.element);
+                    read_value(record.weight);
+                    break;
+
+                case TraceOperation::REMOVE:
+                    read_value(record.element);
+                    break;
+
+                case TraceOperation::SAMPLE_ELEMENTS:
+                case TraceOperation::SAMPLE_DISTINCT:
+                case TraceOperation::SAMPLE_COUNTS:
+                    read_value(record.count);
+                    break;
+
+                case TraceOperation::SAMPLE:
+                case TraceOperation::CLEAR:
+                    break;
+
+                default:
+                    throw std::runtime_error{
+                        "The trace contains an unknown operation."
+                    };
+            }
+
+            return true;
+        }
+
+        // Reads the remaining records.
+        std::vector<TraceRecord<T>> read_all() {
+            std::vector<TraceRecord<T>> records;
+            TraceRecord<T> record;
+
+            while (read(record)) {
+                records.push_back(record);
+            }
+
+            return records;
+        }
+
+    private:
+        std::istream& m_in;
+
+        template<typename Value>
+        void read_value(Value& value) {
+            if (!m_in.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+                throw std::runtime_error{"The trace is cut short."};
+            }
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_OPERATION_TRACE_HPP
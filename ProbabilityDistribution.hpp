@@ -1,24 +1,51 @@
 #ifndef NET_CODERODDE_UTIL_PROBABILITY_DISTRIBUTION_HPP
 #define NET_CODERODDE_UTIL_PROBABILITY_DISTRIBUTION_HPP
 
+#include "HandleTable.hpp"
+#include "RandomEngines.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
+#include <exception>
 #include <random>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace net {
 namespace coderodde {
 namespace util {
     
-    template<typename T>
+    // 'Engine' is the random engine used for sampling. Any type satisfying
+    // the UniformRandomBitGenerator requirements and constructible from a
+    // seed will do; see RandomEngines.hpp for small and fast alternatives to
+    // the default std::mt19937, whose state takes up to 5 KB per
+    // distribution.
+    //
+    // This class is the runtime-polymorphic interface. The concrete
+    // distributions are final, so the calls made through their own types
+    // rather than through this class are bound statically, and the search
+    // loops may be inlined into the calling code; templates taking the
+    // distribution type as a parameter get the same benefit.
+    template<typename T, typename Engine = std::mt19937>
     class ProbabilityDistribution {
     public:
+        typedef Engine engine_type;
+        
+        // The number of the samples drawn from a single engine in
+        // parallel_sample().
+        static constexpr size_t PARALLEL_CHUNK_SIZE = 1 << 14;
+        
         ProbabilityDistribution(std::random_device::result_type seed)
         :
         m_size{0},
         m_total_weight{0.0},
         m_generator{seed},
-        m_real_distribution{0.0, 1.0}
+        m_seed{seed},
+        m_parallel_sample_count{0}
         {}
         
         ProbabilityDistribution()
@@ -26,9 +53,12 @@ namespace util {
         m_size{0},
         m_total_weight{0.0},
         m_generator{},
-        m_real_distribution{0.0, 1.0}
+        m_seed{0},
+        m_parallel_sample_count{0}
         {}
         
+        virtual ~ProbabilityDistribution() {}
+        
         virtual bool is_empty() const {
             return m_size == 0;
         }
@@ -38,17 +68,246 @@ namespace util {
         }
         
         virtual bool add_element     (T const& element, double weight) = 0;
+        virtual bool add_element     (T&& element, double weight)      = 0;
         virtual T    sample_element  ()                                = 0;
         virtual bool contains_element(T const& element)          const = 0;
         virtual bool remove_element  (T const& element)                = 0;
         virtual void clear           ()                                = 0;
+        
+        // Returns the sampled element by reference instead of by copy. The
+        // reference stays valid until the distribution is modified.
+        virtual const T& sample_element_reference() = 0;
+        
+        // Constructs an element from 'args' and adds it with 'weight'. The
+        // element is moved into the distribution.
+        template<typename... Args>
+        bool emplace_element(double weight, Args&&... args) {
+            return add_element(T(std::forward<Args>(args)...), weight);
+        }
+        
+        // Sets the weight of an element already in the distribution. Returns
+        // false if the element is not present.
+        virtual bool   update_weight(T const& element, double weight) = 0;
+        
+        // Returns the weight of the element. Throws std::invalid_argument if
+        // the element is not present.
+        virtual double get_weight   (T const& element)          const = 0;
+        
+        // Returns the sum of the weights as the distribution samples by it,
+        // which may differ from the exact sum by rounding errors.
+        virtual double get_total_weight() const {
+            return m_total_weight;
+        }
+        
+        // The following functions refer to the elements by handles instead
+        // of hashing them. A handle stays valid until its element is removed
+        // or the distribution is cleared, and a copy of a distribution
+        // accepts the handles of the original. Removing an element by its
+        // handle still hashes it once in order to drop it from the element
+        // index.
+        
+        // Adds the element like add_element() and returns its handle, or the
+        // null handle if the element is already present.
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) = 0;
+        
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) = 0;
+        
+        // Returns the handle of the element, or the null handle if the
+        // element is not present.
+        virtual ElementHandle get_handle(T const& element) const = 0;
+        
+        // Returns true if the handle refers to an element of this
+        // distribution.
+        virtual bool contains_handle(ElementHandle handle) const = 0;
+        
+        // Samples an element and returns its handle.
+        virtual ElementHandle sample_handle() = 0;
+        
+        // get_element() and get_weight() throw std::invalid_argument for a
+        // handle that refers to no element, while remove_element() and
+        // update_weight() return false.
+        virtual const T& get_element  (ElementHandle handle)          const = 0;
+        virtual bool     remove_element(ElementHandle handle)               = 0;
+        virtual bool     update_weight(ElementHandle handle, double weight) = 0;
+        virtual double   get_weight   (ElementHandle handle)          const = 0;
+        
+        // Draws 'count' independent samples and writes them to 'output'.
+        // Returns the output iterator past the last written sample.
+        template<typename OutputIterator>
+        OutputIterator sample_elements(size_t count, OutputIterator output) {
+            if (count == 0) {
+                return output;
+            }
+            
+            check_not_empty();
+            std::vector<T> samples;
+            samples.reserve(count);
+            sample_elements_impl(count, samples);
+            return std::move(samples.begin(), samples.end(), output);
+        }
+        
+        // Draws 'count' distinct elements without replacement: each draw
+        // picks one of the elements not drawn yet with probability
+        // proportional to its weight. Writes the elements to 'output' in the
+        // order of drawing and returns the output iterator past the last
+        // one. If 'count' exceeds the size, all the elements are written. The
+        // distribution is left as it was.
+        template<typename OutputIterator>
+        OutputIterator sample_distinct(size_t count, OutputIterator output) {
+            count = std::min(count, size());
+            
+            if (count == 0) {
+                return output;
+            }
+            
+            std::vector<T> samples;
+            samples.reserve(count);
+            sample_distinct_impl(count, samples);
+            return std::move(samples.begin(), samples.end(), output);
+        }
+        
+        // Draws 'count' independent samples and returns how many times each
+        // element was drawn, without materializing the sequence of samples.
+        // Only the elements drawn at least once are listed, in no particular
+        // order.
+        std::vector<std::pair<T, size_t>> sample_counts(size_t count) {
+            std::vector<std::pair<T, size_t>> counts;
+            
+            if (count == 0) {
+                return counts;
+            }
+            
+            check_not_empty();
+            sample_counts_impl(count, counts);
+            return counts;
+        }
+        
+        // Draws 'count' independent samples on 'thread_count' threads, or on
+        // as many as the hardware runs if 'thread_count' is 0, and writes
+        // them to output[0], ..., output[count - 1]. The samples are split
+        // into chunks of a fixed size, and each chunk draws from an engine
+        // of its own seeded by SplitMix64 from the seed of the distribution,
+        // the number of the call and the number of the chunk. The output is
+        // thus the same for any number of threads, and it does not depend on
+        // the samples drawn by the other functions. The distribution must
+        // not be modified during the call.
+        template<typename RandomAccessIterator>
+        RandomAccessIterator parallel_sample(size_t count,
+                                             RandomAccessIterator output,
+                                             size_t thread_count) {
+            if (count == 0) {
+                return output;
+            }
+            
+            check_not_empty();
+            prepare_parallel_sampling();
+            
+            if (thread_count == 0) {
+                thread_count = std::max(1u,
+                                        std::thread::hardware_concurrency());
+            }
+            
+            size_t chunk_count = (count + PARALLEL_CHUNK_SIZE - 1) /
+                                 PARALLEL_CHUNK_SIZE;
+            
+            thread_count = std::min(thread_count, chunk_count);
+            uint64_t stream_seed =
+                SplitMix64{(uint64_t{m_seed} << 32) ^
+                           m_parallel_sample_count++}();
+            
+            std::atomic<size_t> next_chunk{0};
+            std::vector<std::exception_ptr> errors(thread_count);
+            
+            auto sample_chunks = [&](size_t thread_index) {
+                try {
+                    for (size_t chunk = next_chunk++;
+                         chunk < chunk_count;
+                         chunk = next_chunk++) {
+                        // The state of SplitMix64 advances by the golden
+                        // gamma, so this is the output number 'chunk' of
+                        // the stream seeded with 'stream_seed':
+                        Engine generator(
+                            static_cast<typename Engine::result_type>(
+                                SplitMix64{stream_seed +
+                                           chunk *
+                                           0x9e3779b97f4a7c15ULL}()));
+                        
+                        size_t end = std::min(count,
+                                              (chunk + 1) *
+                                              PARALLEL_CHUNK_SIZE);
+                        
+                        for (size_t i = chunk * PARALLEL_CHUNK_SIZE;
+                             i < end;
+                             ++i) {
+                            output[i] = sample_element_with(generator);
+                        }
+                    }
+                } catch (...) {
+                    errors[thread_index] = std::current_exception();
+                    next_chunk = chunk_count;
+                }
+            };
+            
+            std::vector<std::thread> threads;
+            
+            for (size_t i = 1; i < thread_count; ++i) {
+                threads.emplace_back(sample_chunks, i);
+            }
+            
+            sample_chunks(0);
+            
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+            
+            for (const std::exception_ptr& error : errors) {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+            
+            return output + count;
+        }
 
     protected:
         
-        size_t                                 m_size;
-        double                                 m_total_weight;
-        std::uniform_real_distribution<double> m_real_distribution;
-        std::mt19937                           m_generator;
+        size_t m_size;
+        double m_total_weight;
+        Engine m_generator;
+        
+        // The seed of 'm_generator' and the number of the calls to
+        // parallel_sample(), from which the engines of the chunks are seeded.
+        std::random_device::result_type m_seed;
+        uint64_t                        m_parallel_sample_count;
+        
+        // Returns a sample drawn with 'generator' without touching any
+        // state, so that several threads may call it at once with engines of
+        // their own.
+        virtual const T& sample_element_with(Engine& generator) const = 0;
+        
+        // Brings the structures read by sample_element_with() up to date
+        // before the threads of parallel_sample() start.
+        virtual void prepare_parallel_sampling() {}
+        
+        // Let the distributions wrapping another one forward the two
+        // functions above to it.
+        static const T& sample_element_with(
+                            const ProbabilityDistribution& distribution,
+                            Engine& generator) {
+            return distribution.sample_element_with(generator);
+        }
+        
+        static void prepare_parallel_sampling(
+                            ProbabilityDistribution& distribution) {
+            distribution.prepare_parallel_sampling();
+        }
+        
+        // Returns a uniformly distributed value from [0, 1).
+        double generate_uniform() {
+            return generate_uniform_double(m_generator);
+        }
         
         void check_weight(double weight) {
             if (std::isnan(weight)) {
@@ -67,6 +326,133 @@ namespace util {
             }
         }
         
+        void check_contains(bool contains) const {
+            if (!contains) {
+                throw std::invalid_argument{
+                    "The input element is not in this probability distribution."
+                };
+            }
+        }
+        
+        void check_handle(bool contains) const {
+            if (!contains) {
+                throw std::invalid_argument{
+                    "The input handle refers to no element of this "
+                    "probability distribution."
+                };
+            }
+        }
+        
+        // Appends 'count' samples to 'samples'. The distribution is known to
+        // be non-empty. Implementations override this with a search that
+        // serves the whole batch at once.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            for (size_t i = 0; i < count; ++i) {
+                samples.push_back(sample_element());
+            }
+        }
+        
+        // Appends 'count' distinct samples to 'samples', where 'count' does
+        // not exceed the size. The default implementation removes each drawn
+        // element and adds all of them back at the end; implementations
+        // override this with one that masks the drawn weights in place.
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            std::vector<double> weights;
+            weights.reserve(count);
+            
+            for (size_t i = 0; i < count; ++i) {
+                T element = sample_element();
+                weights.push_back(get_weight(element));
+                remove_element(element);
+                samples.push_back(element);
+            }
+            
+            for (size_t i = 0; i < count; ++i) {
+                add_element(samples[i], weights[i]);
+            }
+        }
+        
+        // Appends the element counts of 'count' samples to 'counts'. The
+        // distribution is known to be non-empty. The default implementation
+        // tallies the handles of a batch of samples, so that the elements
+        // need not be hashable by std::hash; implementations override this
+        // by splitting 'count' binomially over their structure.
+        virtual void sample_counts_impl(
+                            size_t count,
+                            std::vector<std::pair<T, size_t>>& counts) {
+            std::vector<ElementHandle> handles;
+            handles.reserve(count);
+            
+            for (size_t i = 0; i < count; ++i) {
+                handles.push_back(sample_handle());
+            }
+            
+            std::sort(handles.begin(),
+                      handles.end(),
+                      [](ElementHandle handle1, ElementHandle handle2) {
+                          return handle1.index < handle2.index;
+                      });
+            
+            for (size_t i = 0; i < count;) {
+                size_t run_end = i + 1;
+                
+                while (run_end < count &&
+                       handles[run_end].index == handles[i].index) {
+                    run_end++;
+                }
+                
+                counts.emplace_back(get_element(handles[i]), run_end - i);
+                i = run_end;
+            }
+        }
+        
+        // Returns the number of successes in 'trials' Bernoulli trials with
+        // the success probability 'probability', which is clamped to [0, 1]
+        // in order to absorb rounding errors.
+        size_t generate_binomial(size_t trials, double probability) {
+            if (!(probability > 0.0)) {
+                return 0;
+            }
+            
+            if (probability >= 1.0) {
+                return trials;
+            }
+            
+            return std::binomial_distribution<size_t>{trials,
+                                                      probability}(m_generator);
+        }
+        
+        // Returns 'count' values uniformly distributed over
+        // [0, m_total_weight) in ascending order. Runs in O(count) time by
+        // normalizing the partial sums of exponential spacings instead of
+        // sorting.
+        std::vector<double> generate_sorted_values(size_t count) {
+            std::vector<double> values(count);
+            double sum = 0.0;
+            
+            for (size_t i = 0; i < count; ++i) {
+                sum -= std::log(1.0 - generate_uniform());
+                values[i] = sum;
+            }
+            
+            sum -= std::log(1.0 - generate_uniform());
+            double scale = m_total_weight / sum;
+            
+            for (double& value : values) {
+                value *= scale;
+            }
+            
+            return values;
+        }
+        
+        // Randomizes the order of a batch produced from sorted values so that
+        // the samples are independent of their positions.
+        void shuffle_samples(std::vector<T>& samples) {
+            std::shuffle(samples.begin(), samples.end(), m_generator);
+        }
+        
         void check_not_empty() const {
             if (is_empty()) {
                 throw std::length_error{
@@ -0,0 +1,189 @@
+#ifndef NET_CODERODDE_UTIL_RANDOM_ENGINES_HPP
+#define NET_CODERODDE_UTIL_RANDOM_ENGINES_HPP
+
+#include <cstdint>
+#include <limits>
+#include <random>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Small and fast random engines. Each one satisfies the
+    // UniformRandomBitGenerator requirements, so they can be plugged into the
+    // probability distributions as well as into the standard library
+    // algorithms.
+
+    // SplitMix64 by Sebastiano Vigna: 8 bytes of state. Also used for seeding
+    // the other engines.
+    class SplitMix64 {
+    public:
+        typedef uint64_t result_type;
+
+        SplitMix64() : m_state{0} {}
+        explicit SplitMix64(uint64_t seed) : m_state{seed} {}
+
+        void seed(uint64_t seed) {
+            m_state = seed;
+        }
+
+        static constexpr result_type min() {
+            return 0;
+        }
+
+        static constexpr result_type max() {
+            return std::numeric_limits<result_type>::max();
+        }
+
+        result_type operator()() {
+            uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+    private:
+        uint64_t m_state;
+    };
+
+    // xoshiro256++ by David Blackman and Sebastiano Vigna: 32 bytes of state,
+    // a period of 2^256 - 1.
+    class Xoshiro256PlusPlus {
+    public:
+        typedef uint64_t result_type;
+
+        Xoshiro256PlusPlus() {
+            seed(0);
+        }
+
+        explicit Xoshiro256PlusPlus(uint64_t seed_value) {
+            seed(seed_value);
+        }
+
+        // Expands the seed with SplitMix64, as recommended by the authors.
+        // The resulting state is never all zeros.
+        void seed(uint64_t seed_value) {
+            SplitMix64 seeder{seed_value};
+
+            for (uint64_t& word : m_state) {
+                word = seeder();
+            }
+        }
+
+        static constexpr result_type min() {
+            return 0;
+        }
+
+        static constexpr result_type max() {
+            return std::numeric_limits<result_type>::max();
+        }
+
+        result_type operator()() {
+            uint64_t result = rotate_left(m_state[0] + m_state[3], 23) +
+                              m_state[0];
+
+            uint64_t t = m_state[1] << 17;
+
+            m_state[2] ^= m_state[0];
+            m_state[3] ^= m_state[1];
+            m_state[1] ^= m_state[2];
+            m_state[0] ^= m_state[3];
+            m_state[2] ^= t;
+            m_state[3] = rotate_left(m_state[3], 45);
+
+            return result;
+        }
+
+    private:
+        uint64_t m_state[4];
+
+        static uint64_t rotate_left(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+    };
+
+#ifdef __SIZEOF_INT128__
+
+    // PCG64 (PCG-XSL-RR 128/64) by Melissa O'Neill: 16 bytes of state, a
+    // period of 2^128.
+    class Pcg64 {
+    public:
+        typedef uint64_t result_type;
+
+        Pcg64() {
+            seed(0);
+        }
+
+        explicit Pcg64(uint64_t seed_value) {
+            seed(seed_value);
+        }
+
+        void seed(uint64_t seed_value) {
+            m_state = 0;
+            step();
+            m_state += seed_value;
+            step();
+        }
+
+        static constexpr result_type min() {
+            return 0;
+        }
+
+        static constexpr result_type max() {
+            return std::numeric_limits<result_type>::max();
+        }
+
+        result_type operator()() {
+            step();
+            uint64_t folded = static_cast<uint64_t>(m_state ^ (m_state >> 64));
+            unsigned rotation = static_cast<unsigned>(m_state >> 122);
+            return (folded >> rotation) | (folded << ((-rotation) & 63));
+        }
+
+    private:
+        unsigned __int128 m_state;
+
+        void step() {
+            const unsigned __int128 multiplier =
+                (static_cast<unsigned __int128>(2549297995355413924ULL) << 64) |
+                4865540595714422341ULL;
+
+            const unsigned __int128 increment =
+                (static_cast<unsigned __int128>(6364136223846793005ULL) << 64) |
+                1442695040888963407ULL;
+
+            m_state = m_state * multiplier + increment;
+        }
+    };
+
+#endif // __SIZEOF_INT128__
+
+    // Returns a double uniformly distributed over [0, 1) with all 53 bits of
+    // the mantissa random. Engines producing full 64-bit words need a single
+    // call; full 32-bit engines (such as std::mt19937) need two. Any other
+    // engine falls back to std::generate_canonical.
+    template<typename Engine>
+    inline double generate_uniform_double(Engine& engine) {
+        const double two_to_minus_53 = 1.0 / 9007199254740992.0;
+
+        if (Engine::min() == 0 &&
+            Engine::max() == std::numeric_limits<uint64_t>::max()) {
+            return (static_cast<uint64_t>(engine()) >> 11) * two_to_minus_53;
+        }
+
+        if (Engine::min() == 0 &&
+            Engine::max() == std::numeric_limits<uint32_t>::max()) {
+            uint64_t high = static_cast<uint32_t>(engine()) >> 5;
+            uint64_t low  = static_cast<uint32_t>(engine()) >> 6;
+            return ((high << 26) | low) * two_to_minus_53;
+        }
+
+        return std::generate_canonical<double,
+                    std::numeric_limits<double>::digits>(engine);
+    }
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_RANDOM_ENGINES_HPP
@@ -0,0 +1,267 @@
+#ifndef NET_CODERODDE_UTIL_RECORDING_PROBABILITY_DISTRIBUTION_HPP
+#define NET_CODERODDE_UTIL_RECORDING_PROBABILITY_DISTRIBUTION_HPP
+
+#include "OperationTrace.hpp"
+#include "ProbabilityDistribution.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // Wraps a distribution and forwards all the calls to it, while writing
+    // the calls that change or sample it to an operation trace. The calls
+    // by handle are traced as the calls by the element of the handle, so a
+    // trace replays on any backend. The calls failing with an exception are
+    // not traced, and neither are the queries nor parallel_sample(). The
+    // batches of sample_elements(), sample_distinct() and sample_counts()
+    // are forwarded and traced whole, so the handles of the wrapped
+    // distribution survive them as they would without the wrapper.
+    //
+    // The wrapped distribution must be empty when the recording starts, as
+    // the trace replays from an empty distribution, and it must not be
+    // changed other than through the wrapper while the recording lasts.
+    template<typename T, typename Engine = std::mt19937>
+    class RecordingProbabilityDistribution final :
+    public ProbabilityDistribution<T, Engine> {
+    public:
+
+        // Records the calls on 'distribution' to 'writer'. Throws
+        // std::invalid_argument if the distribution is not empty.
+        RecordingProbabilityDistribution(
+            ProbabilityDistribution<T, Engine>& distribution,
+            TraceWriter<T>& writer)
+        :
+        m_distribution(distribution),
+        m_writer(writer)
+        {
+            if (!distribution.is_empty()) {
+                throw std::invalid_argument{
+                    "The recorded distribution is not empty."
+                };
+            }
+        }
+
+        RecordingProbabilityDistribution(
+            const RecordingProbabilityDistribution&) = delete;
+
+        RecordingProbabilityDistribution& operator=(
+            const RecordingProbabilityDistribution&) = delete;
+
+        virtual bool is_empty() const {
+            return m_distribution.is_empty();
+        }
+
+        virtual size_t size() const {
+            return m_distribution.size();
+        }
+
+        virtual bool add_element(T const& element, double weight) {
+            bool added = m_distribution.add_element(element, weight);
+            m_writer.write(TraceOperation::ADD, element, weight);
+            return added;
+        }
+
+        virtual bool add_element(T&& element, double weight) {
+            T traced_element = element;
+            bool added = m_distribution.add_element(std::move(element),
+                                                    weight);
+            m_writer.write(TraceOperation::ADD, traced_element, weight);
+            return added;
+        }
+
+        virtual T sample_element() {
+            return sample_element_reference();
+        }
+
+        virtual const T& sample_element_reference() {
+            const T& element = m_distribution.sample_element_reference();
+            m_writer.write(TraceOperation::SAMPLE);
+            return element;
+        }
+
+        virtual bool contains_element(T const& element) const {
+            return m_distribution.contains_element(element);
+        }
+
+        virtual bool remove_element(T const& element) {
+            bool removed = m_distribution.remove_element(element);
+            m_writer.write(TraceOperation::REMOVE, element);
+            return removed;
+        }
+
+        virtual void clear() {
+            m_distribution.clear();
+            m_writer.write(TraceOperation::CLEAR);
+        }
+
+        virtual bool update_weight(T const& element, double weight) {
+            bool updated = m_distribution.update_weight(element, weight);
+            m_writer.write(TraceOperation::UPDATE, element, weight);
+            return updated;
+        }
+
+        virtual double get_weight(T const& element) const {
+            return m_distribution.get_weight(element);
+        }
+
+        virtual double get_total_weight() const {
+            return m_distribution.get_total_weight();
+        }
+
+        virtual ElementHandle add_element_handle(T const& element,
+                                                 double weight) {
+            ElementHandle handle = m_distribution.add_element_handle(element,
+                                                                     weight);
+            m_writer.write(TraceOperation::ADD, element, weight);
+            return handle;
+        }
+
+        virtual ElementHandle add_element_handle(T&& element,
+                                                 double weight) {
+            T traced_element = element;
+            ElementHandle handle =
+                m_distribution.add_element_handle(std::move(element),
+                                                  weight);
+            m_writer.write(TraceOperation::ADD, traced_element, weight);
+            return handle;
+        }
+
+        virtual ElementHandle get_handle(T const& element) const {
+            return m_distribution.get_handle(element);
+        }
+
+        virtual bool contains_handle(ElementHandle handle) const {
+            return m_distribution.contains_handle(handle);
+        }
+
+        virtual ElementHandle sample_handle() {
+            ElementHandle handle = m_distribution.sample_handle();
+            m_writer.write(TraceOperation::SAMPLE);
+            return handle;
+        }
+
+        virtual const T& get_element(ElementHandle handle) const {
+            return m_distribution.get_element(handle);
+        }
+
+        // A handle of no element changes nothing, so the call is not traced.
+        virtual bool remove_element(ElementHandle handle) {
+            if (!m_distribution.contains_handle(handle)) {
+                return false;
+            }
+
+            T element = m_distribution.get_element(handle);
+            m_distribution.remove_element(handle);
+            m_writer.write(TraceOperation::REMOVE, element);
+            return true;
+        }
+
+        virtual bool update_weight(ElementHandle handle, double weight) {
+            if (!m_distribution.contains_handle(handle)) {
+                return false;
+            }
+
+            m_distribution.update_weight(handle, weight);
+            m_writer.write(TraceOperation::UPDATE,
+                           m_distribution.get_element(handle),
+                           weight);
+            return true;
+        }
+
+        virtual double get_weight(ElementHandle handle) const {
+            return m_distribution.get_weight(handle);
+        }
+
+    protected:
+
+        typedef ProbabilityDistribution<T, Engine> base_type;
+
+        virtual const T& sample_element_with(Engine& generator) const {
+            return base_type::sample_element_with(m_distribution, generator);
+        }
+
+        virtual void prepare_parallel_sampling() {
+            base_type::prepare_parallel_sampling(m_distribution);
+        }
+
+        // Keeps the batch a batch, so that the replay takes the batched
+        // search of the backend as well. The batches too large for the
+        // count of a record are split.
+        virtual void sample_elements_impl(size_t count,
+                                          std::vector<T>& samples) {
+            while (count > 0) {
+                uint32_t batch_size = static_cast<uint32_t>(
+                    std::min<size_t>(count,
+                                     std::numeric_limits<uint32_t>::max()));
+
+                m_distribution.sample_elements(batch_size,
+                                               std::back_inserter(samples));
+                m_writer.write(TraceOperation::SAMPLE_ELEMENTS,
+                               T(),
+                               0.0,
+                               batch_size);
+                count -= batch_size;
+            }
+        }
+
+        // Unlike a batch of samples, a batch of distinct samples may not be
+        // split, so a batch too large for the count of a record throws
+        // std::length_error.
+        virtual void sample_distinct_impl(size_t count,
+                                          std::vector<T>& samples) {
+            uint32_t batch_size = get_batch_size(count);
+            m_distribution.sample_distinct(batch_size,
+                                           std::back_inserter(samples));
+            m_writer.write(TraceOperation::SAMPLE_DISTINCT,
+                           T(),
+                           0.0,
+                           batch_size);
+        }
+
+        // Neither may a batch of counts, as each element is listed once.
+        virtual void sample_counts_impl(
+                            size_t count,
+                            std::vector<std::pair<T, size_t>>& counts) {
+            uint32_t batch_size = get_batch_size(count);
+            std::vector<std::pair<T, size_t>> batch_counts =
+                m_distribution.sample_counts(batch_size);
+
+            counts.insert(counts.end(),
+                          std::make_move_iterator(batch_counts.begin()),
+                          std::make_move_iterator(batch_counts.end()));
+
+            m_writer.write(TraceOperation::SAMPLE_COUNTS,
+                           T(),
+                           0.0,
+                           batch_size);
+        }
+
+    private:
+
+        ProbabilityDistribution<T, Engine>& m_distribution;
+        TraceWriter<T>&                     m_writer;
+
+        static uint32_t get_batch_size(size_t count) {
+            if (count > std::numeric_limits<uint32_t>::max()) {
+                throw std::length_error{
+                    "The batch is too large to be traced."
+                };
+            }
+
+            return static_cast<uint32_t>(count);
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_RECORDING_PROBABILITY_DISTRIBUTION_HPP
@@ -0,0 +1,281 @@
+#ifndef NET_CODERODDE_UTIL_SHARDED_PROBABILITY_DISTRIBUTION_HPP
+#define NET_CODERODDE_UTIL_SHARDED_PROBABILITY_DISTRIBUTION_HPP
+
+#include "BinaryTreeProbabilityDistribution.hpp"
+#include "RandomEngines.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // A probability distribution safe to modify and sample from any number
+    // of threads. The elements are hashed into a fixed number of shards,
+    // each an independent distribution of the type 'Shard' with its own
+    // lock and random engine, so that the changes to different shards do
+    // not contend. The total weight of each shard is published in an
+    // atomic variable of its own; sampling picks a shard by those totals
+    // without locking and then samples within the shard under its lock.
+    // Since the totals are read one at a time, a sample drawn during
+    // concurrent changes follows the weights as they were at some moment
+    // of each shard rather than at a single moment of the whole.
+    //
+    // Like ConcurrentProbabilityDistribution, this class does not derive
+    // from ProbabilityDistribution: sample_element() takes the random
+    // engine of the calling thread for picking the shard. 'Hash' picks the
+    // shard of an element, and the default shards index their elements by
+    // 'Hash' and 'KeyEqual' as well.
+    template<typename T,
+             typename Hash = std::hash<T>,
+             typename KeyEqual = std::equal_to<T>,
+             typename Shard = BinaryTreeProbabilityDistribution<T,
+                                                                std::mt19937,
+                                                                Hash,
+                                                                KeyEqual>>
+    class ShardedProbabilityDistribution final {
+    public:
+        static constexpr size_t DEFAULT_SHARD_COUNT = 16;
+
+        explicit ShardedProbabilityDistribution(
+            size_t shard_count = DEFAULT_SHARD_COUNT)
+        :
+        ShardedProbabilityDistribution(shard_count,
+                                       std::random_device{}())
+        {}
+
+        // The shard i is seeded with 'seed' + i.
+        ShardedProbabilityDistribution(size_t shard_count,
+                                       std::random_device::result_type seed)
+        :
+        m_shard_count{shard_count},
+        m_shards{new ShardSlot[shard_count]}
+        {
+            if (shard_count == 0) {
+                throw std::invalid_argument{"The shard count is zero."};
+            }
+
+            for (size_t i = 0; i < shard_count; ++i) {
+                m_shards[i].distribution.reset(
+                    new Shard(static_cast<std::random_device::result_type>(
+                                                                seed + i)));
+            }
+        }
+
+        ShardedProbabilityDistribution(
+            const ShardedProbabilityDistribution&) = delete;
+
+        ShardedProbabilityDistribution& operator=(
+            const ShardedProbabilityDistribution&) = delete;
+
+        size_t get_shard_count() const {
+            return m_shard_count;
+        }
+
+        bool is_empty() const {
+            return size() == 0;
+        }
+
+        // The sum of the sizes of the shards, each read at a different
+        // moment.
+        size_t size() const {
+            size_t size = 0;
+
+            for (size_t i = 0; i < m_shard_count; ++i) {
+                size += m_shards[i].size.load(std::memory_order_relaxed);
+            }
+
+            return size;
+        }
+
+        bool add_element(T const& element, double weight) {
+            ShardSlot& shard = get_shard(element);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            if (!shard.distribution->add_element(element, weight)) {
+                return false;
+            }
+
+            shard.publish_total_weight();
+            shard.size.store(shard.distribution->size(),
+                             std::memory_order_relaxed);
+            return true;
+        }
+
+        bool contains_element(T const& element) const {
+            ShardSlot& shard = get_shard(element);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            return shard.distribution->contains_element(element);
+        }
+
+        bool remove_element(T const& element) {
+            ShardSlot& shard = get_shard(element);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            ElementHandle handle = shard.distribution->get_handle(element);
+
+            if (handle.is_null()) {
+                return false;
+            }
+
+            shard.distribution->remove_element(handle);
+            shard.publish_total_weight();
+            shard.size.store(shard.distribution->size(),
+                             std::memory_order_relaxed);
+            return true;
+        }
+
+        bool update_weight(T const& element, double weight) {
+            ShardSlot& shard = get_shard(element);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            ElementHandle handle = shard.distribution->get_handle(element);
+
+            if (handle.is_null()) {
+                return false;
+            }
+
+            shard.distribution->update_weight(handle, weight);
+            shard.publish_total_weight();
+            return true;
+        }
+
+        // Throws std::invalid_argument if the element is not present.
+        double get_weight(T const& element) const {
+            ShardSlot& shard = get_shard(element);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            return shard.distribution->get_weight(element);
+        }
+
+        // Samples an element, using 'generator' only for picking the shard.
+        // Throws std::length_error if the distribution is empty.
+        template<typename Generator>
+        T sample_element(Generator& generator) {
+            for (;;) {
+                double total_weight = 0.0;
+
+                for (size_t i = 0; i < m_shard_count; ++i) {
+                    total_weight += m_shards[i].get_total_weight();
+                }
+
+                size_t index = 0;
+
+                if (total_weight > 0.0) {
+                    double value = generate_uniform_double(generator) *
+                                   total_weight;
+
+                    // Fall back to the last shard on rounding errors:
+                    while (index + 1 < m_shard_count) {
+                        double weight = m_shards[index].get_total_weight();
+
+                        if (value < weight) {
+                            break;
+                        }
+
+                        value -= weight;
+                        index++;
+                    }
+                } else {
+                    // The totals of the shards may round down to zero while
+                    // they still hold elements; pick a shard by the sizes
+                    // then:
+                    size_t size = this->size();
+
+                    if (size == 0) {
+                        throw std::length_error{
+                            "This probability distribution is empty."
+                        };
+                    }
+
+                    size_t position = static_cast<size_t>(
+                                        generate_uniform_double(generator) *
+                                        size);
+
+                    while (index + 1 < m_shard_count) {
+                        size_t shard_size = m_shards[index].size.load(
+                                                    std::memory_order_relaxed);
+
+                        if (position < shard_size) {
+                            break;
+                        }
+
+                        position -= shard_size;
+                        index++;
+                    }
+                }
+
+                ShardSlot& shard = m_shards[index];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                // The shard may have been emptied since its total was read:
+                if (!shard.distribution->is_empty()) {
+                    return shard.distribution->sample_element();
+                }
+            }
+        }
+
+        // Locks the shards one by one, so the elements added concurrently
+        // to the shards already cleared survive.
+        void clear() {
+            for (size_t i = 0; i < m_shard_count; ++i) {
+                ShardSlot& shard = m_shards[i];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.distribution->clear();
+                shard.total_weight.store(0.0, std::memory_order_relaxed);
+                shard.size.store(0, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+
+        // Each shard has cache lines of its own, so that the threads working
+        // on different shards do not share any. The shard distribution is
+        // allocated separately for the same reason, and 'total_weight' and
+        // 'size' are written only under the lock.
+        struct alignas(64) ShardSlot {
+            std::mutex             mutex;
+            std::unique_ptr<Shard> distribution;
+            std::atomic<double>    total_weight{0.0};
+            std::atomic<size_t>    size{0};
+
+            double get_total_weight() const {
+                return total_weight.load(std::memory_order_relaxed);
+            }
+
+            // Publishes the total of the shard distribution itself rather
+            // than a running sum of the changes, which would cancel a weight
+            // far above the others out along with the rest. Called under the
+            // lock.
+            void publish_total_weight() {
+                total_weight.store(distribution->get_total_weight(),
+                                   std::memory_order_relaxed);
+            }
+        };
+
+        size_t                       m_shard_count;
+        std::unique_ptr<ShardSlot[]> m_shards;
+        Hash                         m_hash;
+
+        // Mixes the hash by the finalizer of MurmurHash3 and maps it to a
+        // shard by multiplication instead of a division. The element index
+        // of a shard takes the home of an element from the Fibonacci hash
+        // instead; were the shard chosen by the same bits, all the elements
+        // of a shard would crowd into a fraction of its index.
+        ShardSlot& get_shard(T const& element) const {
+            uint64_t hash = static_cast<uint64_t>(m_hash(element));
+            hash ^= hash >> 33;
+            hash *= 0xff51afd7ed558ccdULL;
+            hash ^= hash >> 33;
+            return m_shards[((hash >> 32) * m_shard_count) >> 32];
+        }
+    };
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_SHARDED_PROBABILITY_DISTRIBUTION_HPP
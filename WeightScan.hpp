@@ -0,0 +1,172 @@
+#ifndef NET_CODERODDE_UTIL_WEIGHT_SCAN_HPP
+#define NET_CODERODDE_UTIL_WEIGHT_SCAN_HPP
+
+#include <cstddef>
+
+// The vector kernels are compiled with per-function target attributes and
+// selected at run time, so the rest of the program needs no special compiler
+// flags. Define NET_CODERODDE_UTIL_NO_SIMD to always use the scalar kernel.
+#if !defined(NET_CODERODDE_UTIL_NO_SIMD) && \
+    (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define NET_CODERODDE_UTIL_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace net {
+namespace coderodde {
+namespace util {
+
+    // All the scan kernels return the smallest index i such that
+    // 'value' < weights[0] + ... + weights[i], or 'size' if there is no such
+    // index.
+    typedef size_t (*WeightScanKernel)(const double* weights,
+                                       size_t size,
+                                       double value);
+
+    inline size_t scan_weights_scalar(const double* weights,
+                                      size_t size,
+                                      double value) {
+        for (size_t i = 0; i < size; ++i) {
+            if (value < weights[i]) {
+                return i;
+            }
+
+            value -= weights[i];
+        }
+
+        return size;
+    }
+
+#ifdef NET_CODERODDE_UTIL_X86_SIMD
+
+    // Returns the inclusive prefix sums of the four lanes.
+    __attribute__((target("avx2")))
+    inline __m256d prefix_sums_avx2(__m256d v) {
+        // [0, v0, v1, v2]:
+        __m256d shifted = _mm256_blend_pd(
+                            _mm256_permute4x64_pd(v, _MM_SHUFFLE(2, 1, 0, 0)),
+                            _mm256_setzero_pd(),
+                            0x1);
+
+        v = _mm256_add_pd(v, shifted);
+
+        // [0, 0, v0, v0 + v1]:
+        shifted = _mm256_permute2f128_pd(v, v, 0x08);
+        return _mm256_add_pd(v, shifted);
+    }
+
+    // Processes eight weights per iteration. Only one subtraction per
+    // iteration depends on the previous one; the prefix sums within the
+    // block and the comparisons run in parallel with it.
+    __attribute__((target("avx2")))
+    inline size_t scan_weights_avx2(const double* weights,
+                                    size_t size,
+                                    double value) {
+        __m256d remaining = _mm256_set1_pd(value);
+        size_t i = 0;
+
+        for (; i + 8 <= size; i += 8) {
+            __m256d low  = prefix_sums_avx2(_mm256_loadu_pd(weights + i));
+            __m256d high = prefix_sums_avx2(_mm256_loadu_pd(weights + i + 4));
+
+            high = _mm256_add_pd(high, _mm256_permute4x64_pd(low, 0xFF));
+
+            int mask =
+                _mm256_movemask_pd(_mm256_cmp_pd(remaining, low, _CMP_LT_OQ)) |
+                (_mm256_movemask_pd(
+                        _mm256_cmp_pd(remaining, high, _CMP_LT_OQ)) << 4);
+
+            if (mask != 0) {
+                return i + __builtin_ctz(mask);
+            }
+
+            remaining = _mm256_sub_pd(remaining,
+                                      _mm256_permute4x64_pd(high, 0xFF));
+        }
+
+        return i + scan_weights_scalar(weights + i,
+                                       size - i,
+                                       _mm256_cvtsd_f64(remaining));
+    }
+
+    // Returns the inclusive prefix sums of the eight lanes.
+    __attribute__((target("avx512f")))
+    inline __m512d prefix_sums_avx512(__m512d v) {
+        const __m512i shift1 = _mm512_set_epi64(6, 5, 4, 3, 2, 1, 0, 0);
+        const __m512i shift2 = _mm512_set_epi64(5, 4, 3, 2, 1, 0, 0, 0);
+        const __m512i shift4 = _mm512_set_epi64(3, 2, 1, 0, 0, 0, 0, 0);
+
+        v = _mm512_add_pd(v, _mm512_maskz_permutexvar_pd(0xFE, shift1, v));
+        v = _mm512_add_pd(v, _mm512_maskz_permutexvar_pd(0xFC, shift2, v));
+        v = _mm512_add_pd(v, _mm512_maskz_permutexvar_pd(0xF0, shift4, v));
+        return v;
+    }
+
+    __attribute__((target("avx512f")))
+    inline __m512d broadcast_last_lane_avx512(__m512d v) {
+        return _mm512_maskz_permutexvar_pd(0xFF, _mm512_set1_epi64(7), v);
+    }
+
+    // Processes sixteen weights per iteration in the same manner as the AVX2
+    // kernel.
+    __attribute__((target("avx512f")))
+    inline size_t scan_weights_avx512(const double* weights,
+                                      size_t size,
+                                      double value) {
+        __m512d remaining = _mm512_set1_pd(value);
+        size_t i = 0;
+
+        for (; i + 16 <= size; i += 16) {
+            __m512d low  = prefix_sums_avx512(_mm512_loadu_pd(weights + i));
+            __m512d high = prefix_sums_avx512(_mm512_loadu_pd(weights + i + 8));
+
+            high = _mm512_add_pd(high, broadcast_last_lane_avx512(low));
+
+            unsigned mask =
+                _mm512_cmp_pd_mask(remaining, low, _CMP_LT_OQ) |
+                (static_cast<unsigned>(
+                    _mm512_cmp_pd_mask(remaining, high, _CMP_LT_OQ)) << 8);
+
+            if (mask != 0) {
+                return i + __builtin_ctz(mask);
+            }
+
+            remaining = _mm512_sub_pd(remaining,
+                                      broadcast_last_lane_avx512(high));
+        }
+
+        double scalar_remaining = _mm512_cvtsd_f64(remaining);
+        return i + scan_weights_avx2(weights + i, size - i, scalar_remaining);
+    }
+
+#endif // NET_CODERODDE_UTIL_X86_SIMD
+
+    // Returns the fastest kernel supported by the running processor.
+    inline WeightScanKernel select_weight_scan_kernel() {
+#ifdef NET_CODERODDE_UTIL_X86_SIMD
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx512f")) {
+            return scan_weights_avx512;
+        }
+
+        if (__builtin_cpu_supports("avx2")) {
+            return scan_weights_avx2;
+        }
+#endif
+        return scan_weights_scalar;
+    }
+
+    inline size_t scan_weights(const double* weights,
+                               size_t size,
+                               double value) {
+        static const WeightScanKernel kernel = select_weight_scan_kernel();
+        return kernel(weights, size, value);
+    }
+
+} // End of namespace net::coderodde::util.
+} // End of namespace net::coderodde.
+} // End of namespace net.
+
+#endif // NET_CODERODDE_UTIL_WEIGHT_SCAN_HPP
@@ -0,0 +1,723 @@
+// The benchmark suite of the probability distributions. Build and run with
+//
+//     g++ -std=c++17 -O2 -o benchmark benchmark.cpp
+//     ./benchmark --format=csv --output=results.csv
+//
+// For each backend, size n, weight profile and workload, the suite builds a
+// distribution of n elements and runs the workload on it: warmup passes
+// first, then the timed repetitions, each a fresh batch of operations
+// continuing from the state the previous one left. The operations are
+// generated before each pass against a model of the distribution, so the
+// timers measure only the calls to the distribution. The throughput is the
+// time of a whole pass divided by its operations; the latency percentiles
+// come from one more pass timing each operation on its own, less the
+// overhead of reading the clock.
+//
+// Options, all of the form --name=value:
+//     --min-n, --max-n    the range of the sizes, swept by powers of ten
+//                         (default 100 and 10000000)
+//     --backends          a comma-separated list (default all)
+//     --profiles          of uniform, zipf and exponential (default all)
+//     --workloads         of sample, read-heavy, balanced and update-heavy
+//                         (default all)
+//     --operations        the operations per pass (default 100000)
+//     --repetitions       the timed passes (default 5)
+//     --warmup            the untimed passes (default 1)
+//     --max-linear-n      the largest n on which the backends taking linear
+//                         time per operation are run (default 100000)
+//     --zipf-exponent     the exponent s of the Zipf weights (default 1)
+//     --seed              the seed of the weights and the operations
+//     --format            text, csv or json (default text)
+//     --output            the output file (default the standard output)
+#include "AliasProbabilityDistribution.hpp"
+#include "ArrayProbabilityDistribution.hpp"
+#include "BinaryTreeProbabilityDistribution.hpp"
+#include "BucketProbabilityDistribution.hpp"
+#include "DenseIdProbabilityDistribution.hpp"
+#include "FenwickTreeProbabilityDistribution.hpp"
+#include "ImplicitBinaryTreeProbabilityDistribution.hpp"
+#include "LinkedListProbabilityDistribution.hpp"
+#include "RandomEngines.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using net::coderodde::util::AliasProbabilityDistribution;
+using net::coderodde::util::ArrayProbabilityDistribution;
+using net::coderodde::util::BinaryTreeProbabilityDistribution;
+using net::coderodde::util::BucketProbabilityDistribution;
+using net::coderodde::util::DenseIdProbabilityDistribution;
+using net::coderodde::util::FenwickTreeProbabilityDistribution;
+using net::coderodde::util::ImplicitBinaryTreeProbabilityDistribution;
+using net::coderodde::util::LinkedListProbabilityDistribution;
+using net::coderodde::util::Xoshiro256PlusPlus;
+
+typedef std::chrono::steady_clock Clock;
+
+// The percentages of the operations; the rest are samples.
+struct Workload {
+    const char* name;
+    unsigned    add_percentage;
+    unsigned    remove_percentage;
+    unsigned    update_percentage;
+};
+
+static const Workload WORKLOADS[] = {
+    { "sample",       0,  0,  0 },
+    { "read-heavy",   5,  5, 10 },
+    { "balanced",    20, 20, 20 },
+    { "update-heavy", 0,  0, 80 },
+};
+
+static const char* const PROFILES[] = { "uniform", "zipf", "exponential" };
+
+struct Options {
+    size_t                   min_n         = 100;
+    size_t                   max_n         = 10 * 1000 * 1000;
+    std::vector<std::string> backends;
+    std::vector<std::string> profiles;
+    std::vector<std::string> workloads;
+    size_t                   operations    = 100 * 1000;
+    size_t                   repetitions   = 5;
+    size_t                   warmup        = 1;
+    size_t                   max_linear_n  = 100 * 1000;
+    double                   zipf_exponent = 1.0;
+    uint64_t                 seed          = 13;
+    std::string              format        = "text";
+    std::string              output;
+};
+
+struct Result {
+    std::string backend;
+    size_t      n;
+    std::string profile;
+    std::string workload;
+    size_t      operations;
+    size_t      repetitions;
+    double      build_ns_per_element;
+    double      ns_per_op_min;
+    double      ns_per_op_median;
+    double      ns_per_op_mean;
+    double      ns_per_op_stddev;
+    double      p50_ns;
+    double      p90_ns;
+    double      p99_ns;
+    double      p999_ns;
+    double      max_ns;
+    int64_t     checksum;
+};
+
+enum class OperationType : uint8_t { ADD, REMOVE, UPDATE, SAMPLE };
+
+struct Operation {
+    OperationType type;
+    int           element;
+    double        weight;
+};
+
+// Keeps the elements present in the distribution under test, so that the
+// removals and the updates are generated for the present elements and the
+// additions for the absent ones. The removed elements are added again
+// before any new one, which keeps the ids dense.
+class WorkloadModel {
+public:
+    WorkloadModel(size_t n,
+                  const std::string& profile,
+                  double zipf_exponent,
+                  uint64_t seed)
+    :
+    m_n{n},
+    m_profile{profile},
+    m_zipf_exponent{zipf_exponent},
+    m_generator{seed},
+    m_next_element{static_cast<int>(n)}
+    {
+        m_position_vector.resize(n);
+    
+        for (size_t i = 0; i < n; ++i) {
+            m_present_vector.push_back(static_cast<int>(i));
+            m_position_vector[i] = i;
+        }
+    }
+    
+    // The initial weights: the profile over the ranks 0, ..., n - 1,
+    // shuffled over the elements.
+    std::vector<double> generate_initial_weights() {
+        std::vector<double> weights;
+        weights.reserve(m_n);
+    
+        for (size_t rank = 0; rank < m_n; ++rank) {
+            weights.push_back(get_weight_of_rank(rank));
+        }
+    
+        std::shuffle(weights.begin(), weights.end(), m_generator);
+        return weights;
+    }
+    
+    std::vector<Operation> generate_operations(const Workload& workload,
+                                               size_t count) {
+        std::vector<Operation> operations;
+        operations.reserve(count);
+    
+        for (size_t i = 0; i < count; ++i) {
+            unsigned percentile = static_cast<unsigned>(m_generator() % 100);
+    
+            if (m_present_vector.empty() ||
+                percentile < workload.add_percentage) {
+                operations.push_back(generate_add());
+                continue;
+            }
+    
+            percentile -= workload.add_percentage;
+    
+            if (percentile < workload.remove_percentage) {
+                operations.push_back(generate_remove());
+                continue;
+            }
+    
+            percentile -= workload.remove_percentage;
+    
+            if (percentile < workload.update_percentage) {
+                operations.push_back(Operation{OperationType::UPDATE,
+                                               pick_present_element(),
+                                               generate_weight()});
+            } else {
+                operations.push_back(Operation{OperationType::SAMPLE,
+                                               0,
+                                               0.0});
+            }
+        }
+    
+        return operations;
+    }
+
+private:
+    size_t                m_n;
+    std::string           m_profile;
+    double                m_zipf_exponent;
+    Xoshiro256PlusPlus    m_generator;
+    std::vector<int>      m_present_vector;
+    std::vector<size_t>   m_position_vector;
+    std::vector<int>      m_absent_vector;
+    int                   m_next_element;
+    
+    // The exponential profile decays by the factor of e^20 over the ranks
+    // whatever the size, so that its shape does not depend on n.
+    double get_weight_of_rank(size_t rank) const {
+        if (m_profile == "zipf") {
+            return std::pow(static_cast<double>(rank + 1), -m_zipf_exponent);
+        }
+    
+        if (m_profile == "exponential") {
+            return std::exp(-20.0 * rank / m_n);
+        }
+    
+        return 1.0;
+    }
+    
+    double generate_weight() {
+        return get_weight_of_rank(m_generator() % m_n);
+    }
+    
+    int pick_present_element() {
+        return m_present_vector[m_generator() % m_present_vector.size()];
+    }
+    
+    Operation generate_add() {
+        int element;
+    
+        if (m_absent_vector.empty()) {
+            element = m_next_element++;
+            m_position_vector.push_back(0);
+        } else {
+            element = m_absent_vector.back();
+            m_absent_vector.pop_back();
+        }
+    
+        m_position_vector[element] = m_present_vector.size();
+        m_present_vector.push_back(element);
+        return Operation{OperationType::ADD, element, generate_weight()};
+    }
+    
+    Operation generate_remove() {
+        size_t position = m_generator() % m_present_vector.size();
+        int element = m_present_vector[position];
+        int last_element = m_present_vector.back();
+        m_present_vector[position] = last_element;
+        m_position_vector[last_element] = position;
+        m_present_vector.pop_back();
+        m_absent_vector.push_back(element);
+        return Operation{OperationType::REMOVE, element, 0.0};
+    }
+};
+
+// Keeps the compiler from dropping the samples.
+static volatile int64_t sink;
+
+template<typename Distribution>
+static int64_t run_operation(Distribution& dist, const Operation& operation) {
+    switch (operation.type) {
+        case OperationType::ADD:
+            dist.add_element(operation.element, operation.weight);
+            return 0;
+    
+        case OperationType::REMOVE:
+            dist.remove_element(operation.element);
+            return 0;
+    
+        case OperationType::UPDATE:
+            dist.update_weight(operation.element, operation.weight);
+            return 0;
+    
+        case OperationType::SAMPLE:
+            return dist.sample_element();
+    }
+    
+    return 0;
+}
+
+static double get_nanoseconds(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// The median of the times of reading the clock twice in a row.
+static double measure_clock_overhead() {
+    std::vector<double> times;
+    
+    for (int i = 0; i < 10000; ++i) {
+        Clock::time_point start = Clock::now();
+        Clock::time_point end = Clock::now();
+        times.push_back(get_nanoseconds(start, end));
+    }
+    
+    std::nth_element(times.begin(),
+                     times.begin() + times.size() / 2,
+                     times.end());
+    return times[times.size() / 2];
+}
+
+// The nearest-rank percentile of the sorted values.
+static double get_percentile(const std::vector<double>& sorted_values,
+                             double percentile) {
+    size_t rank = static_cast<size_t>(
+                    std::ceil(percentile / 100.0 * sorted_values.size()));
+    return sorted_values[std::max<size_t>(rank, 1) - 1];
+}
+
+template<typename Distribution>
+static Result run_benchmark(const std::string& backend,
+                            size_t n,
+                            const std::string& profile,
+                            const Workload& workload,
+                            size_t operation_count,
+                            const Options& options,
+                            double clock_overhead) {
+    WorkloadModel model(n, profile, options.zipf_exponent, options.seed);
+    std::vector<double> weights = model.generate_initial_weights();
+    Distribution dist(static_cast<std::random_device::result_type>(
+                                                            options.seed));
+    
+    Clock::time_point start = Clock::now();
+    
+    for (size_t i = 0; i < n; ++i) {
+        dist.add_element(static_cast<int>(i), weights[i]);
+    }
+    
+    Clock::time_point end = Clock::now();
+    
+    Result result;
+    result.backend = backend;
+    result.n = n;
+    result.profile = profile;
+    result.workload = workload.name;
+    result.operations = operation_count;
+    result.repetitions = options.repetitions;
+    result.build_ns_per_element = get_nanoseconds(start, end) / n;
+    
+    int64_t checksum = 0;
+    
+    for (size_t pass = 0; pass < options.warmup; ++pass) {
+        for (const Operation& operation :
+                model.generate_operations(workload, operation_count)) {
+            checksum += run_operation(dist, operation);
+        }
+    }
+    
+    std::vector<double> pass_times;
+    
+    for (size_t pass = 0; pass < options.repetitions; ++pass) {
+        std::vector<Operation> operations =
+            model.generate_operations(workload, operation_count);
+    
+        start = Clock::now();
+    
+        for (const Operation& operation : operations) {
+            checksum += run_operation(dist, operation);
+        }
+    
+        end = Clock::now();
+        pass_times.push_back(get_nanoseconds(start, end) / operation_count);
+    }
+    
+    std::vector<double> latencies;
+    latencies.reserve(operation_count);
+    
+    for (const Operation& operation :
+            model.generate_operations(workload, operation_count)) {
+        start = Clock::now();
+        checksum += run_operation(dist, operation);
+        end = Clock::now();
+        latencies.push_back(
+            std::max(0.0, get_nanoseconds(start, end) - clock_overhead));
+    }
+    
+    sink = checksum;
+    result.checksum = checksum;
+    
+    double sum = 0.0;
+    
+    for (double time : pass_times) {
+        sum += time;
+    }
+    
+    result.ns_per_op_mean = sum / pass_times.size();
+    double squared_deviation_sum = 0.0;
+    
+    for (double time : pass_times) {
+        squared_deviation_sum += (time - result.ns_per_op_mean) *
+                                 (time - result.ns_per_op_mean);
+    }
+    
+    result.ns_per_op_stddev = std::sqrt(squared_deviation_sum /
+                                        pass_times.size());
+    std::sort(pass_times.begin(), pass_times.end());
+    result.ns_per_op_min = pass_times.front();
+    result.ns_per_op_median = get_percentile(pass_times, 50.0);
+    
+    std::sort(latencies.begin(), latencies.end());
+    result.p50_ns = get_percentile(latencies, 50.0);
+    result.p90_ns = get_percentile(latencies, 90.0);
+    result.p99_ns = get_percentile(latencies, 99.0);
+    result.p999_ns = get_percentile(latencies, 99.9);
+    result.max_ns = latencies.back();
+    return result;
+}
+
+typedef Result (*BenchmarkFunction)(const std::string&,
+                                    size_t,
+                                    const std::string&,
+                                    const Workload&,
+                                    size_t,
+                                    const Options&,
+                                    double);
+
+// A backend takes linear time per operation either always or only once its
+// samples are interleaved with changes, as the alias method rebuilding its
+// table.
+struct Backend {
+    const char*       name;
+    BenchmarkFunction function;
+    bool              linear;
+    bool              linear_on_changes;
+};
+
+static const Backend BACKENDS[] = {
+    { "Array",
+      run_benchmark<ArrayProbabilityDistribution<int>>,
+      true,
+      true },
+    { "LinkedList",
+      run_benchmark<LinkedListProbabilityDistribution<int>>,
+      true,
+      true },
+    { "BinaryTree",
+      run_benchmark<BinaryTreeProbabilityDistribution<int>>,
+      false,
+      false },
+    { "Alias",
+      run_benchmark<AliasProbabilityDistribution<int>>,
+      false,
+      true },
+    { "FenwickTree",
+      run_benchmark<FenwickTreeProbabilityDistribution<int>>,
+      false,
+      false },
+    { "ImplicitBinaryTree",
+      run_benchmark<ImplicitBinaryTreeProbabilityDistribution<int>>,
+      false,
+      false },
+    { "Bucket",
+      run_benchmark<BucketProbabilityDistribution<int>>,
+      false,
+      false },
+    { "DenseId",
+      run_benchmark<DenseIdProbabilityDistribution<int>>,
+      false,
+      false },
+};
+
+static std::vector<std::string> split(const std::string& text) {
+    std::vector<std::string> parts;
+    std::stringstream ss(text);
+    std::string part;
+    
+    while (std::getline(ss, part, ',')) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    
+    return parts;
+}
+
+static bool is_selected(const std::vector<std::string>& selection,
+                        const std::string& name) {
+    return selection.empty() ||
+           std::find(selection.begin(), selection.end(), name) !=
+           selection.end();
+}
+
+static Options parse_options(int argc, char* argv[]) {
+    Options options;
+    
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        size_t equals = argument.find('=');
+    
+        if (argument.compare(0, 2, "--") != 0 ||
+            equals == std::string::npos) {
+            throw std::invalid_argument{"Malformed option: " + argument};
+        }
+    
+        std::string name = argument.substr(2, equals - 2);
+        std::string value = argument.substr(equals + 1);
+    
+        if (name == "min-n") {
+            options.min_n = std::stoull(value);
+        } else if (name == "max-n") {
+            options.max_n = std::stoull(value);
+        } else if (name == "backends") {
+            options.backends = split(value);
+        } else if (name == "profiles") {
+            options.profiles = split(value);
+        } else if (name == "workloads") {
+            options.workloads = split(value);
+        } else if (name == "operations") {
+            options.operations = std::stoull(value);
+        } else if (name == "repetitions") {
+            options.repetitions = std::stoull(value);
+        } else if (name == "warmup") {
+            options.warmup = std::stoull(value);
+        } else if (name == "max-linear-n") {
+            options.max_linear_n = std::stoull(value);
+        } else if (name == "zipf-exponent") {
+            options.zipf_exponent = std::stod(value);
+        } else if (name == "seed") {
+            options.seed = std::stoull(value);
+        } else if (name == "format") {
+            options.format = value;
+        } else if (name == "output") {
+            options.output = value;
+        } else {
+            throw std::invalid_argument{"Unknown option: --" + name};
+        }
+    }
+    
+    if (options.min_n == 0 ||
+        options.min_n > options.max_n ||
+        options.operations == 0 ||
+        options.repetitions == 0) {
+        throw std::invalid_argument{
+            "The sizes, the operations and the repetitions must be positive."
+        };
+    }
+    
+    if (options.format != "text" &&
+        options.format != "csv" &&
+        options.format != "json") {
+        throw std::invalid_argument{"Unknown format: " + options.format};
+    }
+    
+    return options;
+}
+
+static void print_csv_header(std::ostream& out) {
+    out << "backend,n,profile,workload,operations,repetitions,"
+           "build_ns_per_element,ns_per_op_min,ns_per_op_median,"
+           "ns_per_op_mean,ns_per_op_stddev,p50_ns,p90_ns,p99_ns,p999_ns,"
+           "max_ns,checksum\n";
+}
+
+static void print_csv(std::ostream& out, const Result& result) {
+    out << result.backend << ','
+        << result.n << ','
+        << result.profile << ','
+        << result.workload << ','
+        << result.operations << ','
+        << result.repetitions << ','
+        << result.build_ns_per_element << ','
+        << result.ns_per_op_min << ','
+        << result.ns_per_op_median << ','
+        << result.ns_per_op_mean << ','
+        << result.ns_per_op_stddev << ','
+        << result.p50_ns << ','
+        << result.p90_ns << ','
+        << result.p99_ns << ','
+        << result.p999_ns << ','
+        << result.max_ns << ','
+        << result.checksum << '\n';
+}
+
+static void print_json(std::ostream& out, const Result& result, bool first) {
+    out << (first ? "\n" : ",\n")
+        << "    {\"backend\": \"" << result.backend << "\", "
+        << "\"n\": " << result.n << ", "
+        << "\"profile\": \"" << result.profile << "\", "
+        << "\"workload\": \"" << result.workload << "\",\n"
+        << "     \"operations\": " << result.operations << ", "
+        << "\"repetitions\": " << result.repetitions << ", "
+        << "\"build_ns_per_element\": " << result.build_ns_per_element
+        << ",\n"
+        << "     \"ns_per_op_min\": " << result.ns_per_op_min << ", "
+        << "\"ns_per_op_median\": " << result.ns_per_op_median << ", "
+        << "\"ns_per_op_mean\": " << result.ns_per_op_mean << ", "
+        << "\"ns_per_op_stddev\": " << result.ns_per_op_stddev << ",\n"
+        << "     \"p50_ns\": " << result.p50_ns << ", "
+        << "\"p90_ns\": " << result.p90_ns << ", "
+        << "\"p99_ns\": " << result.p99_ns << ", "
+        << "\"p999_ns\": " << result.p999_ns << ", "
+        << "\"max_ns\": " << result.max_ns << ", "
+        << "\"checksum\": " << result.checksum << "}";
+}
+
+static void print_text(std::ostream& out, const Result& result) {
+    out << std::left
+        << std::setw(19) << result.backend
+        << std::setw(10) << result.n
+        << std::setw(12) << result.profile
+        << std::setw(13) << result.workload
+        << std::right << std::fixed << std::setprecision(1)
+        << std::setw(10) << result.ns_per_op_median
+        << " ns/op (+-" << result.ns_per_op_stddev << "), p50 "
+        << result.p50_ns << ", p99 "
+        << result.p99_ns << ", max "
+        << result.max_ns << " ns\n"
+        << std::defaultfloat << std::setprecision(6);
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    
+    try {
+        options = parse_options(argc, argv);
+    } catch (std::exception& err) {
+        std::cerr << err.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    
+    std::ofstream file;
+    
+    if (!options.output.empty()) {
+        file.open(options.output);
+    
+        if (!file) {
+            std::cerr << "Cannot open " << options.output << ".\n";
+            return EXIT_FAILURE;
+        }
+    }
+    
+    std::ostream& out = options.output.empty() ? std::cout : file;
+    double clock_overhead = measure_clock_overhead();
+    bool first = true;
+    
+    if (options.format == "csv") {
+        print_csv_header(out);
+    } else if (options.format == "json") {
+        out << "{\"clock_overhead_ns\": " << clock_overhead
+            << ",\n \"results\": [";
+    } else {
+        out << "backend            n         profile     workload"
+               "       median ns/op (+-stddev), latency percentiles\n";
+    }
+    
+    for (size_t n = options.min_n; n <= options.max_n; n *= 10) {
+        for (const Backend& backend : BACKENDS) {
+            if (!is_selected(options.backends, backend.name)) {
+                continue;
+            }
+    
+            for (const char* profile : PROFILES) {
+                if (!is_selected(options.profiles, profile)) {
+                    continue;
+                }
+    
+                for (const Workload& workload : WORKLOADS) {
+                    if (!is_selected(options.workloads, workload.name)) {
+                        continue;
+                    }
+    
+                    bool changes = workload.add_percentage +
+                                   workload.remove_percentage +
+                                   workload.update_percentage > 0;
+                    bool linear = backend.linear ||
+                                  (changes && backend.linear_on_changes);
+    
+                    if (linear && n > options.max_linear_n) {
+                        continue;
+                    }
+    
+                    // Bound the work of a linear pass to that of the full
+                    // pass on 1000 elements:
+                    size_t operation_count = options.operations;
+    
+                    if (linear) {
+                        operation_count =
+                            std::min(operation_count,
+                                     std::max<size_t>(
+                                        1000,
+                                        1000 * options.operations / n));
+                    }
+    
+                    Result result = backend.function(backend.name,
+                                                     n,
+                                                     profile,
+                                                     workload,
+                                                     operation_count,
+                                                     options,
+                                                     clock_overhead);
+    
+                    if (options.format == "csv") {
+                        print_csv(out, result);
+                    } else if (options.format == "json") {
+                        print_json(out, result, first);
+                    } else {
+                        print_text(out, result);
+                    }
+    
+                    first = false;
+                    out.flush();
+                }
+            }
+        }
+    
+        // Stop before the size overflows:
+        if (n > options.max_n / 10) {
+            break;
+        }
+    }
+    
+    if (options.format == "json") {
+        out << "\n ]}\n";
+    }
+    
+    return EXIT_SUCCESS;
+}
@@ -1,17 +1,61 @@
+#include "AliasProbabilityDistribution.hpp"
 #include "ArrayProbabilityDistribution.hpp"
+#include "AtomicFenwickTreeProbabilityDistribution.hpp"
 #include "BinaryTreeProbabilityDistribution.hpp"
+#include "BucketProbabilityDistribution.hpp"
+#include "ConcurrentProbabilityDistribution.hpp"
+#include "DenseIdProbabilityDistribution.hpp"
+#include "FenwickTreeProbabilityDistribution.hpp"
+#include "FlatHashIndex.hpp"
+#include "ImplicitBinaryTreeProbabilityDistribution.hpp"
 #include "LinkedListProbabilityDistribution.hpp"
+#include "NodePool.hpp"
+#include "OperationTrace.hpp"
 #include "ProbabilityDistribution.hpp"
+#include "RandomEngines.hpp"
+#include "RecordingProbabilityDistribution.hpp"
+#include "ShardedProbabilityDistribution.hpp"
+#include "WeightScan.hpp"
 #include "assert.hpp"
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cctype>
+#include <cmath>
 #include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <memory_resource>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 using net::coderodde::util::ProbabilityDistribution;
+using net::coderodde::util::ElementHandle;
+using net::coderodde::util::AliasProbabilityDistribution;
 using net::coderodde::util::ArrayProbabilityDistribution;
+using net::coderodde::util::AtomicFenwickTreeProbabilityDistribution;
 using net::coderodde::util::BinaryTreeProbabilityDistribution;
+using net::coderodde::util::BucketProbabilityDistribution;
+using net::coderodde::util::ConcurrentProbabilityDistribution;
+using net::coderodde::util::DenseIdProbabilityDistribution;
+using net::coderodde::util::FenwickTreeProbabilityDistribution;
+using net::coderodde::util::FlatHashIndex;
+using net::coderodde::util::ImplicitBinaryTreeProbabilityDistribution;
 using net::coderodde::util::LinkedListProbabilityDistribution;
+using net::coderodde::util::NodePool;
+using net::coderodde::util::Pcg64;
+using net::coderodde::util::RecordingProbabilityDistribution;
+using net::coderodde::util::ShardedProbabilityDistribution;
+using net::coderodde::util::SplitMix64;
+using net::coderodde::util::TraceOperation;
+using net::coderodde::util::TraceReader;
+using net::coderodde::util::TraceRecord;
+using net::coderodde::util::TraceWriter;
+using net::coderodde::util::Xoshiro256PlusPlus;
 
 static void test_all();
 static void demo();
@@ -27,14 +71,47 @@ int main() {
 static void test_array();
 static void test_linked_list();
 static void test_tree();
+static void test_alias();
+static void test_fenwick_tree();
+static void test_implicit_tree();
+static void test_bucket();
+static void test_dense_id();
+static void test_weight_scan();
+static void test_random_engines();
+static void test_memory_resources();
+static void test_element_storage();
+static void test_handles();
+static void test_element_index();
+static void test_concurrent();
+static void test_sharded();
+static void test_atomic_fenwick_tree();
+static void test_parallel_sample();
+static void test_trace();
 
 static void test_all() {
     test_array();
     test_linked_list();
     test_tree();
+    test_alias();
+    test_fenwick_tree();
+    test_implicit_tree();
+    test_bucket();
+    test_dense_id();
+    test_weight_scan();
+    test_random_engines();
+    test_memory_resources();
+    test_element_storage();
+    test_handles();
+    test_element_index();
+    test_concurrent();
+    test_sharded();
+    test_atomic_fenwick_tree();
+    test_parallel_sample();
+    test_trace();
 }
 
-static void test_impl(ProbabilityDistribution<int>* dist) {
+template<typename Engine>
+static void test_impl(ProbabilityDistribution<int, Engine>* dist) {
     ASSERT(dist->is_empty());
     
     for (int i = 0; i < 4; ++i) {
@@ -59,6 +136,112 @@ static void test_impl(ProbabilityDistribution<int>* dist) {
         ASSERT(dist->add_element(i, 2.0) == false);
     }
     
+    for (int i = 0; i < 4; ++i) {
+        ASSERT(dist->get_weight(i) == 1.0);
+        ASSERT(dist->update_weight(i, i + 0.5));
+        ASSERT(dist->get_weight(i) == i + 0.5);
+    }
+    
+    ASSERT(dist->update_weight(-1, 1.0) == false);
+    ASSERT(dist->size() == 4);
+    
+    try {
+        dist->get_weight(-1);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    try {
+        dist->update_weight(0, -1.0);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    // Make element 3 carry virtually all of the probability mass:
+    ASSERT(dist->update_weight(3, 1e9));
+    int count = 0;
+    
+    for (int i = 0; i < 100; ++i) {
+        if (dist->sample_element() == 3) {
+            count++;
+        }
+    }
+    
+    ASSERT(count > 95);
+    
+    std::vector<int> samples;
+    dist->sample_elements(1000, std::back_inserter(samples));
+    ASSERT(samples.size() == 1000);
+    ASSERT(std::count(samples.begin(), samples.end(), 3) > 950);
+    
+    for (int sample : samples) {
+        ASSERT(sample >= 0 && sample < 4);
+    }
+    
+    samples.clear();
+    dist->sample_elements(0, std::back_inserter(samples));
+    ASSERT(samples.empty());
+    
+    // Without replacement the heavy element is drawn first, and asking for
+    // more elements than there are yields each element once:
+    for (int i = 0; i < 20; ++i) {
+        samples.clear();
+        dist->sample_distinct(10, std::back_inserter(samples));
+        ASSERT(samples.size() == 4);
+        ASSERT(samples[0] == 3);
+        std::sort(samples.begin(), samples.end());
+        ASSERT(samples == std::vector<int>({ 0, 1, 2, 3 }));
+    }
+    
+    samples.clear();
+    dist->sample_distinct(2, std::back_inserter(samples));
+    ASSERT(samples.size() == 2);
+    ASSERT(samples[0] == 3 && samples[1] != 3);
+    
+    samples.clear();
+    dist->sample_distinct(0, std::back_inserter(samples));
+    ASSERT(samples.empty());
+    
+    // The weights must be restored afterwards:
+    ASSERT(dist->size() == 4);
+    ASSERT(dist->get_weight(3) == 1e9);
+    
+    for (int i = 0; i < 3; ++i) {
+        ASSERT(dist->get_weight(i) == i + 0.5);
+    }
+    
+    count = 0;
+    
+    for (int i = 0; i < 100; ++i) {
+        if (dist->sample_element() == 3) {
+            count++;
+        }
+    }
+    
+    ASSERT(count > 95);
+    
+    ASSERT(dist->sample_counts(0).empty());
+    
+    for (size_t trials : { 3, 1000, 1000 * 1000 }) {
+        std::vector<std::pair<int, size_t>> counts =
+            dist->sample_counts(trials);
+    
+        size_t total_count = 0;
+        size_t count_of_3 = 0;
+    
+        for (const auto& element_count : counts) {
+            ASSERT(element_count.first >= 0 && element_count.first < 4);
+            ASSERT(element_count.second > 0);
+            total_count += element_count.second;
+    
+            if (element_count.first == 3) {
+                count_of_3 = element_count.second;
+            }
+        }
+    
+        ASSERT(counts.size() <= 4);
+        ASSERT(total_count == trials);
+        ASSERT(count_of_3 >= trials * 95 / 100);
+    }
+    
     for (int i = 0; i < 4; ++i) {
         ASSERT(dist->remove_element(i));
     }
@@ -72,6 +255,11 @@ static void test_impl(ProbabilityDistribution<int>* dist) {
         FAIL("std::length_error expected.");
     } catch (std::length_error err) {}
     
+    try {
+        dist->sample_counts(1);
+        FAIL("std::length_error expected.");
+    } catch (std::length_error& err) {}
+    
     for (int i = 0; i < 4; ++i) {
         dist->add_element(i, 2.0);
     }
@@ -79,6 +267,38 @@ static void test_impl(ProbabilityDistribution<int>* dist) {
     ASSERT(dist->size() == 4);
     dist->clear();
     ASSERT(dist->size() == 0);
+    
+    // Drawing the heavy element cancels the running totals out to zero,
+    // while the light ones must still be drawn, each once:
+    dist->add_element(0, 1e17);
+    dist->add_element(1, 1.0);
+    dist->add_element(2, 1.0);
+    
+    for (int i = 0; i < 20; ++i) {
+        samples.clear();
+        dist->sample_distinct(3, std::back_inserter(samples));
+        ASSERT(samples.size() == 3);
+        ASSERT(samples[0] == 0);
+        std::sort(samples.begin(), samples.end());
+        ASSERT(samples == std::vector<int>({ 0, 1, 2 }));
+    }
+    
+    // Lowering the heavy weight leaves the same cancellation in the sums
+    // kept by adding differences:
+    for (int i = 3; i < 6; ++i) {
+        dist->add_element(i, 1.0);
+    }
+    
+    ASSERT(dist->update_weight(0, 1.0));
+    
+    for (int i = 0; i < 20; ++i) {
+        samples.clear();
+        dist->sample_distinct(6, std::back_inserter(samples));
+        std::sort(samples.begin(), samples.end());
+        ASSERT(samples == std::vector<int>({ 0, 1, 2, 3, 4, 5 }));
+    }
+    
+    dist->clear();
 }
 
 static void test_array() {
@@ -169,6 +389,26 @@ static void test_array() {
     
     ASSERT(dist6.size() == 5);
     ASSERT(dist1.size() == 3);
+    
+    // Removal moves the last element into the hole; the weights must follow:
+    ArrayProbabilityDistribution<int> dist8;
+    
+    for (int i = 0; i < 5; ++i) {
+        dist8.add_element(i, i + 1.0);
+    }
+    
+    ASSERT(dist8.remove_element(1));
+    ASSERT(dist8.remove_element(0));
+    ASSERT(dist8.size() == 3);
+    
+    for (int i = 2; i < 5; ++i) {
+        ASSERT(dist8.contains_element(i));
+        ASSERT(dist8.get_weight(i) == i + 1.0);
+    }
+    
+    ASSERT(dist8.remove_element(4));
+    ASSERT(dist8.get_weight(2) == 3.0);
+    ASSERT(dist8.get_weight(3) == 4.0);
 }
 
 static void test_linked_list() {
@@ -262,6 +502,17 @@ static void test_linked_list() {
 
 }
 
+// Returns the smallest h such that 2^h >= n.
+static size_t ceil_log2(size_t n) {
+    size_t h = 0;
+    
+    while ((static_cast<size_t>(1) << h) < n) {
+        ++h;
+    }
+    
+    return h;
+}
+
 static void test_tree() {
     test_impl(new BinaryTreeProbabilityDistribution<int>);
     
@@ -351,185 +602,3186 @@ static void test_tree() {
     
     ASSERT(dist6.size() == 5);
     ASSERT(dist1.size() == 3);
-}
-
-static void demo() {
-    std::cout << "--- Sanity demo ---\n";
-    
-    using net::coderodde::util::ArrayProbabilityDistribution;
-    using net::coderodde::util::LinkedListProbabilityDistribution;
-    using net::coderodde::util::BinaryTreeProbabilityDistribution;
     
-    std::random_device rd{};
-    std::random_device::result_type seed = rd();
-    
-    ArrayProbabilityDistribution<int> prob_dist1{seed};
-    LinkedListProbabilityDistribution<int> prob_dist2{seed};
-    BinaryTreeProbabilityDistribution<int> prob_dist3{seed};
-    
-    prob_dist1.add_element(1, 1.0);
-    prob_dist1.add_element(2, 1.0);
-    prob_dist1.add_element(3, 3.0);
+    // A copy must preserve the relay nodes and the parent links, so that
+    // weight updates propagate to the root:
+    BinaryTreeProbabilityDistribution<int> dist8(dist1);
+    ASSERT(dist8.update_weight(12, 1e9));
     
-    prob_dist2.add_element(1, 1.0);
-    prob_dist2.add_element(2, 1.0);
-    prob_dist2.add_element(3, 3.0);
+    for (int i = 0; i < 100; ++i) {
+        int element = dist8.sample_element();
+        ASSERT(element == 10 || element == 12 || element == 14);
+    }
     
-    prob_dist3.add_element(1, 1.0);
-    prob_dist3.add_element(2, 1.0);
-    prob_dist3.add_element(3, 3.0);
+    ASSERT(dist8.get_weight(12) == 1e9);
+    ASSERT(dist1.get_weight(12) == 1.5);
     
-    int arr1[4] = {};
-    int arr2[4] = {};
-    int arr3[4] = {};
+    // Removals must keep the tree as balanced as insertions do:
+    BinaryTreeProbabilityDistribution<int> dist9;
+    std::vector<int> elements;
     
     for (int i = 0; i < 1000; ++i) {
-        arr1[prob_dist1.sample_element()]++;
-        arr2[prob_dist2.sample_element()]++;
-        arr3[prob_dist3.sample_element()]++;
+        ASSERT(dist9.add_element(i, 1.0));
+        elements.push_back(i);
+        ASSERT(dist9.get_height() == ceil_log2(dist9.size()));
     }
     
-    for (int i = 1; i < 4; ++i) {
-        std::cout << arr1[i] << " ";
+    std::mt19937 generator{7};
+    std::shuffle(elements.begin(), elements.end(), generator);
+    
+    for (int i = 0; i < 900; ++i) {
+        ASSERT(dist9.remove_element(elements[i]));
+        ASSERT(dist9.get_height() == ceil_log2(dist9.size()));
     }
     
-    std::cout << "\n";
+    // The moved leaves must carry their weights along:
+    ASSERT(dist9.update_weight(elements[950], 1e9));
     
-    for (int i = 1; i < 4; ++i) {
-        std::cout << arr2[i] << " ";
+    for (int i = 0; i < 100; ++i) {
+        int element = dist9.sample_element();
+        ASSERT(std::find(elements.begin() + 900, elements.end(), element) !=
+               elements.end());
     }
     
-    std::cout << "\n";
+    ASSERT(dist9.get_weight(elements[950]) == 1e9);
     
-    for (int i = 1; i < 4; ++i) {
-        std::cout << arr3[i] << " ";
+    for (int i = 900; i < 1000; ++i) {
+        ASSERT(dist9.remove_element(elements[i]));
     }
     
-    std::cout << "\n-------------------\n";
+    ASSERT(dist9.is_empty());
+    
+    BinaryTreeProbabilityDistribution<int>* dist10 =
+        new BinaryTreeProbabilityDistribution<int>;
+    
+    dist10->set_weight_shaped(true);
+    test_impl(dist10);
+    
+    // A weight-shaped tree puts the heavy elements near the root:
+    BinaryTreeProbabilityDistribution<int> dist11;
+    dist11.add_element(0, 8.0);
+    dist11.add_element(1, 4.0);
+    dist11.add_element(2, 2.0);
+    dist11.add_element(3, 1.0);
+    dist11.add_element(4, 1.0);
+    dist11.set_weight_shaped(true);
+    
+    ASSERT(dist11.is_weight_shaped());
+    ASSERT(dist11.get_depth(0) == 1);
+    ASSERT(dist11.get_depth(1) == 2);
+    ASSERT(dist11.get_depth(2) == 3);
+    ASSERT(dist11.get_depth(3) == 4);
+    ASSERT(dist11.get_depth(4) == 4);
+    ASSERT(dist11.get_expected_depth() == 30.0 / 16.0);
+    
+    // The fifth modification triggers a rebuild:
+    dist11.update_weight(0, 1.0);
+    dist11.update_weight(1, 1.0);
+    dist11.update_weight(2, 2.0);
+    dist11.update_weight(3, 4.0);
+    ASSERT(dist11.get_depth(4) == 4);
+    dist11.update_weight(4, 8.0);
+    
+    ASSERT(dist11.get_depth(4) == 1);
+    ASSERT(dist11.get_depth(3) == 2);
+    ASSERT(dist11.get_depth(2) == 3);
+    ASSERT(dist11.get_depth(1) == 4);
+    
+    ASSERT(dist11.remove_element(4));
+    ASSERT(dist11.get_depth(3) == 1);
+    ASSERT(dist11.get_expected_depth() == 14.0 / 8.0);
+    
+    dist11.set_weight_shaped(false);
+    ASSERT(!dist11.is_weight_shaped());
+    ASSERT(dist11.get_height() == 2);
+    ASSERT(dist11.get_expected_depth() == 2.0);
+    ASSERT(dist11.get_weight(3) == 4.0);
+    ASSERT(dist11.get_weight(0) == 1.0);
 }
 
-static size_t LOAD = 40 * 1000;
-static size_t SAMPLES = 40 * 1000;
-
-static void benchmark() {
+static void test_alias() {
+    test_impl(new AliasProbabilityDistribution<int>);
     
-    class CurrentTime {
-        std::chrono::high_resolution_clock m_clock;
-        
-    public:
-        uint64_t milliseconds() {
-            return std::chrono::duration_cast<std::chrono::milliseconds>
-            (m_clock.now().time_since_epoch()).count();
-        }
-    };
+    AliasProbabilityDistribution<int> dist1;
+    AliasProbabilityDistribution<int> dist2;
     
-    ArrayProbabilityDistribution<int>      prob_dist1;
-    LinkedListProbabilityDistribution<int> prob_dist2;
-    BinaryTreeProbabilityDistribution<int> prob_dist3;
+    for (int i = 0; i < 3; ++i) {
+        dist2.add_element(i, 1.0);
+    }
     
-    std::vector<int> remove_order_vector;
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist2.size() == 3);
     
-    for (int i = 0; i < LOAD; ++i) {
-        remove_order_vector.push_back(i);
-    }
-    std::random_device rd;
-    std::mt19937 g(rd());
-    std::shuffle(remove_order_vector.begin(),
-                 remove_order_vector.end(),
-                 g);
+    dist1 = dist2;
     
-    CurrentTime ct;
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
     
-    //// ARRAY BASED BENCHMARK ////
-    std::cout << "ArrayProbabilityDistribution:\n";
+    AliasProbabilityDistribution<int> dist3(dist1);
     
-    uint64_t add_time = 0;
-    uint64_t sample_time = 0;
-    uint64_t remove_time = 0;
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
+    ASSERT(dist3.size() == 3);
     
-    uint64_t start = ct.milliseconds();
+    AliasProbabilityDistribution<int> dist4;
+    dist4 = std::move(dist1);
     
-    for (size_t i = 0; i < LOAD; ++i) {
-        prob_dist1.add_element(i, 1.0);
-    }
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist4.size() == 3);
     
-    uint64_t end = ct.milliseconds();
+    AliasProbabilityDistribution<int> dist5(std::move(dist2));
     
-    add_time = end - start;
-    std::cout << "  add_element: " << add_time << " milliseconds.\n";
+    ASSERT(dist5.size() == 3);
+    ASSERT(dist2.size() == 0);
     
-    start = ct.milliseconds();
+    dist1.clear();
+    dist2.clear();
     
-    for (size_t i = 0; i < SAMPLES; ++i) {
-        prob_dist1.sample_element();
+    ASSERT(dist1.is_empty());
+    ASSERT(dist2.is_empty());
+    
+    for (int i = 10; i < 15; ++i) {
+        dist1.add_element(i, 1.5);
     }
     
-    end = ct.milliseconds();
+    // Test move assignment:
+    dist2 = std::move(dist1);
     
-    sample_time = end - start;
-    std::cout << "  sample_element: " << sample_time << " milliseconds.\n";
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist2.contains_element(i));
+        ASSERT(dist1.contains_element(i) == false);
+    }
     
-    start = ct.milliseconds();
+    // Test move constructor:
+    AliasProbabilityDistribution<int> dist6(std::move(dist2));
     
-    for (int element : remove_order_vector) {
-        prob_dist1.remove_element(element);
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist2.contains_element(i) == false);
     }
     
-    end = ct.milliseconds();
+    // Test copy constructor:
+    AliasProbabilityDistribution<int> dist7(dist6);
+    dist7.remove_element(14);
     
-    remove_time = end - start;
-    std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
-    std::cout << "  Total: " << (add_time + sample_time + remove_time)
-              << " milliseconds.\n";
+    for (int i = 10; i < 14; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist7.contains_element(i));
+    }
     
+    ASSERT(dist6.contains_element(14));
+    ASSERT(dist7.contains_element(14) == false);
     
-    //// LINKED LIST BASED BENCHMARK ////
-    std::cout << "LinkedListProbabilityDistribution:\n";
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist7.size() == 4);
     
-    add_time = 0;
-    sample_time = 0;
-    remove_time = 0;
+    // Test copy assignment:
+    dist1.clear();
+    dist1 = dist6;
     
-    start = ct.milliseconds();
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 5);
+
+    ASSERT(dist1.remove_element(11));
+    ASSERT(dist1.remove_element(13));
     
-    for (size_t i = 0; i < LOAD; ++i) {
-        prob_dist2.add_element(i, 1.0);
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 3);
+    
+    // The alias table must be rebuilt after each modification:
+    for (int i = 0; i < 100; ++i) {
+        int element = dist1.sample_element();
+        ASSERT(element == 10 || element == 12 || element == 14);
     }
     
-    end = ct.milliseconds();
+    ASSERT(dist1.remove_element(10));
+    ASSERT(dist1.remove_element(14));
     
-    add_time = end - start;
-    std::cout << "  add_element: " << add_time << " milliseconds.\n";
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist1.sample_element() == 12);
+    }
+}
+
+static void test_fenwick_tree() {
+    test_impl(new FenwickTreeProbabilityDistribution<int>);
     
-    start = ct.milliseconds();
+    FenwickTreeProbabilityDistribution<int> dist1;
+    FenwickTreeProbabilityDistribution<int> dist2;
     
-    for (size_t i = 0; i < SAMPLES; ++i) {
-        prob_dist2.sample_element();
+    for (int i = 0; i < 3; ++i) {
+        dist2.add_element(i, 1.0);
     }
     
-    end = ct.milliseconds();
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist2.size() == 3);
     
-    sample_time = end - start;
-    std::cout << "  sample_element: " << sample_time << " milliseconds.\n";
+    dist1 = dist2;
     
-    start = ct.milliseconds();
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
     
-    for (int element : remove_order_vector) {
-        prob_dist2.remove_element(element);
-    }
+    FenwickTreeProbabilityDistribution<int> dist3(dist1);
     
-    end = ct.milliseconds();
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
+    ASSERT(dist3.size() == 3);
     
-    remove_time = end - start;
-    std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
-    std::cout << "  Total: " << (add_time + sample_time + remove_time)
-    << " milliseconds.\n";
-
-    //// TREE BASED BENCHMARK ////
-    std::cout << "BinaryTreeProbabilityDistribution:\n";
+    FenwickTreeProbabilityDistribution<int> dist4;
+    dist4 = std::move(dist1);
     
-    add_time = 0;
-    sample_time = 0;
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist4.size() == 3);
+    
+    FenwickTreeProbabilityDistribution<int> dist5(std::move(dist2));
+    
+    ASSERT(dist5.size() == 3);
+    ASSERT(dist2.size() == 0);
+    
+    dist1.clear();
+    dist2.clear();
+    
+    ASSERT(dist1.is_empty());
+    ASSERT(dist2.is_empty());
+    
+    for (int i = 10; i < 15; ++i) {
+        dist1.add_element(i, 1.5);
+    }
+    
+    // Test move assignment:
+    dist2 = std::move(dist1);
+    
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist2.contains_element(i));
+        ASSERT(dist1.contains_element(i) == false);
+    }
+    
+    // Test move constructor:
+    FenwickTreeProbabilityDistribution<int> dist6(std::move(dist2));
+    
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist2.contains_element(i) == false);
+    }
+    
+    // Test copy constructor:
+    FenwickTreeProbabilityDistribution<int> dist7(dist6);
+    dist7.remove_element(14);
+    
+    for (int i = 10; i < 14; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist7.contains_element(i));
+    }
+    
+    ASSERT(dist6.contains_element(14));
+    ASSERT(dist7.contains_element(14) == false);
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist7.size() == 4);
+    
+    // Test copy assignment:
+    dist1.clear();
+    dist1 = dist6;
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 5);
+
+    ASSERT(dist1.remove_element(11));
+    ASSERT(dist1.remove_element(13));
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 3);
+    
+    for (int i = 0; i < 100; ++i) {
+        int element = dist1.sample_element();
+        ASSERT(element == 10 || element == 12 || element == 14);
+    }
+    
+    // Removing from the middle moves the last element into the hole:
+    ASSERT(dist1.remove_element(12));
+    ASSERT(dist1.remove_element(14));
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist1.sample_element() == 10);
+    }
+}
+
+static void test_implicit_tree() {
+    test_impl(new ImplicitBinaryTreeProbabilityDistribution<int>);
+    
+    ImplicitBinaryTreeProbabilityDistribution<int> dist1;
+    ImplicitBinaryTreeProbabilityDistribution<int> dist2;
+    
+    for (int i = 0; i < 3; ++i) {
+        dist2.add_element(i, 1.0);
+    }
+    
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist2.size() == 3);
+    
+    dist1 = dist2;
+    
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
+    
+    ImplicitBinaryTreeProbabilityDistribution<int> dist3(dist1);
+    
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
+    ASSERT(dist3.size() == 3);
+    
+    ImplicitBinaryTreeProbabilityDistribution<int> dist4;
+    dist4 = std::move(dist1);
+    
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist4.size() == 3);
+    
+    ImplicitBinaryTreeProbabilityDistribution<int> dist5(std::move(dist2));
+    
+    ASSERT(dist5.size() == 3);
+    ASSERT(dist2.size() == 0);
+    
+    dist1.clear();
+    dist2.clear();
+    
+    ASSERT(dist1.is_empty());
+    ASSERT(dist2.is_empty());
+    
+    for (int i = 10; i < 15; ++i) {
+        dist1.add_element(i, 1.5);
+    }
+    
+    // Test move assignment:
+    dist2 = std::move(dist1);
+    
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist2.contains_element(i));
+        ASSERT(dist1.contains_element(i) == false);
+    }
+    
+    // Test move constructor:
+    ImplicitBinaryTreeProbabilityDistribution<int> dist6(std::move(dist2));
+    
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist2.contains_element(i) == false);
+    }
+    
+    // Test copy constructor:
+    ImplicitBinaryTreeProbabilityDistribution<int> dist7(dist6);
+    dist7.remove_element(14);
+    
+    for (int i = 10; i < 14; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist7.contains_element(i));
+    }
+    
+    ASSERT(dist6.contains_element(14));
+    ASSERT(dist7.contains_element(14) == false);
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist7.size() == 4);
+    
+    // Test copy assignment:
+    dist1.clear();
+    dist1 = dist6;
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 5);
+
+    ASSERT(dist1.remove_element(11));
+    ASSERT(dist1.remove_element(13));
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 3);
+    
+    // Grow past several capacities, then shrink back down:
+    ImplicitBinaryTreeProbabilityDistribution<int> dist8;
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist8.add_element(i, i + 1.0));
+    }
+    
+    for (int i = 0; i < 100; i += 2) {
+        ASSERT(dist8.remove_element(i));
+    }
+    
+    for (int i = 1; i < 100; i += 2) {
+        ASSERT(dist8.get_weight(i) == i + 1.0);
+    }
+    
+    for (int i = 1; i < 97; i += 2) {
+        ASSERT(dist8.remove_element(i));
+    }
+    
+    ASSERT(dist8.size() == 2);
+    
+    for (int i = 0; i < 100; ++i) {
+        int element = dist8.sample_element();
+        ASSERT(element == 97 || element == 99);
+    }
+}
+
+static void test_bucket() {
+    test_impl(new BucketProbabilityDistribution<int>);
+    
+    // Drawing the heavy element cancels the running total out to zero,
+    // while the light ones must still be drawn, each once:
+    BucketProbabilityDistribution<int> skewed_dist(11);
+    skewed_dist.add_element(0, 1e17);
+    skewed_dist.add_element(1, 1.0);
+    skewed_dist.add_element(2, 1.0);
+    
+    for (int i = 0; i < 20; ++i) {
+        std::vector<int> samples;
+        skewed_dist.sample_distinct(3, std::back_inserter(samples));
+        std::sort(samples.begin(), samples.end());
+        ASSERT(samples == std::vector<int>({ 0, 1, 2 }));
+    }
+    
+    BucketProbabilityDistribution<int> dist1;
+    BucketProbabilityDistribution<int> dist2;
+    
+    for (int i = 0; i < 3; ++i) {
+        dist2.add_element(i, 1.0);
+    }
+    
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist2.size() == 3);
+    
+    dist1 = dist2;
+    
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
+    
+    BucketProbabilityDistribution<int> dist3(dist1);
+    
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
+    ASSERT(dist3.size() == 3);
+    
+    BucketProbabilityDistribution<int> dist4;
+    dist4 = std::move(dist1);
+    
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist4.size() == 3);
+    
+    BucketProbabilityDistribution<int> dist5(std::move(dist2));
+    
+    ASSERT(dist5.size() == 3);
+    ASSERT(dist2.size() == 0);
+    
+    dist1.clear();
+    dist2.clear();
+    
+    ASSERT(dist1.is_empty());
+    ASSERT(dist2.is_empty());
+    
+    for (int i = 10; i < 15; ++i) {
+        dist1.add_element(i, 1.5);
+    }
+    
+    // Test move assignment:
+    dist2 = std::move(dist1);
+    
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist2.contains_element(i));
+        ASSERT(dist1.contains_element(i) == false);
+    }
+    
+    // Test move constructor:
+    BucketProbabilityDistribution<int> dist6(std::move(dist2));
+    
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist2.contains_element(i) == false);
+    }
+    
+    // Test copy constructor:
+    BucketProbabilityDistribution<int> dist7(dist6);
+    dist7.remove_element(14);
+    
+    for (int i = 10; i < 14; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist7.contains_element(i));
+    }
+    
+    ASSERT(dist6.contains_element(14));
+    ASSERT(dist7.contains_element(14) == false);
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist7.size() == 4);
+    
+    // Test copy assignment:
+    dist1.clear();
+    dist1 = dist6;
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 5);
+    
+    ASSERT(dist1.remove_element(11));
+    ASSERT(dist1.remove_element(13));
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 3);
+    
+    // The weights may span the whole range of exponents:
+    BucketProbabilityDistribution<int> dist8;
+    ASSERT(dist8.add_element(0, 1e-310));
+    ASSERT(dist8.add_element(1, 1e308));
+    ASSERT(dist8.add_element(2, 1.0));
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist8.sample_element() == 1);
+    }
+    
+    // Moving an element to another bucket:
+    ASSERT(dist8.update_weight(1, 1e-300));
+    ASSERT(dist8.get_weight(1) == 1e-300);
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist8.sample_element() == 2);
+    }
+    
+    ASSERT(dist8.remove_element(2));
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist8.sample_element() == 1);
+    }
+    
+    ASSERT(dist8.remove_element(1));
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist8.sample_element() == 0);
+    }
+    
+    // The rejection within a bucket must respect the weights:
+    BucketProbabilityDistribution<int> dist9(2017);
+    dist9.add_element(0, 1.0);
+    dist9.add_element(1, 1.75);
+    size_t count = 0;
+    
+    for (int i = 0; i < 100000; ++i) {
+        if (dist9.sample_element() == 1) {
+            count++;
+        }
+    }
+    
+    ASSERT(std::abs(count / 100000.0 - 1.75 / 2.75) < 0.01);
+}
+
+static void test_dense_id() {
+    test_impl(new DenseIdProbabilityDistribution<int>);
+    
+    // Drawing the heavy element cancels the running total out to zero,
+    // while the light ones must still be drawn, each once:
+    DenseIdProbabilityDistribution<int> skewed_dist(11);
+    skewed_dist.add_element(0, 1e17);
+    skewed_dist.add_element(1, 1.0);
+    skewed_dist.add_element(2, 1.0);
+    
+    for (int i = 0; i < 20; ++i) {
+        std::vector<int> samples;
+        skewed_dist.sample_distinct(3, std::back_inserter(samples));
+        std::sort(samples.begin(), samples.end());
+        ASSERT(samples == std::vector<int>({ 0, 1, 2 }));
+    }
+    
+    DenseIdProbabilityDistribution<int> dist1;
+    DenseIdProbabilityDistribution<int> dist2;
+    
+    for (int i = 0; i < 3; ++i) {
+        dist2.add_element(i, 1.0);
+    }
+    
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist2.size() == 3);
+    
+    dist1 = dist2;
+    
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
+    
+    DenseIdProbabilityDistribution<int> dist3(dist1);
+    
+    ASSERT(dist1.size() == 3);
+    ASSERT(dist2.size() == 3);
+    ASSERT(dist3.size() == 3);
+    
+    DenseIdProbabilityDistribution<int> dist4;
+    dist4 = std::move(dist1);
+    
+    ASSERT(dist1.size() == 0);
+    ASSERT(dist4.size() == 3);
+    
+    DenseIdProbabilityDistribution<int> dist5(std::move(dist2));
+    
+    ASSERT(dist5.size() == 3);
+    ASSERT(dist2.size() == 0);
+    
+    dist1.clear();
+    dist2.clear();
+    
+    ASSERT(dist1.is_empty());
+    ASSERT(dist2.is_empty());
+    
+    for (int i = 10; i < 15; ++i) {
+        dist1.add_element(i, 1.5);
+    }
+    
+    // Test move assignment:
+    dist2 = std::move(dist1);
+    
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist2.contains_element(i));
+        ASSERT(dist1.contains_element(i) == false);
+    }
+    
+    // Test move constructor:
+    DenseIdProbabilityDistribution<int> dist6(std::move(dist2));
+    
+    for (int i = 10; i < 15; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist2.contains_element(i) == false);
+    }
+    
+    // Test copy constructor:
+    DenseIdProbabilityDistribution<int> dist7(dist6);
+    dist7.remove_element(14);
+    
+    for (int i = 10; i < 14; ++i) {
+        ASSERT(dist6.contains_element(i));
+        ASSERT(dist7.contains_element(i));
+    }
+    
+    ASSERT(dist6.contains_element(14));
+    ASSERT(dist7.contains_element(14) == false);
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist7.size() == 4);
+    
+    // Test copy assignment:
+    dist1.clear();
+    dist1 = dist6;
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 5);
+    
+    ASSERT(dist1.remove_element(11));
+    ASSERT(dist1.remove_element(13));
+    
+    ASSERT(dist6.size() == 5);
+    ASSERT(dist1.size() == 3);
+    
+    // Ids outside [0, 2^31) are never contained and cannot be added:
+    DenseIdProbabilityDistribution<int64_t> dist8(2019);
+    ASSERT(dist8.contains_element(-5) == false);
+    ASSERT(dist8.remove_element(-5) == false);
+    ASSERT(dist8.update_weight(int64_t{1} << 40, 1.0) == false);
+    
+    try {
+        dist8.add_element(-5, 1.0);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    try {
+        dist8.add_element(int64_t{1} << 40, 1.0);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    ASSERT(dist8.is_empty());
+    
+    // Growing the capacity must keep the prefix sums of the present ids:
+    ASSERT(dist8.add_element(3, 1.0));
+    ASSERT(dist8.get_capacity() == 64);
+    ASSERT(dist8.add_element(100000, 3.0));
+    ASSERT(dist8.get_capacity() == 131072);
+    ASSERT(dist8.contains_element(99999) == false);
+    size_t count = 0;
+    
+    for (int i = 0; i < 100000; ++i) {
+        int64_t element = dist8.sample_element();
+        ASSERT(element == 3 || element == 100000);
+        
+        if (element == 3) {
+            count++;
+        }
+    }
+    
+    ASSERT(std::abs(count / 100000.0 - 0.25) < 0.01);
+    
+    ASSERT(dist8.add_element(70000, 4.0));
+    ASSERT(dist8.remove_element(3));
+    count = 0;
+    
+    for (const auto& element_count : dist8.sample_counts(100000)) {
+        ASSERT(element_count.first == 70000 ||
+               element_count.first == 100000);
+        
+        if (element_count.first == 70000) {
+            count += element_count.second;
+        }
+    }
+    
+    ASSERT(std::abs(count / 100000.0 - 4.0 / 7.0) < 0.01);
+    
+    // Unsigned ids:
+    DenseIdProbabilityDistribution<unsigned char> dist9;
+    
+    for (unsigned i = 0; i < 256; i += 5) {
+        ASSERT(dist9.add_element(static_cast<unsigned char>(i), 1.0));
+    }
+    
+    ASSERT(dist9.size() == 52);
+    ASSERT(dist9.get_capacity() == 256);
+    
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT(dist9.sample_element() % 5 == 0);
+    }
+}
+
+static void test_weight_scan() {
+    using net::coderodde::util::WeightScanKernel;
+    using net::coderodde::util::scan_weights;
+    using net::coderodde::util::scan_weights_scalar;
+    
+    std::vector<WeightScanKernel> kernels = { scan_weights };
+    
+#ifdef NET_CODERODDE_UTIL_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(net::coderodde::util::scan_weights_avx2);
+    }
+    
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels.push_back(net::coderodde::util::scan_weights_avx512);
+    }
+#endif
+    
+    // Small integral weights keep all the prefix sums exact, so every kernel
+    // must agree with the scalar one on every value:
+    std::mt19937 generator{13};
+    
+    for (size_t size = 0; size < 70; ++size) {
+        std::vector<double> weights(size);
+        double total_weight = 0.0;
+        
+        for (double& weight : weights) {
+            weight = 1.0 + generator() % 4;
+            total_weight += weight;
+        }
+        
+        for (double value = 0.0; value <= total_weight + 1.0; value += 0.5) {
+            size_t expected = scan_weights_scalar(weights.data(), size, value);
+            
+            for (WeightScanKernel kernel : kernels) {
+                ASSERT(kernel(weights.data(), size, value) == expected);
+            }
+        }
+    }
+}
+
+template<typename Engine>
+static void test_random_engine() {
+    using net::coderodde::util::generate_uniform_double;
+    
+    Engine engine1{2017};
+    Engine engine2{2017};
+    Engine engine3{2018};
+    bool differs = false;
+    
+    for (int i = 0; i < 1000; ++i) {
+        auto value = engine1();
+        ASSERT(value == engine2());
+        
+        if (value != engine3()) {
+            differs = true;
+        }
+    }
+    
+    ASSERT(differs);
+    
+    double sum = 0.0;
+    
+    for (int i = 0; i < 100 * 1000; ++i) {
+        double value = generate_uniform_double(engine1);
+        ASSERT(value >= 0.0 && value < 1.0);
+        sum += value;
+    }
+    
+    ASSERT(sum / (100 * 1000) > 0.49 && sum / (100 * 1000) < 0.51);
+    
+    test_impl(new ArrayProbabilityDistribution<int, Engine>);
+    test_impl(new BinaryTreeProbabilityDistribution<int, Engine>);
+    test_impl(new AliasProbabilityDistribution<int, Engine>);
+    
+    // Equal seeds must produce equal sample sequences:
+    FenwickTreeProbabilityDistribution<int, Engine> dist1(7);
+    FenwickTreeProbabilityDistribution<int, Engine> dist2(7);
+    
+    for (int i = 0; i < 10; ++i) {
+        dist1.add_element(i, i + 1.0);
+        dist2.add_element(i, i + 1.0);
+    }
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist1.sample_element() == dist2.sample_element());
+    }
+}
+
+static void test_random_engines() {
+    test_random_engine<std::mt19937>();
+    test_random_engine<SplitMix64>();
+    test_random_engine<Xoshiro256PlusPlus>();
+#ifdef __SIZEOF_INT128__
+    test_random_engine<Pcg64>();
+#endif
+}
+
+// Tracks the memory allocated through it.
+class CountingMemoryResource : public std::pmr::memory_resource {
+public:
+    size_t get_bytes_in_use() const {
+        return m_bytes_in_use;
+    }
+    
+    size_t get_allocation_count() const {
+        return m_allocation_count;
+    }
+    
+private:
+    size_t m_bytes_in_use = 0;
+    size_t m_allocation_count = 0;
+    
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        m_bytes_in_use += bytes;
+        m_allocation_count++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        m_bytes_in_use -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    
+    bool do_is_equal(const std::pmr::memory_resource& other)
+    const noexcept override {
+        return this == &other;
+    }
+};
+
+template<typename Distribution>
+static void test_node_recycling() {
+    CountingMemoryResource resource;
+    
+    {
+        Distribution dist(&resource);
+        
+        for (int i = 0; i < 1000; ++i) {
+            dist.add_element(i, 1.0 + i % 7);
+        }
+        
+        size_t bytes_in_use = resource.get_bytes_in_use();
+        
+        // Removing and adding the same number of elements must reuse the
+        // freed nodes instead of growing the pool:
+        for (int round = 0; round < 10; ++round) {
+            for (int i = 0; i < 1000; i += 2) {
+                ASSERT(dist.remove_element(i));
+            }
+            
+            for (int i = 0; i < 1000; i += 2) {
+                ASSERT(dist.add_element(i, 2.0));
+            }
+        }
+        
+        ASSERT(dist.size() == 1000);
+        ASSERT(resource.get_bytes_in_use() == bytes_in_use);
+        
+        // Moving into a distribution with another resource copies the nodes:
+        CountingMemoryResource other_resource;
+        Distribution other_dist(&other_resource);
+        other_dist = std::move(dist);
+        
+        ASSERT(other_dist.size() == 1000);
+        ASSERT(dist.size() == 0);
+        ASSERT(other_resource.get_bytes_in_use() > 0);
+        
+        for (int i = 0; i < 1000; ++i) {
+            ASSERT(other_dist.contains_element(i));
+            ASSERT(dist.contains_element(i) == false);
+        }
+        
+        other_dist.clear();
+        ASSERT(other_resource.get_bytes_in_use() < bytes_in_use);
+    }
+    
+    ASSERT(resource.get_bytes_in_use() == 0);
+}
+
+static void test_memory_resources() {
+    struct Node {
+        double value;
+        Node*  next;
+    };
+    
+    NodePool<Node> pool;
+    std::vector<Node*> nodes;
+    
+    for (int i = 0; i < 100; ++i) {
+        nodes.push_back(pool.create(Node{1.0 * i, nullptr}));
+    }
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(nodes[i]->value == i);
+    }
+    
+    size_t capacity = pool.capacity();
+    ASSERT(capacity >= 100);
+    
+    for (Node* node : nodes) {
+        pool.destroy(node);
+    }
+    
+    for (int i = 0; i < 100; ++i) {
+        pool.create(Node{0.0, nullptr});
+    }
+    
+    ASSERT(pool.capacity() == capacity);
+    pool.release();
+    ASSERT(pool.capacity() == 0);
+    
+    CountingMemoryResource resource;
+    test_impl(new ArrayProbabilityDistribution<int>(&resource));
+    test_impl(new LinkedListProbabilityDistribution<int>(&resource));
+    test_impl(new BinaryTreeProbabilityDistribution<int>(&resource));
+    test_impl(new AliasProbabilityDistribution<int>(&resource));
+    test_impl(new FenwickTreeProbabilityDistribution<int>(&resource));
+    test_impl(new ImplicitBinaryTreeProbabilityDistribution<int>(&resource));
+    test_impl(new BucketProbabilityDistribution<int>(&resource));
+    test_impl(new DenseIdProbabilityDistribution<int>(&resource));
+    ASSERT(resource.get_allocation_count() > 0);
+    
+    test_node_recycling<BinaryTreeProbabilityDistribution<int>>();
+    test_node_recycling<LinkedListProbabilityDistribution<int>>();
+}
+
+template<typename Distribution>
+static void test_string_elements() {
+    // Long enough to defeat the small string optimization, so that a copy
+    // would show up as another buffer:
+    const std::string prefix(32, 'x');
+    CountingMemoryResource resource;
+    Distribution dist(&resource);
+    
+    std::string element = prefix + "a";
+    ASSERT(dist.add_element(std::move(element), 1.0));
+    ASSERT(dist.emplace_element(2.0, prefix + "b"));
+    ASSERT(dist.emplace_element(3.0, 33, 'c'));
+    ASSERT(dist.add_element(prefix + "a", 5.0) == false);
+    ASSERT(dist.emplace_element(5.0, prefix + "b") == false);
+    ASSERT(dist.size() == 3);
+    ASSERT(dist.get_weight(prefix + "a") == 1.0);
+    ASSERT(dist.get_weight(std::string(33, 'c')) == 3.0);
+    
+    // The samples refer to the one stored copy of each element:
+    const std::string* addresses[3] = { nullptr, nullptr, nullptr };
+    
+    for (int i = 0; i < 1000; ++i) {
+        const std::string& sample = dist.sample_element_reference();
+        ASSERT(sample.size() == 33);
+        int index = sample.back() - 'a';
+        ASSERT(index >= 0 && index < 3);
+        
+        if (addresses[index] == nullptr) {
+            addresses[index] = &sample;
+        }
+        
+        ASSERT(addresses[index] == &sample);
+    }
+    
+    ASSERT(dist.update_weight(prefix + "a", 4.0));
+    ASSERT(dist.remove_element(prefix + "b"));
+    ASSERT(dist.get_weight(prefix + "a") == 4.0);
+    ASSERT(dist.sample_element_reference().size() == 33);
+    
+    Distribution copy(dist);
+    ASSERT(copy.size() == 2);
+    ASSERT(copy.get_weight(prefix + "a") == 4.0);
+    ASSERT(copy.remove_element(std::string(33, 'c')));
+    ASSERT(copy.sample_element() == prefix + "a");
+    ASSERT(dist.size() == 2);
+    
+    CountingMemoryResource other_resource;
+    Distribution other_dist(&other_resource);
+    other_dist = std::move(dist);
+    ASSERT(dist.size() == 0);
+    ASSERT(other_dist.size() == 2);
+    ASSERT(other_dist.get_weight(std::string(33, 'c')) == 3.0);
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(other_dist.sample_element_reference().size() == 33);
+    }
+    
+    ASSERT(other_dist.remove_element(prefix + "a"));
+    ASSERT(other_dist.sample_element() == std::string(33, 'c'));
+    
+    Distribution moved_dist(std::move(other_dist));
+    ASSERT(other_dist.size() == 0);
+    ASSERT(moved_dist.sample_element() == std::string(33, 'c'));
+}
+
+static void test_element_storage() {
+    test_string_elements<ArrayProbabilityDistribution<std::string>>();
+    test_string_elements<LinkedListProbabilityDistribution<std::string>>();
+    test_string_elements<BinaryTreeProbabilityDistribution<std::string>>();
+    test_string_elements<AliasProbabilityDistribution<std::string>>();
+    test_string_elements<FenwickTreeProbabilityDistribution<std::string>>();
+    test_string_elements<
+        ImplicitBinaryTreeProbabilityDistribution<std::string>>();
+    test_string_elements<BucketProbabilityDistribution<std::string>>();
+}
+
+template<typename Distribution>
+static void test_handles_impl() {
+    Distribution dist(13);
+    std::vector<ElementHandle> handles;
+    
+    for (int i = 0; i < 100; ++i) {
+        handles.push_back(dist.add_element_handle(i, 1.0 + i));
+        ASSERT(handles.back().is_null() == false);
+    }
+    
+    ASSERT(dist.add_element_handle(5, 1.0).is_null());
+    ASSERT(dist.get_handle(7) == handles[7]);
+    ASSERT(dist.get_handle(100).is_null());
+    ASSERT(dist.contains_handle(ElementHandle{}) == false);
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist.contains_handle(handles[i]));
+        ASSERT(dist.get_element(handles[i]) == i);
+        ASSERT(dist.get_weight(handles[i]) == 1.0 + i);
+    }
+    
+    // Crosses a power of two, which moves the element between buckets:
+    ASSERT(dist.update_weight(handles[3], 50.0));
+    ASSERT(dist.get_weight(3) == 50.0);
+    ASSERT(dist.get_weight(handles[3]) == 50.0);
+    
+    for (int i = 0; i < 100; i += 3) {
+        ASSERT(dist.remove_element(handles[i]));
+    }
+    
+    ASSERT(dist.size() == 66);
+    
+    for (int i = 0; i < 100; ++i) {
+        if (i % 3 == 0) {
+            ASSERT(dist.contains_handle(handles[i]) == false);
+            ASSERT(dist.contains_element(i) == false);
+            ASSERT(dist.remove_element(handles[i]) == false);
+            ASSERT(dist.update_weight(handles[i], 1.0) == false);
+            
+            try {
+                dist.get_weight(handles[i]);
+                FAIL("std::invalid_argument expected.");
+            } catch (std::invalid_argument& err) {}
+        } else {
+            ASSERT(dist.contains_handle(handles[i]));
+            ASSERT(dist.get_element(handles[i]) == i);
+            ASSERT(dist.get_handle(i) == handles[i]);
+        }
+    }
+    
+    // The new element may reuse the slot, but not the generation:
+    ElementHandle handle = dist.add_element_handle(0, 2.0);
+    ASSERT(handle != handles[0]);
+    ASSERT(dist.contains_handle(handles[0]) == false);
+    ASSERT(dist.get_element(handle) == 0);
+    handles[0] = handle;
+    
+    for (int i = 0; i < 1000; ++i) {
+        ElementHandle sampled_handle = dist.sample_handle();
+        ASSERT(dist.contains_handle(sampled_handle));
+        ASSERT(dist.get_handle(dist.get_element(sampled_handle)) ==
+               sampled_handle);
+    }
+    
+    // Sampling without replacement leaves every handle valid:
+    std::vector<int> distinct_samples;
+    dist.sample_distinct(20, std::back_inserter(distinct_samples));
+    ASSERT(distinct_samples.size() == 20);
+    
+    for (int i = 0; i < 100; ++i) {
+        if (i % 3 != 0 || i == 0) {
+            ASSERT(dist.contains_handle(handles[i]));
+            ASSERT(dist.get_element(handles[i]) == i);
+            ASSERT(dist.get_handle(i) == handles[i]);
+        }
+    }
+    
+    Distribution copy(dist);
+    ASSERT(copy.get_element(handles[1]) == 1);
+    ASSERT(copy.remove_element(handles[1]));
+    ASSERT(dist.contains_handle(handles[1]));
+    ASSERT(copy.update_weight(handles[2], 40.0));
+    ASSERT(copy.get_weight(2) == 40.0);
+    ASSERT(dist.get_weight(2) == 3.0);
+    
+    CountingMemoryResource resource;
+    Distribution moved_dist(&resource);
+    moved_dist = std::move(dist);
+    ASSERT(dist.contains_handle(handles[2]) == false);
+    ASSERT(moved_dist.get_element(handles[2]) == 2);
+    ASSERT(moved_dist.update_weight(handles[4], 0.5));
+    ASSERT(moved_dist.get_weight(4) == 0.5);
+    ASSERT(moved_dist.remove_element(handles[5]));
+    ASSERT(moved_dist.contains_element(5) == false);
+    
+    moved_dist.clear();
+    ASSERT(moved_dist.add_element(1000, 1.0));
+    
+    for (const ElementHandle& old_handle : handles) {
+        ASSERT(moved_dist.contains_handle(old_handle) == false);
+    }
+}
+
+static void test_handles() {
+    test_handles_impl<ArrayProbabilityDistribution<int>>();
+    test_handles_impl<LinkedListProbabilityDistribution<int>>();
+    test_handles_impl<BinaryTreeProbabilityDistribution<int>>();
+    test_handles_impl<AliasProbabilityDistribution<int>>();
+    test_handles_impl<FenwickTreeProbabilityDistribution<int>>();
+    test_handles_impl<ImplicitBinaryTreeProbabilityDistribution<int>>();
+    test_handles_impl<BucketProbabilityDistribution<int>>();
+    test_handles_impl<DenseIdProbabilityDistribution<int>>();
+    
+    BinaryTreeProbabilityDistribution<int> weight_shaped_dist;
+    weight_shaped_dist.set_weight_shaped(true);
+    std::vector<ElementHandle> handles;
+    
+    for (int i = 0; i < 64; ++i) {
+        handles.push_back(weight_shaped_dist.add_element_handle(i, 1 << i % 8));
+    }
+    
+    // The rebuilds reshape the tree, but keep the leaves:
+    for (int i = 0; i < 64; ++i) {
+        ASSERT(weight_shaped_dist.update_weight(handles[i], 1 + i % 3));
+    }
+    
+    for (int i = 0; i < 64; ++i) {
+        ASSERT(weight_shaped_dist.get_element(handles[i]) == i);
+        ASSERT(weight_shaped_dist.get_weight(handles[i]) == 1 + i % 3);
+    }
+}
+
+// Hashes all the elements to the same value, so that every lookup probes
+// the whole cluster.
+struct ConstantHash {
+    size_t operator()(int) const {
+        return 0;
+    }
+};
+
+// Hashes only the first letter, ignoring its case, so that the words
+// sharing it collide.
+struct CaseInsensitiveHash {
+    size_t operator()(const std::string& word) const {
+        return word.empty() ? 0 : std::tolower(word[0]);
+    }
+};
+
+struct CaseInsensitiveEqual {
+    bool operator()(const std::string& word1,
+                    const std::string& word2) const {
+        if (word1.size() != word2.size()) {
+            return false;
+        }
+    
+        for (size_t i = 0; i < word1.size(); ++i) {
+            if (std::tolower(word1[i]) != std::tolower(word2[i])) {
+                return false;
+            }
+        }
+    
+        return true;
+    }
+};
+
+// Checks the index against std::unordered_map under random insertions and
+// removals. The values index the array holding the keys.
+template<typename Hash>
+static void test_flat_hash_index_impl(int key_range, int operation_count) {
+    FlatHashIndex<int, Hash> index;
+    std::vector<int> keys;
+    std::vector<uint32_t> free_values;
+    std::unordered_map<int, uint32_t> model;
+    std::mt19937 generator(17);
+    auto get_key = [&keys](uint32_t value) -> const int& {
+        return keys[value];
+    };
+    
+    for (int i = 0; i < operation_count; ++i) {
+        int key = static_cast<int>(generator() % key_range);
+        uint32_t hash = index.hash(key);
+        uint32_t value = index.find(key, hash, get_key);
+        auto iterator = model.find(key);
+    
+        if (iterator == model.end()) {
+            ASSERT(value == FlatHashIndex<int>::NOT_FOUND);
+    
+            if (free_values.empty()) {
+                value = static_cast<uint32_t>(keys.size());
+                keys.push_back(key);
+            } else {
+                value = free_values.back();
+                free_values.pop_back();
+                keys[value] = key;
+            }
+    
+            index.insert(hash, value);
+            model[key] = value;
+        } else {
+            ASSERT(value == iterator->second);
+            index.erase(hash, value);
+            free_values.push_back(value);
+            model.erase(iterator);
+        }
+    
+        ASSERT(index.size() == model.size());
+    }
+    
+    for (int key = 0; key < key_range; ++key) {
+        auto iterator = model.find(key);
+        uint32_t value = index.find(key, get_key);
+    
+        if (iterator == model.end()) {
+            ASSERT(value == FlatHashIndex<int>::NOT_FOUND);
+        } else {
+            ASSERT(value == iterator->second);
+        }
+    }
+    
+    // The table grows at the load factor of 0.8:
+    ASSERT(5 * index.size() <= 4 * index.capacity());
+    index.clear();
+    ASSERT(index.size() == 0);
+    ASSERT(index.find(0, get_key) == FlatHashIndex<int>::NOT_FOUND);
+}
+
+template<typename Distribution>
+static void test_custom_hash_impl() {
+    Distribution dist(29);
+    ASSERT(dist.add_element("Apple", 1.0));
+    ASSERT(dist.add_element("apple", 2.0) == false);
+    ASSERT(dist.add_element("Avocado", 3.0));
+    ASSERT(dist.contains_element("APPLE"));
+    ASSERT(dist.get_weight("aVoCaDo") == 3.0);
+    ASSERT(dist.update_weight("AVOCADO", 4.0));
+    ASSERT(dist.get_weight("Avocado") == 4.0);
+    ASSERT(dist.remove_element("aPPLE"));
+    ASSERT(dist.contains_element("Apple") == false);
+    
+    // Every word starts with one of four letters:
+    std::vector<std::string> words;
+    
+    for (int i = 0; i < 400; ++i) {
+        words.push_back(std::string(1, "abcd"[i % 4]) + std::to_string(i));
+        ASSERT(dist.add_element(words.back(), 1.0 + i % 5));
+    }
+    
+    for (int i = 0; i < 400; i += 2) {
+        std::string word = words[i];
+        word[0] = std::toupper(word[0]);
+        ASSERT(dist.remove_element(word));
+    }
+    
+    ASSERT(dist.size() == 201);
+    
+    for (int i = 0; i < 400; ++i) {
+        ASSERT(dist.contains_element(words[i]) == (i % 2 == 1));
+    }
+    
+    size_t total_count = 0;
+    
+    for (const auto& entry : dist.sample_counts(1000)) {
+        ASSERT(dist.contains_element(entry.first));
+        total_count += entry.second;
+    }
+    
+    ASSERT(total_count == 1000);
+    
+    Distribution copy(dist);
+    ASSERT(copy.remove_element("B1"));
+    ASSERT(copy.contains_element("b1") == false);
+    ASSERT(dist.contains_element("b1"));
+}
+
+static void test_element_index() {
+    test_flat_hash_index_impl<std::hash<int>>(2000, 50000);
+    test_flat_hash_index_impl<ConstantHash>(100, 2000);
+    
+    test_custom_hash_impl<
+        ArrayProbabilityDistribution<std::string,
+                                     std::mt19937,
+                                     CaseInsensitiveHash,
+                                     CaseInsensitiveEqual>>();
+    test_custom_hash_impl<
+        LinkedListProbabilityDistribution<std::string,
+                                          std::mt19937,
+                                          CaseInsensitiveHash,
+                                          CaseInsensitiveEqual>>();
+    test_custom_hash_impl<
+        BinaryTreeProbabilityDistribution<std::string,
+                                          std::mt19937,
+                                          CaseInsensitiveHash,
+                                          CaseInsensitiveEqual>>();
+    test_custom_hash_impl<
+        AliasProbabilityDistribution<std::string,
+                                     std::mt19937,
+                                     CaseInsensitiveHash,
+                                     CaseInsensitiveEqual>>();
+    test_custom_hash_impl<
+        FenwickTreeProbabilityDistribution<std::string,
+                                           std::mt19937,
+                                           CaseInsensitiveHash,
+                                           CaseInsensitiveEqual>>();
+    test_custom_hash_impl<
+        ImplicitBinaryTreeProbabilityDistribution<std::string,
+                                                  std::mt19937,
+                                                  CaseInsensitiveHash,
+                                                  CaseInsensitiveEqual>>();
+    test_custom_hash_impl<
+        BucketProbabilityDistribution<std::string,
+                                      std::mt19937,
+                                      CaseInsensitiveHash,
+                                      CaseInsensitiveEqual>>();
+}
+
+static void test_concurrent() {
+    typedef ConcurrentProbabilityDistribution<int> Distribution;
+    Distribution dist(4);
+    Distribution::Sampler sampler = dist.get_sampler(31);
+    
+    try {
+        sampler.sample_element();
+        FAIL("std::length_error expected.");
+    } catch (std::length_error& err) {}
+    
+    for (int i = 0; i < 10; ++i) {
+        ASSERT(dist.add_element(i, 1.0 + i));
+    }
+    
+    ASSERT(dist.add_element(3, 1.0) == false);
+    ASSERT(dist.size() == 10);
+    
+    // Nothing is visible to the samplers before publishing:
+    try {
+        sampler.sample_element();
+        FAIL("std::length_error expected.");
+    } catch (std::length_error& err) {}
+    
+    dist.publish();
+    
+    for (int i = 0; i < 1000; ++i) {
+        int element = sampler.sample_element();
+        ASSERT(element >= 0 && element < 10);
+    }
+    
+    ASSERT(dist.update_weight(7, 1e9));
+    ASSERT(dist.get_weight(7) == 1e9);
+    ASSERT(dist.remove_element(0));
+    ASSERT(dist.remove_element(0) == false);
+    ASSERT(dist.contains_element(0) == false);
+    ASSERT(dist.update_weight(0, 1.0) == false);
+    ASSERT(dist.size() == 9);
+    
+    try {
+        dist.get_weight(0);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    try {
+        dist.update_weight(7, -1.0);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    // The last element moved into the hole keeps its weight:
+    ASSERT(dist.get_weight(9) == 10.0);
+    
+    // The samplers keep seeing the old snapshot until the next publish():
+    int count = 0;
+    
+    for (int i = 0; i < 1000; ++i) {
+        if (sampler.sample_element() == 7) {
+            count++;
+        }
+    }
+    
+    ASSERT(count < 500);
+    dist.publish();
+    
+    std::vector<int> samples;
+    sampler.sample_elements(1000, std::back_inserter(samples));
+    ASSERT(samples.size() == 1000);
+    ASSERT(std::count(samples.begin(), samples.end(), 7) > 950);
+    ASSERT(std::count(samples.begin(), samples.end(), 0) == 0);
+    
+    // No sampler was reading, so the replaced snapshots were freed:
+    ASSERT(dist.get_retired_snapshot_count() == 0);
+    
+    {
+        std::vector<Distribution::Sampler> samplers;
+        
+        for (int i = 0; i < 3; ++i) {
+            samplers.push_back(dist.get_sampler(i));
+        }
+        
+        try {
+            dist.get_sampler(3);
+            FAIL("std::length_error expected.");
+        } catch (std::length_error& err) {}
+    }
+    
+    // The destroyed samplers gave their slots back:
+    Distribution::Sampler sampler2 = dist.get_sampler(5);
+    Distribution::Sampler sampler3(std::move(sampler2));
+    ASSERT(sampler3.sample_element() != 0);
+    
+    for (int i = 10; i < 1000; ++i) {
+        ASSERT(dist.add_element(i, 1.0 + i % 7));
+    }
+    
+    for (int i = 0; i < 1000; i += 3) {
+        dist.remove_element(i);
+    }
+    
+    ASSERT(dist.update_weight(7, 1.0));
+    dist.publish();
+    
+    for (int i = 1; i < 1000; ++i) {
+        ASSERT(dist.contains_element(i) == (i % 3 != 0));
+    }
+    
+    for (int i = 10; i < 1000; ++i) {
+        if (i % 3 != 0) {
+            ASSERT(dist.get_weight(i) == 1.0 + i % 7);
+        }
+    }
+    
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT(sampler3.sample_element() % 3 != 0);
+    }
+    
+    // Each publish() of a few changes copies only them into the snapshot
+    // replaced by the previous publish(), which must then match the writer:
+    for (int i = 1; i < 300; ++i) {
+        int element = i % 3 == 0 ? 2000 + i : i;
+        
+        if (i % 3 == 0) {
+            ASSERT(dist.add_element(element, 1e12));
+        } else {
+            ASSERT(dist.update_weight(element, 1e12));
+        }
+        
+        dist.publish();
+        
+        for (int j = 0; j < 100; ++j) {
+            ASSERT(sampler3.sample_element() == element);
+        }
+        
+        if (i % 3 == 0) {
+            ASSERT(dist.remove_element(element));
+        } else {
+            ASSERT(dist.update_weight(element, 1.0 + i % 7));
+        }
+    }
+    
+    dist.publish();
+    
+    for (int i = 0; i < 10000; ++i) {
+        int element = sampler3.sample_element();
+        ASSERT(element > 0 && element < 1000 && element % 3 != 0);
+    }
+    
+    dist.clear();
+    dist.publish();
+    ASSERT(dist.is_empty());
+    
+    try {
+        sampler3.sample_element();
+        FAIL("std::length_error expected.");
+    } catch (std::length_error& err) {}
+    
+    // Only the even elements below 2000 are ever added, while the writer
+    // keeps adding, removing, reweighting and publishing:
+    Distribution shared_dist(8);
+    
+    for (int i = 0; i < 2000; i += 2) {
+        shared_dist.add_element(i, 1.0);
+    }
+    
+    shared_dist.publish();
+    std::vector<size_t> failure_counts(4, 0);
+    std::vector<std::thread> threads;
+    
+    for (size_t t = 0; t < failure_counts.size(); ++t) {
+        threads.emplace_back([&shared_dist, &failure_counts, t]() {
+            Distribution::Sampler thread_sampler =
+                shared_dist.get_sampler(static_cast<uint32_t>(t));
+            
+            for (int i = 0; i < 20000; ++i) {
+                int element = thread_sampler.sample_element();
+                
+                if (element % 2 != 0 || element < 0 || element >= 2000) {
+                    failure_counts[t]++;
+                }
+            }
+        });
+    }
+    
+    std::mt19937 generator(37);
+    
+    for (int round = 0; round < 2000; ++round) {
+        int element = 2 * static_cast<int>(generator() % 1000);
+        
+        if (shared_dist.size() > 1 && shared_dist.contains_element(element)) {
+            if (round % 3 == 0) {
+                shared_dist.update_weight(element, 1.0 + round % 5);
+            } else {
+                shared_dist.remove_element(element);
+            }
+        } else {
+            shared_dist.add_element(element, 1.0 + round % 5);
+        }
+        
+        if (round % 10 == 0) {
+            shared_dist.publish();
+        }
+    }
+    
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    
+    for (size_t failure_count : failure_counts) {
+        ASSERT(failure_count == 0);
+    }
+    
+    shared_dist.publish();
+    ASSERT(shared_dist.get_retired_snapshot_count() == 0);
+}
+
+static void test_sharded() {
+    typedef ShardedProbabilityDistribution<int> Distribution;
+    Distribution dist(8, 41);
+    std::mt19937 generator(41);
+    
+    ASSERT(dist.get_shard_count() == 8);
+    ASSERT(dist.is_empty());
+    
+    // The published total of a shard is its own total, not a running sum
+    // that the heavy weight cancels out to zero:
+    Distribution single_shard_dist(1, 41);
+    single_shard_dist.add_element(1, 1e17);
+    single_shard_dist.add_element(2, 1.0);
+    ASSERT(single_shard_dist.remove_element(1));
+    ASSERT(single_shard_dist.size() == 1);
+    
+    for (int i = 0; i < 10; ++i) {
+        ASSERT(single_shard_dist.sample_element(generator) == 2);
+    }
+    
+    // A shard whose own total cancels out is still sampled while it holds
+    // elements:
+    ShardedProbabilityDistribution<int,
+                                   std::hash<int>,
+                                   std::equal_to<int>,
+                                   FenwickTreeProbabilityDistribution<int>>
+        fenwick_shard_dist(1, 41);
+    
+    fenwick_shard_dist.add_element(1, 1e17);
+    fenwick_shard_dist.add_element(2, 1.0);
+    ASSERT(fenwick_shard_dist.remove_element(1));
+    ASSERT(fenwick_shard_dist.is_empty() == false);
+    
+    for (int i = 0; i < 10; ++i) {
+        ASSERT(fenwick_shard_dist.sample_element(generator) == 2);
+    }
+    
+    try {
+        dist.sample_element(generator);
+        FAIL("std::length_error expected.");
+    } catch (std::length_error& err) {}
+    
+    for (int i = 0; i < 100; ++i) {
+        ASSERT(dist.add_element(i, 1.0));
+    }
+    
+    ASSERT(dist.add_element(5, 2.0) == false);
+    ASSERT(dist.size() == 100);
+    ASSERT(dist.contains_element(99));
+    ASSERT(dist.contains_element(100) == false);
+    
+    try {
+        dist.add_element(100, -1.0);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    try {
+        dist.get_weight(100);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    ASSERT(dist.update_weight(17, 900.0));
+    ASSERT(dist.get_weight(17) == 900.0);
+    ASSERT(dist.update_weight(100, 1.0) == false);
+    size_t count = 0;
+    
+    for (int i = 0; i < 100000; ++i) {
+        int element = dist.sample_element(generator);
+        ASSERT(element >= 0 && element < 100);
+        
+        if (element == 17) {
+            count++;
+        }
+    }
+    
+    ASSERT(std::abs(count / 100000.0 - 0.9) < 0.01);
+    
+    for (int i = 0; i < 100; i += 2) {
+        ASSERT(dist.remove_element(i));
+        ASSERT(dist.remove_element(i) == false);
+    }
+    
+    ASSERT(dist.size() == 50);
+    
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT(dist.sample_element(generator) % 2 == 1);
+    }
+    
+    dist.clear();
+    ASSERT(dist.is_empty());
+    ASSERT(dist.contains_element(17) == false);
+    
+    try {
+        dist.sample_element(generator);
+        FAIL("std::length_error expected.");
+    } catch (std::length_error& err) {}
+    
+    // Each writer thread churns its own range of elements while the
+    // sampler threads draw; only the elements at multiples of 3 are ever
+    // added:
+    std::vector<std::thread> threads;
+    std::vector<size_t> failure_counts(6, 0);
+    
+    for (int i = 0; i < 1200; i += 3) {
+        dist.add_element(i, 1.0);
+    }
+    
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&dist, t]() {
+            std::mt19937 thread_generator(t);
+            
+            for (int round = 0; round < 5000; ++round) {
+                int element = 300 * t + 3 * (thread_generator() % 100);
+                
+                if (!dist.contains_element(element)) {
+                    dist.add_element(element, 1.0 + round % 7);
+                } else if (round % 2 == 0) {
+                    dist.update_weight(element, 1.0 + round % 5);
+                } else {
+                    dist.remove_element(element);
+                }
+            }
+            
+            // Leave the range with the elements and the weights it started
+            // with:
+            for (int element = 300 * t;
+                 element < 300 * (t + 1);
+                 element += 3) {
+                if (!dist.add_element(element, 1.0)) {
+                    dist.update_weight(element, 1.0);
+                }
+            }
+        });
+    }
+    
+    for (size_t t = 4; t < failure_counts.size(); ++t) {
+        threads.emplace_back([&dist, &failure_counts, t]() {
+            Xoshiro256PlusPlus thread_generator(t);
+            
+            for (int i = 0; i < 20000; ++i) {
+                int element = dist.sample_element(thread_generator);
+                
+                if (element % 3 != 0 || element < 0 || element >= 1200) {
+                    failure_counts[t]++;
+                }
+            }
+        });
+    }
+    
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    
+    for (size_t failure_count : failure_counts) {
+        ASSERT(failure_count == 0);
+    }
+    
+    ASSERT(dist.size() == 400);
+    
+    for (int i = 0; i < 1200; ++i) {
+        ASSERT(dist.contains_element(i) == (i % 3 == 0));
+    }
+    
+    for (int i = 0; i < 1200; i += 3) {
+        ASSERT(dist.get_weight(i) == 1.0);
+    }
+    
+    // The shards index the words by the same hash and equality:
+    ShardedProbabilityDistribution<std::string,
+                                   CaseInsensitiveHash,
+                                   CaseInsensitiveEqual> word_dist(4, 41);
+    
+    ASSERT(word_dist.add_element("Apple", 1.0));
+    ASSERT(word_dist.add_element("APPLE", 2.0) == false);
+    ASSERT(word_dist.add_element("Avocado", 3.0));
+    ASSERT(word_dist.contains_element("apple"));
+    ASSERT(word_dist.get_weight("aVoCaDo") == 3.0);
+    ASSERT(word_dist.remove_element("AVOCADO"));
+    ASSERT(word_dist.size() == 1);
+    ASSERT(word_dist.sample_element(generator) == "Apple");
+}
+
+static void test_atomic_fenwick_tree() {
+    typedef AtomicFenwickTreeProbabilityDistribution<int> Distribution;
+    std::vector<int> elements;
+    
+    for (int i = 0; i < 100; ++i) {
+        elements.push_back(i);
+    }
+    
+    try {
+        Distribution dist({ 1, 2, 1 });
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    try {
+        Distribution dist({ 1, 2 }, { 1 });
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    Distribution dist(elements);
+    std::mt19937 generator(43);
+    
+    ASSERT(dist.size() == 100);
+    ASSERT(dist.get_total_weight() == 0);
+    ASSERT(dist.contains_element(99));
+    ASSERT(dist.contains_element(100) == false);
+    ASSERT(dist.get_handle(100).is_null());
+    ASSERT(dist.add_to_weight(100, 1) == false);
+    
+    try {
+        dist.sample_element(generator);
+        FAIL("std::length_error expected.");
+    } catch (std::length_error& err) {}
+    
+    try {
+        dist.get_weight(100);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    ASSERT(dist.add_to_weight(7, 3));
+    ASSERT(dist.add_to_weight(99, 1));
+    ElementHandle handle = dist.get_handle(7);
+    ASSERT(dist.get_element(handle) == 7);
+    dist.add_to_weight(handle, 6);
+    ASSERT(dist.get_weight(7) == 9);
+    ASSERT(dist.get_total_weight() == 10);
+    size_t count = 0;
+    
+    for (int i = 0; i < 100000; ++i) {
+        int element = dist.sample_element(generator);
+        ASSERT(element == 7 || element == 99);
+        
+        if (element == 7) {
+            count++;
+        }
+    }
+    
+    ASSERT(std::abs(count / 100000.0 - 0.9) < 0.01);
+    
+    // Negative deltas take the weights back down:
+    dist.add_to_weight(handle, -9);
+    ASSERT(dist.get_weight(handle) == 0);
+    
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT(dist.sample_handle(generator) == dist.get_handle(99));
+    }
+    
+    // Initial weights:
+    Distribution dist2({ 10, 20, 30 }, { 1, 0, 3 });
+    ASSERT(dist2.get_total_weight() == 4);
+    ASSERT(dist2.get_weight(20) == 0);
+    
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT(dist2.sample_element(generator) != 20);
+    }
+    
+    // The threads bump the odd elements only, while the others sample;
+    // the even elements keep the weight of zero:
+    Distribution shared_dist(elements);
+    shared_dist.add_to_weight(1, 1);
+    std::vector<std::thread> threads;
+    std::vector<size_t> failure_counts(6, 0);
+    
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&shared_dist, t]() {
+            std::mt19937 thread_generator(t);
+            
+            for (int i = 0; i < 25000; ++i) {
+                shared_dist.add_to_weight(
+                    2 * static_cast<int>(thread_generator() % 50) + 1,
+                    1);
+            }
+        });
+    }
+    
+    for (size_t t = 4; t < failure_counts.size(); ++t) {
+        threads.emplace_back([&shared_dist, &failure_counts, t]() {
+            std::mt19937 thread_generator(t);
+            
+            for (int i = 0; i < 20000; ++i) {
+                if (shared_dist.sample_element(thread_generator) % 2 == 0) {
+                    failure_counts[t]++;
+                }
+            }
+        });
+    }
+    
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    
+    for (size_t failure_count : failure_counts) {
+        ASSERT(failure_count == 0);
+    }
+    
+    ASSERT(shared_dist.get_total_weight() == 100001);
+    uint64_t total_weight = 0;
+    
+    for (int i = 0; i < 100; ++i) {
+        total_weight += shared_dist.get_weight(i);
+    }
+    
+    ASSERT(total_weight == 100001);
+}
+
+template<typename Distribution>
+static void test_parallel_sample_impl() {
+    // Spans several chunks, the last of them partial:
+    const size_t count = 3 * Distribution::PARALLEL_CHUNK_SIZE + 100;
+    Distribution dist(29);
+    std::vector<int> samples(count);
+    
+    try {
+        dist.parallel_sample(count, samples.begin(), 2);
+        FAIL("std::length_error expected.");
+    } catch (std::length_error& err) {}
+    
+    ASSERT(dist.parallel_sample(0, samples.begin(), 2) == samples.begin());
+    
+    for (int i = 0; i < 20; ++i) {
+        dist.add_element(i, 1.0 + i);
+    }
+    
+    Distribution copy_dist(29);
+    
+    for (int i = 0; i < 20; ++i) {
+        copy_dist.add_element(i, 1.0 + i);
+    }
+    
+    // The samples drawn serially do not shift the parallel streams:
+    for (int i = 0; i < 100; ++i) {
+        copy_dist.sample_element();
+    }
+    
+    ASSERT(dist.parallel_sample(count, samples.begin(), 1) == samples.end());
+    
+    std::vector<int> copy_samples(count);
+    copy_dist.parallel_sample(count, copy_samples.begin(), 8);
+    ASSERT(samples == copy_samples);
+    
+    // The second call draws from new streams, alike on any thread count:
+    std::vector<int> samples2(count);
+    std::vector<int> copy_samples2(count);
+    dist.parallel_sample(count, samples2.begin(), 2);
+    copy_dist.parallel_sample(count, copy_samples2.begin(), 0);
+    ASSERT(samples2 == copy_samples2);
+    ASSERT(samples2 != samples);
+    
+    // A copy carries on with the streams of the original:
+    Distribution copied_dist(dist);
+    Distribution assigned_dist(31);
+    assigned_dist = dist;
+    std::vector<int> samples3(count);
+    std::vector<int> copied_samples3(count);
+    std::vector<int> assigned_samples3(count);
+    dist.parallel_sample(count, samples3.begin(), 2);
+    copied_dist.parallel_sample(count, copied_samples3.begin(), 2);
+    assigned_dist.parallel_sample(count, assigned_samples3.begin(), 2);
+    ASSERT(samples3 == copied_samples3);
+    ASSERT(samples3 == assigned_samples3);
+    
+    std::vector<size_t> counts(20, 0);
+    
+    for (int element : samples) {
+        ASSERT(element >= 0 && element < 20);
+        counts[element]++;
+    }
+    
+    for (int i = 0; i < 20; ++i) {
+        ASSERT(std::abs(counts[i] / static_cast<double>(count) -
+                        (1.0 + i) / 210.0) < 0.01);
+    }
+    
+    // The changes are seen by the next call:
+    dist.update_weight(0, 1000.0);
+    dist.remove_element(19);
+    dist.parallel_sample(count, samples.begin(), 3);
+    size_t zero_count = 0;
+    
+    for (int element : samples) {
+        ASSERT(element != 19);
+        
+        if (element == 0) {
+            zero_count++;
+        }
+    }
+    
+    ASSERT(std::abs(zero_count / static_cast<double>(count) -
+                    1000.0 / 1190.0) < 0.01);
+}
+
+static void test_parallel_sample() {
+    test_parallel_sample_impl<ArrayProbabilityDistribution<int>>();
+    test_parallel_sample_impl<LinkedListProbabilityDistribution<int>>();
+    test_parallel_sample_impl<BinaryTreeProbabilityDistribution<int>>();
+    test_parallel_sample_impl<AliasProbabilityDistribution<int>>();
+    test_parallel_sample_impl<FenwickTreeProbabilityDistribution<int>>();
+    test_parallel_sample_impl<ImplicitBinaryTreeProbabilityDistribution<int>>();
+    test_parallel_sample_impl<BucketProbabilityDistribution<int>>();
+    test_parallel_sample_impl<DenseIdProbabilityDistribution<int>>();
+    
+    // Other engines are seeded alike:
+    typedef ArrayProbabilityDistribution<int, Xoshiro256PlusPlus> XoshiroDist;
+    XoshiroDist dist(5);
+    dist.add_element(1, 1.0);
+    dist.add_element(2, 3.0);
+    std::vector<int> samples(100000);
+    std::vector<int> samples2(100000);
+    dist.parallel_sample(samples.size(), samples.begin(), 1);
+    XoshiroDist dist2(5);
+    dist2.add_element(1, 1.0);
+    dist2.add_element(2, 3.0);
+    dist2.parallel_sample(samples2.size(), samples2.begin(), 4);
+    ASSERT(samples == samples2);
+    ASSERT(std::abs(std::count(samples.begin(), samples.end(), 2) /
+                    100000.0 - 0.75) < 0.01);
+}
+
+// Replays the records on a fresh distribution and checks that it ends up
+// with the weights 'weights' of the elements 0, 1, ... and that all the
+// samples are elements present at the time.
+template<typename Distribution>
+static void test_trace_replay(const std::vector<TraceRecord<int>>& records,
+                              const std::vector<double>& weights,
+                              size_t sample_count) {
+    Distribution dist(3);
+    size_t replayed_sample_count = 0;
+    
+    auto check_sample = [&dist, &replayed_sample_count](int element) {
+        ASSERT(dist.contains_element(element));
+        replayed_sample_count++;
+    };
+    
+    for (const TraceRecord<int>& record : records) {
+        record.apply(dist, check_sample);
+    }
+    
+    ASSERT(replayed_sample_count == sample_count);
+    ASSERT(dist.size() == static_cast<size_t>(
+                            std::count_if(weights.begin(),
+                                          weights.end(),
+                                          [](double weight) {
+                                              return weight > 0.0;
+                                          })));
+    
+    for (size_t i = 0; i < weights.size(); ++i) {
+        int element = static_cast<int>(i);
+        
+        if (weights[i] > 0.0) {
+            ASSERT(dist.get_weight(element) == weights[i]);
+        } else {
+            ASSERT(dist.contains_element(element) == false);
+        }
+    }
+}
+
+static void test_trace() {
+    std::stringstream trace;
+    TraceWriter<int> writer(trace);
+    ArrayProbabilityDistribution<int> recorded_dist(5);
+    RecordingProbabilityDistribution<int> dist(recorded_dist, writer);
+    std::vector<double> weights(40, 0.0);
+    std::vector<ElementHandle> handles;
+    size_t sample_count = 0;
+    
+    ASSERT(dist.is_empty());
+    
+    try {
+        dist.sample_element();
+        FAIL("std::length_error expected.");
+    } catch (std::length_error& err) {}
+    
+    for (int i = 0; i < 30; ++i) {
+        handles.push_back(dist.add_element_handle(i, 1.0 + i));
+        weights[i] = 1.0 + i;
+    }
+    
+    // Fails and is traced, as it fails alike on the replay:
+    ASSERT(dist.add_element(3, 100.0) == false);
+    
+    int element = 30;
+    ASSERT(dist.add_element(std::move(element), 2.0));
+    weights[30] = 2.0;
+    
+    for (int i = 0; i < 100; ++i) {
+        int sample = dist.sample_element();
+        ASSERT(sample >= 0 && sample <= 30);
+        dist.sample_handle();
+        sample_count += 2;
+    }
+    
+    ASSERT(dist.update_weight(4, 0.5));
+    ASSERT(dist.update_weight(handles[5], 7.0));
+    ASSERT(dist.remove_element(6));
+    ASSERT(dist.remove_element(handles[7]));
+    ASSERT(dist.remove_element(handles[7]) == false);
+    ASSERT(dist.update_weight(handles[7], 1.0) == false);
+    weights[4] = 0.5;
+    weights[5] = 7.0;
+    weights[6] = 0.0;
+    weights[7] = 0.0;
+    
+    std::vector<int> samples;
+    dist.sample_elements(50, std::back_inserter(samples));
+    sample_count += 50;
+    ASSERT(samples.size() == 50);
+    
+    // The batches of distinct samples and of counts are traced as a record
+    // each and leave the handles of the recorded distribution valid:
+    uint64_t record_count = writer.get_record_count();
+    std::vector<int> distinct_samples;
+    dist.sample_distinct(10, std::back_inserter(distinct_samples));
+    std::vector<std::pair<int, size_t>> counts = dist.sample_counts(100);
+    size_t counted_sample_count = 0;
+    sample_count += 110;
+    
+    for (const std::pair<int, size_t>& element_count : counts) {
+        counted_sample_count += element_count.second;
+    }
+    
+    ASSERT(writer.get_record_count() == record_count + 2);
+    ASSERT(distinct_samples.size() == 10);
+    ASSERT(counted_sample_count == 100);
+    
+    for (int i = 0; i < 30; ++i) {
+        if (i != 6 && i != 7) {
+            ASSERT(recorded_dist.contains_handle(handles[i]));
+            ASSERT(recorded_dist.get_handle(i) == handles[i]);
+            ASSERT(recorded_dist.get_weight(handles[i]) == weights[i]);
+        }
+    }
+    
+    // Queries are forwarded and not traced:
+    ASSERT(dist.size() == 29);
+    ASSERT(dist.get_weight(handles[5]) == 7.0);
+    ASSERT(dist.get_element(handles[8]) == 8);
+    ASSERT(dist.contains_handle(handles[6]) == false);
+    ASSERT(dist.get_handle(9) == handles[9]);
+    
+    std::vector<int> parallel_samples(1000);
+    dist.parallel_sample(1000, parallel_samples.begin(), 2);
+    
+    for (int sample : parallel_samples) {
+        ASSERT(recorded_dist.contains_element(sample));
+    }
+    
+    // The replay starts again from the state after the clearing:
+    dist.clear();
+    ASSERT(recorded_dist.is_empty());
+    std::fill(weights.begin(), weights.end(), 0.0);
+    
+    for (int i = 0; i < 40; ++i) {
+        dist.add_element(i, 40.0 - i);
+        weights[i] = 40.0 - i;
+    }
+    
+    for (int i = 0; i < 40; i += 4) {
+        dist.remove_element(i);
+        weights[i] = 0.0;
+    }
+    
+    for (int i = 0; i < 200; ++i) {
+        dist.sample_element();
+        sample_count++;
+    }
+    
+    TraceReader<int> reader(trace);
+    std::vector<TraceRecord<int>> records = reader.read_all();
+    ASSERT(records.size() == writer.get_record_count());
+    ASSERT(records[0].operation == TraceOperation::ADD);
+    ASSERT(records[0].element == 0);
+    ASSERT(records[0].weight == 1.0);
+    ASSERT(records.back().operation == TraceOperation::SAMPLE);
+    
+    test_trace_replay<ArrayProbabilityDistribution<int>>(records,
+                                                         weights,
+                                                         sample_count);
+    test_trace_replay<LinkedListProbabilityDistribution<int>>(records,
+                                                              weights,
+                                                              sample_count);
+    test_trace_replay<BinaryTreeProbabilityDistribution<int>>(records,
+                                                              weights,
+                                                              sample_count);
+    test_trace_replay<AliasProbabilityDistribution<int>>(records,
+                                                         weights,
+                                                         sample_count);
+    test_trace_replay<BucketProbabilityDistribution<int>>(records,
+                                                          weights,
+                                                          sample_count);
+    test_trace_replay<DenseIdProbabilityDistribution<int>>(records,
+                                                           weights,
+                                                           sample_count);
+    
+    // A sample is a single byte:
+    std::stringstream sample_trace;
+    TraceWriter<int> sample_writer(sample_trace);
+    size_t header_size = sample_trace.str().size();
+    sample_writer.write(TraceOperation::SAMPLE);
+    ASSERT(sample_trace.str().size() == header_size + 1);
+    
+    try {
+        RecordingProbabilityDistribution<int> non_empty_dist(recorded_dist,
+                                                             writer);
+        FAIL("std::invalid_argument expected.");
+    } catch (std::invalid_argument& err) {}
+    
+    std::stringstream bad_trace("PDTRACEX");
+    
+    try {
+        TraceReader<int> bad_reader(bad_trace);
+        FAIL("std::runtime_error expected.");
+    } catch (std::runtime_error& err) {}
+    
+    std::stringstream int_trace;
+    TraceWriter<int> int_writer(int_trace);
+    int_writer.write(TraceOperation::ADD, 1, 1.0);
+    
+    try {
+        TraceReader<int64_t> wrong_size_reader(int_trace);
+        FAIL("std::runtime_error expected.");
+    } catch (std::runtime_error& err) {}
+    
+    // Cut the weight of the last record short:
+    std::string bytes = int_trace.str();
+    std::stringstream cut_trace(bytes.substr(0, bytes.size() - 1));
+    TraceReader<int> cut_reader(cut_trace);
+    TraceRecord<int> record;
+    
+    try {
+        cut_reader.read(record);
+        FAIL("std::runtime_error expected.");
+    } catch (std::runtime_error& err) {}
+}
+
+static void demo() {
+    std::cout << "--- Sanity demo ---\n";
+    
+    using net::coderodde::util::ArrayProbabilityDistribution;
+    using net::coderodde::util::LinkedListProbabilityDistribution;
+    using net::coderodde::util::BinaryTreeProbabilityDistribution;
+    using net::coderodde::util::AliasProbabilityDistribution;
+    using net::coderodde::util::FenwickTreeProbabilityDistribution;
+    using net::coderodde::util::ImplicitBinaryTreeProbabilityDistribution;
+    
+    std::random_device rd{};
+    std::random_device::result_type seed = rd();
+    
+    ArrayProbabilityDistribution<int> prob_dist1{seed};
+    LinkedListProbabilityDistribution<int> prob_dist2{seed};
+    BinaryTreeProbabilityDistribution<int> prob_dist3{seed};
+    AliasProbabilityDistribution<int> prob_dist4{seed};
+    FenwickTreeProbabilityDistribution<int> prob_dist5{seed};
+    ImplicitBinaryTreeProbabilityDistribution<int> prob_dist6{seed};
+    
+    prob_dist1.add_element(1, 1.0);
+    prob_dist1.add_element(2, 1.0);
+    prob_dist1.add_element(3, 3.0);
+    
+    prob_dist2.add_element(1, 1.0);
+    prob_dist2.add_element(2, 1.0);
+    prob_dist2.add_element(3, 3.0);
+    
+    prob_dist3.add_element(1, 1.0);
+    prob_dist3.add_element(2, 1.0);
+    prob_dist3.add_element(3, 3.0);
+    
+    prob_dist4.add_element(1, 1.0);
+    prob_dist4.add_element(2, 1.0);
+    prob_dist4.add_element(3, 3.0);
+    
+    prob_dist5.add_element(1, 1.0);
+    prob_dist5.add_element(2, 1.0);
+    prob_dist5.add_element(3, 3.0);
+    
+    prob_dist6.add_element(1, 1.0);
+    prob_dist6.add_element(2, 1.0);
+    prob_dist6.add_element(3, 3.0);
+    
+    int arr1[4] = {};
+    int arr2[4] = {};
+    int arr3[4] = {};
+    int arr4[4] = {};
+    int arr5[4] = {};
+    int arr6[4] = {};
+    
+    for (int i = 0; i < 1000; ++i) {
+        arr1[prob_dist1.sample_element()]++;
+        arr2[prob_dist2.sample_element()]++;
+        arr3[prob_dist3.sample_element()]++;
+        arr4[prob_dist4.sample_element()]++;
+        arr5[prob_dist5.sample_element()]++;
+        arr6[prob_dist6.sample_element()]++;
+    }
+    
+    for (int i = 1; i < 4; ++i) {
+        std::cout << arr1[i] << " ";
+    }
+    
+    std::cout << "\n";
+    
+    for (int i = 1; i < 4; ++i) {
+        std::cout << arr2[i] << " ";
+    }
+    
+    std::cout << "\n";
+    
+    for (int i = 1; i < 4; ++i) {
+        std::cout << arr3[i] << " ";
+    }
+    
+    std::cout << "\n";
+    
+    for (int i = 1; i < 4; ++i) {
+        std::cout << arr4[i] << " ";
+    }
+    
+    std::cout << "\n";
+    
+    for (int i = 1; i < 4; ++i) {
+        std::cout << arr5[i] << " ";
+    }
+    
+    std::cout << "\n";
+    
+    for (int i = 1; i < 4; ++i) {
+        std::cout << arr6[i] << " ";
+    }
+    
+    std::cout << "\n-------------------\n";
+}
+
+static size_t LOAD = 40 * 1000;
+static size_t SAMPLES = 40 * 1000;
+
+// Samples from an alias method distribution, whose O(1) sampling is dominated
+// by the cost of the random engine.
+template<typename Engine>
+static void benchmark_engine(const char* engine_name) {
+    const size_t samples = 100 * SAMPLES;
+    AliasProbabilityDistribution<int, Engine> prob_dist;
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist.add_element(i, 1.0 + i % 10);
+    }
+    
+    prob_dist.sample_element(); // Build the alias table.
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    int64_t checksum = 0;
+    
+    for (size_t i = 0; i < samples; ++i) {
+        checksum += prob_dist.sample_element();
+    }
+    
+    auto end = std::chrono::high_resolution_clock::now();
+    double nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    std::cout << "  " << engine_name << " (" << sizeof(Engine)
+              << " bytes of state): " << nanoseconds / samples
+              << " nanoseconds per sample, checksum " << checksum << ".\n";
+}
+
+// Compares updating and removing elements by value, which hashes them,
+// with doing so by handle. The string elements are too long for the small
+// string optimization, so that hashing and comparing them is not free.
+template<typename Distribution>
+static void benchmark_handles(const char* distribution_name) {
+    Distribution prob_dist(2017);
+    std::vector<std::string> elements;
+    std::vector<ElementHandle> handles;
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        elements.push_back("a rather long element name " + std::to_string(i));
+        handles.push_back(prob_dist.add_element_handle(elements.back(),
+                                                       1.0 + i % 7));
+    }
+    
+    std::vector<size_t> order(LOAD);
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        order[i] = i;
+    }
+    
+    std::shuffle(order.begin(), order.end(), std::mt19937{2017});
+    const size_t rounds = 10;
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    for (size_t round = 0; round < rounds; ++round) {
+        for (size_t i : order) {
+            prob_dist.update_weight(elements[i], 1.0 + (i + round) % 7);
+        }
+    }
+    
+    auto end = std::chrono::high_resolution_clock::now();
+    double element_nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    start = std::chrono::high_resolution_clock::now();
+    
+    for (size_t round = 0; round < rounds; ++round) {
+        for (size_t i : order) {
+            prob_dist.update_weight(handles[i], 1.0 + (i + round) % 7);
+        }
+    }
+    
+    end = std::chrono::high_resolution_clock::now();
+    double handle_nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    start = std::chrono::high_resolution_clock::now();
+    
+    for (size_t i : order) {
+        prob_dist.remove_element(handles[i]);
+    }
+    
+    end = std::chrono::high_resolution_clock::now();
+    double remove_nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    std::cout << "  " << distribution_name << ": update_weight "
+              << element_nanoseconds / (rounds * LOAD)
+              << " nanoseconds by element, "
+              << handle_nanoseconds / (rounds * LOAD)
+              << " nanoseconds by handle; remove_element "
+              << remove_nanoseconds / LOAD
+              << " nanoseconds by handle, size " << prob_dist.size() << ".\n";
+}
+
+// Compares sample_element() called on the concrete (final) type, which is
+// bound statically, with the same call through the base class, on a
+// distribution small enough for the dispatch to dominate. The base pointer
+// goes through a volatile variable to hide the dynamic type from the
+// compiler.
+template<typename Distribution>
+static void benchmark_dispatch(const char* distribution_name) {
+    const size_t samples = 100 * SAMPLES;
+    Distribution prob_dist(2017);
+    
+    for (int i = 0; i < 8; ++i) {
+        prob_dist.add_element(i, 1.0 + i);
+    }
+    
+    ProbabilityDistribution<int>* volatile volatile_pointer = &prob_dist;
+    ProbabilityDistribution<int>* base_pointer = volatile_pointer;
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    int64_t checksum = 0;
+    
+    for (size_t i = 0; i < samples; ++i) {
+        checksum += prob_dist.sample_element();
+    }
+    
+    auto end = std::chrono::high_resolution_clock::now();
+    double static_nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    start = std::chrono::high_resolution_clock::now();
+    
+    for (size_t i = 0; i < samples; ++i) {
+        checksum += base_pointer->sample_element();
+    }
+    
+    end = std::chrono::high_resolution_clock::now();
+    double virtual_nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    std::cout << "  " << distribution_name << ": "
+              << static_nanoseconds / samples << " nanoseconds static, "
+              << virtual_nanoseconds / samples << " nanoseconds virtual, "
+              << "checksum " << checksum << ".\n";
+}
+
+// Grows a tree distribution to a million elements, shrinks it to a tenth by
+// removing the oldest elements, and then slides the window of live elements
+// further, which is the workload that used to skew the tree.
+static void benchmark_churn() {
+    const size_t peak_size = 25 * LOAD;
+    const size_t window_size = peak_size / 10;
+    BinaryTreeProbabilityDistribution<int> prob_dist;
+    int next_element = 0;
+    int oldest_element = 0;
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    while (prob_dist.size() < peak_size) {
+        prob_dist.add_element(next_element, 1.0 + next_element % 10);
+        next_element++;
+    }
+    
+    while (prob_dist.size() > window_size) {
+        prob_dist.remove_element(oldest_element++);
+    }
+    
+    for (size_t i = 0; i < 10 * window_size; ++i) {
+        prob_dist.remove_element(oldest_element++);
+        prob_dist.add_element(next_element, 1.0 + next_element % 10);
+        next_element++;
+    }
+    
+    auto end = std::chrono::high_resolution_clock::now();
+    double churn_milliseconds =
+        std::chrono::duration<double, std::milli>(end - start).count();
+    
+    start = std::chrono::high_resolution_clock::now();
+    int64_t checksum = 0;
+    
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        checksum += prob_dist.sample_element();
+    }
+    
+    end = std::chrono::high_resolution_clock::now();
+    double nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    std::cout << "  churn: " << churn_milliseconds << " milliseconds.\n";
+    std::cout << "  height: " << prob_dist.get_height() << ", ceil(log2 n): "
+              << ceil_log2(prob_dist.size()) << ".\n";
+    std::cout << "  sample_element: " << nanoseconds / SAMPLES
+              << " nanoseconds per sample, checksum " << checksum << ".\n";
+}
+
+// Samples Zipf-distributed weights from a tree of each shape and compares the
+// expected depth of a sampled leaf with the average depth actually observed
+// and with the entropy of the distribution, which bounds both from below.
+static void benchmark_tree_shape() {
+    const size_t size = 25 * LOAD;
+    BinaryTreeProbabilityDistribution<int> prob_dist;
+    std::vector<double> weights;
+    double total_weight = 0.0;
+    
+    for (size_t i = 0; i < size; ++i) {
+        weights.push_back(1.0 / (i + 1));
+        total_weight += weights.back();
+        prob_dist.add_element(static_cast<int>(i), weights.back());
+    }
+    
+    double entropy = 0.0;
+    
+    for (double weight : weights) {
+        double probability = weight / total_weight;
+        entropy -= probability * std::log2(probability);
+    }
+    
+    std::cout << "  Zipf, " << size << " elements, entropy " << entropy
+              << " bits.\n";
+    
+    for (bool weight_shaped : { false, true }) {
+        auto start = std::chrono::high_resolution_clock::now();
+        prob_dist.set_weight_shaped(weight_shaped);
+        auto end = std::chrono::high_resolution_clock::now();
+        double rebuild_milliseconds =
+            std::chrono::duration<double, std::milli>(end - start).count();
+        
+        start = std::chrono::high_resolution_clock::now();
+        int64_t checksum = 0;
+        
+        for (size_t i = 0; i < SAMPLES; ++i) {
+            checksum += prob_dist.sample_element();
+        }
+        
+        end = std::chrono::high_resolution_clock::now();
+        double nanoseconds =
+            std::chrono::duration<double, std::nano>(end - start).count();
+        
+        size_t total_depth = 0;
+        
+        for (size_t i = 0; i < SAMPLES; ++i) {
+            total_depth += prob_dist.get_depth(prob_dist.sample_element());
+        }
+        
+        std::cout << (weight_shaped ? "  weight-shaped: " : "  balanced: ")
+                  << "height " << prob_dist.get_height()
+                  << ", expected depth " << prob_dist.get_expected_depth()
+                  << ", observed depth "
+                  << static_cast<double>(total_depth) / SAMPLES
+                  << ", rebuild " << rebuild_milliseconds
+                  << " milliseconds, sample_element " << nanoseconds / SAMPLES
+                  << " nanoseconds, checksum " << checksum << ".\n";
+    }
+}
+
+// Times the element index against std::pmr::unordered_map over a million
+// shuffled integers, mapping each to its position like the distributions map
+// an element to its handle index, and counts the bytes each one allocates.
+static void benchmark_element_index() {
+    const size_t size = 25 * LOAD;
+    std::vector<int> keys;
+    
+    for (size_t i = 0; i < size; ++i) {
+        keys.push_back(static_cast<int>(i));
+    }
+    
+    std::shuffle(keys.begin(), keys.end(), std::mt19937{41});
+    auto get_key = [&keys](uint32_t value) -> const int& {
+        return keys[value];
+    };
+    
+    auto report = [size](const char* name,
+                         const char* operation,
+                         std::chrono::high_resolution_clock::time_point start,
+                         uint64_t checksum) {
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "  " << name << " " << operation << ": "
+                  << std::chrono::duration<double, std::nano>(end - start)
+                     .count() / size
+                  << " nanoseconds, checksum " << checksum << ".\n";
+    };
+    
+    {
+        CountingMemoryResource resource;
+        FlatHashIndex<int> index(&resource);
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        for (size_t i = 0; i < size; ++i) {
+            index.insert(index.hash(keys[i]), static_cast<uint32_t>(i));
+        }
+        
+        report("FlatHashIndex", "insert", start, index.size());
+        std::cout << "  FlatHashIndex bytes: " << resource.get_bytes_in_use()
+                  << ", allocations: " << resource.get_allocation_count()
+                  << ".\n";
+        
+        start = std::chrono::high_resolution_clock::now();
+        uint64_t checksum = 0;
+        
+        for (size_t i = 0; i < size; ++i) {
+            checksum += index.find(static_cast<int>(i), get_key);
+        }
+        
+        report("FlatHashIndex", "find hit", start, checksum);
+        start = std::chrono::high_resolution_clock::now();
+        checksum = 0;
+        
+        for (size_t i = 0; i < size; ++i) {
+            checksum += index.find(static_cast<int>(size + i), get_key) ==
+                        FlatHashIndex<int>::NOT_FOUND;
+        }
+        
+        report("FlatHashIndex", "find miss", start, checksum);
+        start = std::chrono::high_resolution_clock::now();
+        
+        for (size_t i = 0; i < size; ++i) {
+            index.erase(index.hash(keys[i]), static_cast<uint32_t>(i));
+        }
+        
+        report("FlatHashIndex", "erase", start, index.size());
+    }
+    
+    {
+        CountingMemoryResource resource;
+        std::pmr::unordered_map<int, uint32_t> map(&resource);
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        for (size_t i = 0; i < size; ++i) {
+            map.emplace(keys[i], static_cast<uint32_t>(i));
+        }
+        
+        report("unordered_map", "insert", start, map.size());
+        std::cout << "  unordered_map bytes: " << resource.get_bytes_in_use()
+                  << ", allocations: " << resource.get_allocation_count()
+                  << ".\n";
+        
+        start = std::chrono::high_resolution_clock::now();
+        uint64_t checksum = 0;
+        
+        for (size_t i = 0; i < size; ++i) {
+            checksum += map.find(static_cast<int>(i))->second;
+        }
+        
+        report("unordered_map", "find hit", start, checksum);
+        start = std::chrono::high_resolution_clock::now();
+        checksum = 0;
+        
+        for (size_t i = 0; i < size; ++i) {
+            checksum += map.find(static_cast<int>(size + i)) == map.end();
+        }
+        
+        report("unordered_map", "find miss", start, checksum);
+        start = std::chrono::high_resolution_clock::now();
+        
+        for (size_t i = 0; i < size; ++i) {
+            map.erase(keys[i]);
+        }
+        
+        report("unordered_map", "erase", start, map.size());
+    }
+}
+
+// Adds a million shuffled dense ids, samples them, checks them and removes
+// them, counting the bytes allocated for the elements.
+template<typename Distribution>
+static void benchmark_dense_ids(const char* distribution_name,
+                                const std::vector<int>& ids) {
+    CountingMemoryResource resource;
+    Distribution prob_dist(&resource);
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    for (int id : ids) {
+        prob_dist.add_element(id, 1.0 + id % 10);
+    }
+    
+    auto end = std::chrono::high_resolution_clock::now();
+    double add_nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    size_t bytes_in_use = resource.get_bytes_in_use();
+    size_t allocation_count = resource.get_allocation_count();
+    
+    start = std::chrono::high_resolution_clock::now();
+    int64_t checksum = 0;
+    
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        checksum += prob_dist.sample_element();
+    }
+    
+    end = std::chrono::high_resolution_clock::now();
+    double sample_nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    start = std::chrono::high_resolution_clock::now();
+    
+    for (int id : ids) {
+        checksum += prob_dist.contains_element(id + 1);
+    }
+    
+    end = std::chrono::high_resolution_clock::now();
+    double contains_nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    start = std::chrono::high_resolution_clock::now();
+    
+    for (int id : ids) {
+        prob_dist.remove_element(id);
+    }
+    
+    end = std::chrono::high_resolution_clock::now();
+    double remove_nanoseconds =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    
+    std::cout << "  " << distribution_name << ": add_element "
+              << add_nanoseconds / ids.size() << ", sample_element "
+              << sample_nanoseconds / SAMPLES << ", contains_element "
+              << contains_nanoseconds / ids.size() << ", remove_element "
+              << remove_nanoseconds / ids.size() << " nanoseconds; "
+              << bytes_in_use << " bytes in " << allocation_count
+              << " allocations, checksum " << checksum << ".\n";
+}
+
+// Samples from 1, 2, 4, ... threads while a writer thread keeps reweighting
+// the elements and publishing, and reports the total throughput of the
+// samplers.
+static void benchmark_concurrent() {
+    typedef ConcurrentProbabilityDistribution<int, Xoshiro256PlusPlus>
+            Distribution;
+    
+    const size_t samples_per_thread = 10 * SAMPLES;
+    Distribution prob_dist;
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist.add_element(static_cast<int>(i), 1.0 + i % 10);
+    }
+    
+    prob_dist.publish();
+    size_t maximum_thread_count =
+        std::max(4u, std::thread::hardware_concurrency());
+    
+    for (size_t thread_count = 1;
+         thread_count <= maximum_thread_count;
+         thread_count *= 2) {
+        std::atomic<bool> stop{false};
+        size_t publish_count = 0;
+        std::vector<int64_t> checksums(thread_count, 0);
+        
+        std::thread writer([&prob_dist, &stop, &publish_count]() {
+            std::mt19937 generator(43);
+            
+            while (!stop.load()) {
+                for (int i = 0; i < 100; ++i) {
+                    prob_dist.update_weight(
+                        static_cast<int>(generator() % LOAD),
+                        1.0 + generator() % 10);
+                }
+                
+                prob_dist.publish();
+                publish_count++;
+            }
+        });
+        
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> samplers;
+        
+        for (size_t t = 0; t < thread_count; ++t) {
+            samplers.emplace_back([&prob_dist, &checksums, t,
+                                   samples_per_thread]() {
+                Distribution::Sampler sampler =
+                    prob_dist.get_sampler(static_cast<uint32_t>(t));
+                
+                for (size_t i = 0; i < samples_per_thread; ++i) {
+                    checksums[t] += sampler.sample_element();
+                }
+            });
+        }
+        
+        for (std::thread& sampler : samplers) {
+            sampler.join();
+        }
+        
+        auto end = std::chrono::high_resolution_clock::now();
+        stop.store(true);
+        writer.join();
+        
+        double seconds =
+            std::chrono::duration<double>(end - start).count();
+        int64_t checksum = 0;
+        
+        for (int64_t thread_checksum : checksums) {
+            checksum += thread_checksum;
+        }
+        
+        std::cout << "  " << thread_count << " sampler threads: "
+                  << thread_count * samples_per_thread / seconds / 1e6
+                  << " million samples per second, " << publish_count
+                  << " publishes, checksum " << checksum << ".\n";
+    }
+}
+
+// Reweights the elements and publishes after every 1, 10, 100, ... updates,
+// and reports the time per publish, which is proportional to the updates
+// since the previous publish while only a few changed, and to the size once
+// too many did.
+static void benchmark_concurrent_publish() {
+    typedef ConcurrentProbabilityDistribution<int, Xoshiro256PlusPlus>
+            Distribution;
+    
+    const size_t update_count = 10 * SAMPLES;
+    Distribution prob_dist;
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist.add_element(static_cast<int>(i), 1.0 + i % 10);
+    }
+    
+    prob_dist.publish();
+    Xoshiro256PlusPlus generator(47);
+    
+    for (size_t updates_per_publish = 1;
+         updates_per_publish <= LOAD;
+         updates_per_publish *= 10) {
+        size_t publish_count = update_count / updates_per_publish;
+        double update_nanoseconds = 0.0;
+        double publish_nanoseconds = 0.0;
+        
+        for (size_t i = 0; i < publish_count; ++i) {
+            auto start = std::chrono::high_resolution_clock::now();
+            
+            for (size_t j = 0; j < updates_per_publish; ++j) {
+                prob_dist.update_weight(
+                    static_cast<int>(generator() % LOAD),
+                    1.0 + generator() % 10);
+            }
+            
+            auto middle = std::chrono::high_resolution_clock::now();
+            prob_dist.publish();
+            auto end = std::chrono::high_resolution_clock::now();
+            
+            update_nanoseconds += std::chrono::duration<double, std::nano>(
+                                                middle - start).count();
+            publish_nanoseconds += std::chrono::duration<double, std::nano>(
+                                                end - middle).count();
+        }
+        
+        std::cout << "  " << updates_per_publish
+                  << " updates per publish: update_weight "
+                  << update_nanoseconds / (publish_count * updates_per_publish)
+                  << ", publish " << publish_nanoseconds / publish_count
+                  << " nanoseconds.\n";
+    }
+}
+
+// Does nothing; the sharded distribution locks the shards itself.
+struct NoLock {
+    void lock() {}
+    void unlock() {}
+};
+
+static int sample(BinaryTreeProbabilityDistribution<int>& prob_dist,
+                  Xoshiro256PlusPlus&) {
+    return prob_dist.sample_element();
+}
+
+static int sample(ShardedProbabilityDistribution<int>& prob_dist,
+                  Xoshiro256PlusPlus& generator) {
+    return prob_dist.sample_element(generator);
+}
+
+// Runs a fixed number of operations split over 1, 2, 4, ..., 32 threads,
+// mostly weight updates with some removals, additions and samples, against
+// a sharded distribution and against a tree behind a single mutex.
+template<typename Distribution, typename Lock>
+static void benchmark_update_scaling(const char* distribution_name,
+                                     Distribution& prob_dist,
+                                     Lock& lock) {
+    const size_t operation_count = 10 * SAMPLES;
+    
+    for (size_t thread_count = 1; thread_count <= 32; thread_count *= 2) {
+        std::vector<int64_t> checksums(thread_count, 0);
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        for (size_t t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t]() {
+                Xoshiro256PlusPlus generator(t);
+                
+                for (size_t i = 0; i < operation_count / thread_count; ++i) {
+                    int element = static_cast<int>(generator() % LOAD);
+                    uint64_t operation = generator() % 10;
+                    std::lock_guard<Lock> guard(lock);
+                    
+                    if (operation < 7) {
+                        prob_dist.update_weight(element, 1.0 + i % 10);
+                    } else if (operation < 9) {
+                        if (!prob_dist.remove_element(element)) {
+                            prob_dist.add_element(element, 1.0);
+                        }
+                    } else {
+                        checksums[t] += sample(prob_dist, generator);
+                    }
+                }
+            });
+        }
+        
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        
+        auto end = std::chrono::high_resolution_clock::now();
+        double seconds =
+            std::chrono::duration<double>(end - start).count();
+        int64_t checksum = 0;
+        
+        for (int64_t thread_checksum : checksums) {
+            checksum += thread_checksum;
+        }
+        
+        std::cout << "  " << distribution_name << ", " << thread_count
+                  << " threads: " << operation_count / seconds / 1e6
+                  << " million operations per second, checksum " << checksum
+                  << ".\n";
+    }
+}
+
+static void benchmark_sharded() {
+    BinaryTreeProbabilityDistribution<int> tree_dist;
+    ShardedProbabilityDistribution<int> sharded_dist(64);
+    std::mutex mutex;
+    NoLock no_lock;
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        tree_dist.add_element(static_cast<int>(i), 1.0);
+        sharded_dist.add_element(static_cast<int>(i), 1.0);
+    }
+    
+    benchmark_update_scaling("mutex + BinaryTree", tree_dist, mutex);
+    benchmark_update_scaling("Sharded(64)", sharded_dist, no_lock);
+}
+
+// Splits a fixed number of operations over 1, 2, 4, ..., 32 threads, nine in
+// ten of them weight increments and the rest samples, against the atomic
+// Fenwick tree and against a tree behind a single mutex.
+static void benchmark_atomic_fenwick_tree() {
+    const size_t operation_count = 10 * SAMPLES;
+    std::vector<int> elements;
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        elements.push_back(static_cast<int>(i));
+    }
+    
+    AtomicFenwickTreeProbabilityDistribution<int> atomic_dist(
+                                        elements,
+                                        std::vector<uint64_t>(LOAD, 1));
+    BinaryTreeProbabilityDistribution<int> tree_dist;
+    std::mutex mutex;
+    
+    for (int element : elements) {
+        tree_dist.add_element(element, 1.0);
+    }
+    
+    for (bool atomic : { false, true }) {
+        for (size_t thread_count = 1; thread_count <= 32; thread_count *= 2) {
+            std::vector<int64_t> checksums(thread_count, 0);
+            std::vector<std::thread> threads;
+            auto start = std::chrono::high_resolution_clock::now();
+            
+            for (size_t t = 0; t < thread_count; ++t) {
+                threads.emplace_back([&, t]() {
+                    Xoshiro256PlusPlus generator(t);
+                    
+                    for (size_t i = 0;
+                         i < operation_count / thread_count;
+                         ++i) {
+                        int element = static_cast<int>(generator() % LOAD);
+                        bool increment = generator() % 10 != 0;
+                        
+                        if (atomic) {
+                            if (increment) {
+                                atomic_dist.add_to_weight(element, 1);
+                            } else {
+                                checksums[t] +=
+                                    atomic_dist.sample_element(generator);
+                            }
+                        } else {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            
+                            if (increment) {
+                                tree_dist.update_weight(
+                                    element,
+                                    tree_dist.get_weight(element) + 1.0);
+                            } else {
+                                checksums[t] += tree_dist.sample_element();
+                            }
+                        }
+                    }
+                });
+            }
+            
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+            
+            auto end = std::chrono::high_resolution_clock::now();
+            double seconds =
+                std::chrono::duration<double>(end - start).count();
+            int64_t checksum = 0;
+            
+            for (int64_t thread_checksum : checksums) {
+                checksum += thread_checksum;
+            }
+            
+            std::cout << (atomic ? "  AtomicFenwickTree, " :
+                                   "  mutex + BinaryTree, ")
+                      << thread_count << " threads: "
+                      << operation_count / seconds / 1e6
+                      << " million operations per second, checksum "
+                      << checksum << ".\n";
+        }
+    }
+}
+
+template<typename Distribution>
+static void benchmark_parallel_sample(const std::string& name) {
+    const size_t count = 100 * SAMPLES;
+    Distribution dist(17);
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        dist.add_element(static_cast<int>(i), 1.0 + i % 10);
+    }
+    
+    std::vector<int> samples(count);
+    auto start = std::chrono::high_resolution_clock::now();
+    dist.sample_elements(count, samples.begin());
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "  " << name << ", sample_elements: "
+              << std::chrono::duration<double>(end - start).count() * 1e3
+              << " milliseconds.\n";
+    
+    // Each copy starts from the same streams, so the checksums match:
+    for (size_t thread_count = 1; thread_count <= 8; thread_count *= 2) {
+        Distribution copy(dist);
+        start = std::chrono::high_resolution_clock::now();
+        copy.parallel_sample(count, samples.begin(), thread_count);
+        end = std::chrono::high_resolution_clock::now();
+        int64_t checksum = 0;
+        
+        for (int sample : samples) {
+            checksum += sample;
+        }
+        
+        std::cout << "  " << name << ", parallel_sample on " << thread_count
+                  << " threads: "
+                  << std::chrono::duration<double>(end - start).count() * 1e3
+                  << " milliseconds, checksum " << checksum << ".\n";
+    }
+}
+
+// A quick comparison of the backends on a single size; benchmark.cpp holds
+// the full suite.
+static void benchmark() {
+    
+    class CurrentTime {
+        std::chrono::high_resolution_clock m_clock;
+        
+    public:
+        uint64_t milliseconds() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>
+            (m_clock.now().time_since_epoch()).count();
+        }
+    };
+    
+    ArrayProbabilityDistribution<int>      prob_dist1;
+    LinkedListProbabilityDistribution<int> prob_dist2;
+    BinaryTreeProbabilityDistribution<int> prob_dist3;
+    AliasProbabilityDistribution<int>      prob_dist4;
+    FenwickTreeProbabilityDistribution<int> prob_dist5;
+    ImplicitBinaryTreeProbabilityDistribution<int> prob_dist6;
+    BucketProbabilityDistribution<int>     prob_dist7;
+    DenseIdProbabilityDistribution<int>    prob_dist8;
+    
+    std::vector<int> remove_order_vector;
+    
+    for (int i = 0; i < LOAD; ++i) {
+        remove_order_vector.push_back(i);
+    }
+    std::random_device rd;
+    std::mt19937 g(rd());
+    std::shuffle(remove_order_vector.begin(),
+                 remove_order_vector.end(),
+                 g);
+    
+    CurrentTime ct;
+    
+    //// ARRAY BASED BENCHMARK ////
+    std::cout << "ArrayProbabilityDistribution:\n";
+    
+    uint64_t add_time = 0;
+    uint64_t sample_time = 0;
+    uint64_t remove_time = 0;
+    
+    uint64_t start = ct.milliseconds();
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist1.add_element(i, 1.0);
+    }
+    
+    uint64_t end = ct.milliseconds();
+    
+    add_time = end - start;
+    std::cout << "  add_element: " << add_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        prob_dist1.sample_element();
+    }
+    
+    end = ct.milliseconds();
+    
+    sample_time = end - start;
+    std::cout << "  sample_element: " << sample_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (int element : remove_order_vector) {
+        prob_dist1.remove_element(element);
+    }
+    
+    end = ct.milliseconds();
+    
+    remove_time = end - start;
+    std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
+    std::cout << "  Total: " << (add_time + sample_time + remove_time)
+              << " milliseconds.\n";
+    
+    
+    //// LINKED LIST BASED BENCHMARK ////
+    std::cout << "LinkedListProbabilityDistribution:\n";
+    
+    add_time = 0;
+    sample_time = 0;
+    remove_time = 0;
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist2.add_element(i, 1.0);
+    }
+    
+    end = ct.milliseconds();
+    
+    add_time = end - start;
+    std::cout << "  add_element: " << add_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        prob_dist2.sample_element();
+    }
+    
+    end = ct.milliseconds();
+    
+    sample_time = end - start;
+    std::cout << "  sample_element: " << sample_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (int element : remove_order_vector) {
+        prob_dist2.remove_element(element);
+    }
+    
+    end = ct.milliseconds();
+    
+    remove_time = end - start;
+    std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
+    std::cout << "  Total: " << (add_time + sample_time + remove_time)
+    << " milliseconds.\n";
+
+    //// TREE BASED BENCHMARK ////
+    std::cout << "BinaryTreeProbabilityDistribution:\n";
+    
+    add_time = 0;
+    sample_time = 0;
     remove_time = 0;
     
     start = ct.milliseconds();
@@ -566,4 +3818,301 @@ static void benchmark() {
     std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
     std::cout << "  Total: " << (add_time + sample_time + remove_time)
     << " milliseconds.\n";
+
+    //// FENWICK TREE BASED BENCHMARK ////
+    std::cout << "FenwickTreeProbabilityDistribution:\n";
+    
+    add_time = 0;
+    sample_time = 0;
+    remove_time = 0;
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist5.add_element(i, 1.0);
+    }
+    
+    end = ct.milliseconds();
+    
+    add_time = end - start;
+    std::cout << "  add_element: " << add_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        prob_dist5.sample_element();
+    }
+    
+    end = ct.milliseconds();
+    
+    sample_time = end - start;
+    std::cout << "  sample_element: " << sample_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (int element : remove_order_vector) {
+        prob_dist5.remove_element(element);
+    }
+    
+    end = ct.milliseconds();
+    
+    remove_time = end - start;
+    std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
+    std::cout << "  Total: " << (add_time + sample_time + remove_time)
+    << " milliseconds.\n";
+
+    //// IMPLICIT TREE BASED BENCHMARK ////
+    std::cout << "ImplicitBinaryTreeProbabilityDistribution:\n";
+    
+    add_time = 0;
+    sample_time = 0;
+    remove_time = 0;
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist6.add_element(i, 1.0);
+    }
+    
+    end = ct.milliseconds();
+    
+    add_time = end - start;
+    std::cout << "  add_element: " << add_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        prob_dist6.sample_element();
+    }
+    
+    end = ct.milliseconds();
+    
+    sample_time = end - start;
+    std::cout << "  sample_element: " << sample_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (int element : remove_order_vector) {
+        prob_dist6.remove_element(element);
+    }
+    
+    end = ct.milliseconds();
+    
+    remove_time = end - start;
+    std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
+    std::cout << "  Total: " << (add_time + sample_time + remove_time)
+    << " milliseconds.\n";
+
+    //// ALIAS METHOD BASED BENCHMARK ////
+    std::cout << "AliasProbabilityDistribution:\n";
+    
+    add_time = 0;
+    sample_time = 0;
+    remove_time = 0;
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist4.add_element(i, 1.0);
+    }
+    
+    end = ct.milliseconds();
+    
+    add_time = end - start;
+    std::cout << "  add_element: " << add_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        prob_dist4.sample_element();
+    }
+    
+    end = ct.milliseconds();
+    
+    sample_time = end - start;
+    std::cout << "  sample_element: " << sample_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (int element : remove_order_vector) {
+        prob_dist4.remove_element(element);
+    }
+    
+    end = ct.milliseconds();
+    
+    remove_time = end - start;
+    std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
+    std::cout << "  Total: " << (add_time + sample_time + remove_time)
+    << " milliseconds.\n";
+    
+    //// BUCKET BASED BENCHMARK ////
+    std::cout << "BucketProbabilityDistribution:\n";
+    
+    add_time = 0;
+    sample_time = 0;
+    remove_time = 0;
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist7.add_element(i, 1.0);
+    }
+    
+    end = ct.milliseconds();
+    
+    add_time = end - start;
+    std::cout << "  add_element: " << add_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        prob_dist7.sample_element();
+    }
+    
+    end = ct.milliseconds();
+    
+    sample_time = end - start;
+    std::cout << "  sample_element: " << sample_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (int element : remove_order_vector) {
+        prob_dist7.remove_element(element);
+    }
+    
+    end = ct.milliseconds();
+    
+    remove_time = end - start;
+    std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
+    std::cout << "  Total: " << (add_time + sample_time + remove_time)
+    << " milliseconds.\n";
+    
+    //// DENSE ID BASED BENCHMARK ////
+    std::cout << "DenseIdProbabilityDistribution:\n";
+    
+    add_time = 0;
+    sample_time = 0;
+    remove_time = 0;
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < LOAD; ++i) {
+        prob_dist8.add_element(i, 1.0);
+    }
+    
+    end = ct.milliseconds();
+    
+    add_time = end - start;
+    std::cout << "  add_element: " << add_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        prob_dist8.sample_element();
+    }
+    
+    end = ct.milliseconds();
+    
+    sample_time = end - start;
+    std::cout << "  sample_element: " << sample_time << " milliseconds.\n";
+    
+    start = ct.milliseconds();
+    
+    for (int element : remove_order_vector) {
+        prob_dist8.remove_element(element);
+    }
+    
+    end = ct.milliseconds();
+    
+    remove_time = end - start;
+    std::cout << "  remove_element: " << remove_time << " milliseconds.\n";
+    std::cout << "  Total: " << (add_time + sample_time + remove_time)
+    << " milliseconds.\n";
+    
+    //// RANDOM ENGINE BENCHMARK ////
+    std::cout << "Random engines:\n";
+    
+    benchmark_engine<std::mt19937>("std::mt19937");
+    benchmark_engine<SplitMix64>("SplitMix64");
+    benchmark_engine<Xoshiro256PlusPlus>("Xoshiro256PlusPlus");
+#ifdef __SIZEOF_INT128__
+    benchmark_engine<Pcg64>("Pcg64");
+#endif
+    
+    //// DISPATCH BENCHMARK ////
+    std::cout << "sample_element() on 8 elements, static vs. virtual:\n";
+    benchmark_dispatch<ArrayProbabilityDistribution<int>>("Array");
+    benchmark_dispatch<LinkedListProbabilityDistribution<int>>("LinkedList");
+    benchmark_dispatch<BinaryTreeProbabilityDistribution<int>>("BinaryTree");
+    benchmark_dispatch<AliasProbabilityDistribution<int>>("Alias");
+    benchmark_dispatch<FenwickTreeProbabilityDistribution<int>>("FenwickTree");
+    benchmark_dispatch<ImplicitBinaryTreeProbabilityDistribution<int>>(
+                                                        "ImplicitBinaryTree");
+    benchmark_dispatch<BucketProbabilityDistribution<int>>("Bucket");
+    benchmark_dispatch<DenseIdProbabilityDistribution<int>>("DenseId");
+    
+    //// HANDLE BENCHMARK ////
+    std::cout << "update_weight() and remove_element() on " << LOAD
+              << " strings, by element vs. by handle:\n";
+    benchmark_handles<ArrayProbabilityDistribution<std::string>>("Array");
+    benchmark_handles<LinkedListProbabilityDistribution<std::string>>(
+                                                        "LinkedList");
+    benchmark_handles<BinaryTreeProbabilityDistribution<std::string>>(
+                                                        "BinaryTree");
+    benchmark_handles<AliasProbabilityDistribution<std::string>>("Alias");
+    benchmark_handles<FenwickTreeProbabilityDistribution<std::string>>(
+                                                        "FenwickTree");
+    benchmark_handles<ImplicitBinaryTreeProbabilityDistribution<std::string>>(
+                                                        "ImplicitBinaryTree");
+    benchmark_handles<BucketProbabilityDistribution<std::string>>("Bucket");
+    
+    //// TREE CHURN BENCHMARK ////
+    std::cout << "BinaryTreeProbabilityDistribution under churn:\n";
+    benchmark_churn();
+    
+    //// TREE SHAPE BENCHMARK ////
+    std::cout << "BinaryTreeProbabilityDistribution by shape:\n";
+    benchmark_tree_shape();
+    
+    //// ELEMENT INDEX BENCHMARK ////
+    std::cout << "Element index on " << 25 * LOAD << " integers:\n";
+    benchmark_element_index();
+    
+    //// DENSE ID BENCHMARK ////
+    std::vector<int> ids;
+    
+    for (size_t i = 0; i < 25 * LOAD; ++i) {
+        ids.push_back(static_cast<int>(i));
+    }
+    
+    std::shuffle(ids.begin(), ids.end(), g);
+    std::cout << "Dense ids 0.." << ids.size() - 1 << ", shuffled:\n";
+    benchmark_dense_ids<FenwickTreeProbabilityDistribution<int>>(
+                                                        "FenwickTree", ids);
+    benchmark_dense_ids<DenseIdProbabilityDistribution<int>>("DenseId", ids);
+    
+    //// CONCURRENT BENCHMARK ////
+    std::cout << "ConcurrentProbabilityDistribution on " << LOAD
+              << " elements, one writer:\n";
+    benchmark_concurrent();
+    std::cout << "ConcurrentProbabilityDistribution on " << LOAD
+              << " elements, publish cost by publish rate:\n";
+    benchmark_concurrent_publish();
+    
+    //// SHARDED BENCHMARK ////
+    std::cout << "Updates on " << LOAD << " elements, sharded vs. locked:\n";
+    benchmark_sharded();
+    
+    //// ATOMIC FENWICK TREE BENCHMARK ////
+    std::cout << "Weight increments on " << LOAD
+              << " elements, atomic vs. locked:\n";
+    benchmark_atomic_fenwick_tree();
+    
+    //// PARALLEL SAMPLE BENCHMARK ////
+    std::cout << 100 * SAMPLES << " samples from " << LOAD
+              << " elements, serial vs. parallel:\n";
+    benchmark_parallel_sample<AliasProbabilityDistribution<int>>("Alias");
+    benchmark_parallel_sample<FenwickTreeProbabilityDistribution<int>>(
+                                                            "FenwickTree");
+    benchmark_parallel_sample<BucketProbabilityDistribution<int>>("Bucket");
 }
@@ -0,0 +1,360 @@
+// Replays an operation trace, recorded by RecordingProbabilityDistribution,
+// against each backend and reports the throughput and the latency
+// histograms of the operations. Build and run with
+//
+//     g++ -std=c++17 -O2 -o replay replay.cpp
+//     ./replay trace.bin
+//
+// The traces of the elements of 4 and 8 bytes are replayed as int32_t and
+// int64_t, respectively. Each backend replays the whole trace from empty
+// --repetitions times (default 3), timing each replay as a whole; the
+// throughput is the median of those. One more replay times each operation
+// on its own, less the overhead of reading the clock, for the histograms,
+// whose buckets span powers of two nanoseconds. --backends selects a
+// comma-separated list of the backends, and --seed seeds them. A backend
+// failing on the trace, such as DenseId on negative elements, is reported
+// and skipped.
+#include "AliasProbabilityDistribution.hpp"
+#include "ArrayProbabilityDistribution.hpp"
+#include "BinaryTreeProbabilityDistribution.hpp"
+#include "BucketProbabilityDistribution.hpp"
+#include "DenseIdProbabilityDistribution.hpp"
+#include "FenwickTreeProbabilityDistribution.hpp"
+#include "ImplicitBinaryTreeProbabilityDistribution.hpp"
+#include "LinkedListProbabilityDistribution.hpp"
+#include "OperationTrace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using net::coderodde::util::AliasProbabilityDistribution;
+using net::coderodde::util::ArrayProbabilityDistribution;
+using net::coderodde::util::BinaryTreeProbabilityDistribution;
+using net::coderodde::util::BucketProbabilityDistribution;
+using net::coderodde::util::DenseIdProbabilityDistribution;
+using net::coderodde::util::FenwickTreeProbabilityDistribution;
+using net::coderodde::util::ImplicitBinaryTreeProbabilityDistribution;
+using net::coderodde::util::LinkedListProbabilityDistribution;
+using net::coderodde::util::TraceReader;
+using net::coderodde::util::TraceRecord;
+using net::coderodde::util::read_trace_header;
+
+typedef std::chrono::steady_clock Clock;
+
+// Indexed by the operation codes less one.
+static const char* const OPERATION_NAMES[] = {
+    "add",
+    "remove",
+    "update",
+    "sample",
+    "sample_elements (per batch)",
+    "clear",
+    "sample_distinct (per batch)",
+    "sample_counts (per batch)",
+};
+
+static const size_t OPERATION_COUNT = 8;
+
+struct Options {
+    std::string              trace_file_name;
+    std::vector<std::string> backends;
+    size_t                   repetitions = 3;
+    uint32_t                 seed        = 13;
+};
+
+// Keeps the compiler from dropping the samples.
+static volatile int64_t sink;
+
+static double get_nanoseconds(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// The median of the times of reading the clock twice in a row.
+static double measure_clock_overhead() {
+    std::vector<double> times;
+    
+    for (int i = 0; i < 10000; ++i) {
+        Clock::time_point start = Clock::now();
+        Clock::time_point end = Clock::now();
+        times.push_back(get_nanoseconds(start, end));
+    }
+    
+    std::nth_element(times.begin(),
+                     times.begin() + times.size() / 2,
+                     times.end());
+    return times[times.size() / 2];
+}
+
+// The nearest-rank percentile of the sorted values.
+static double get_percentile(const std::vector<double>& sorted_values,
+                             double percentile) {
+    size_t rank = static_cast<size_t>(
+                    std::ceil(percentile / 100.0 * sorted_values.size()));
+    return sorted_values[std::max<size_t>(rank, 1) - 1];
+}
+
+static void print_histogram(const std::string& name,
+                            std::vector<double>& latencies) {
+    if (latencies.empty()) {
+        return;
+    }
+    
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "    " << name << ": " << latencies.size()
+              << " operations, p50 " << get_percentile(latencies, 50.0)
+              << ", p90 " << get_percentile(latencies, 90.0)
+              << ", p99 " << get_percentile(latencies, 99.0)
+              << ", p99.9 " << get_percentile(latencies, 99.9)
+              << ", max " << latencies.back() << " ns\n";
+    
+    // The bucket i holds the latencies in [2^(i - 1), 2^i), and the bucket
+    // 0 those below one nanosecond:
+    std::vector<size_t> buckets;
+    
+    for (double latency : latencies) {
+        size_t bucket = 0;
+    
+        while (bucket < 63 && latency >= static_cast<double>(1ULL << bucket)) {
+            bucket++;
+        }
+    
+        if (buckets.size() <= bucket) {
+            buckets.resize(bucket + 1, 0);
+        }
+    
+        buckets[bucket]++;
+    }
+    
+    size_t largest_bucket = *std::max_element(buckets.begin(), buckets.end());
+    
+    for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+        if (buckets[bucket] == 0) {
+            continue;
+        }
+    
+        uint64_t low = bucket == 0 ? 0 : 1ULL << (bucket - 1);
+        std::ostringstream range;
+        range << "[" << low << ", " << (1ULL << bucket) << ")";
+        std::cout << "      " << std::left << std::setw(24) << range.str()
+                  << std::right << std::setw(10) << buckets[bucket] << " "
+                  << std::string(40 * buckets[bucket] / largest_bucket, '#')
+                  << "\n";
+    }
+}
+
+template<typename Distribution, typename T>
+static void replay(const std::string& backend,
+                   const std::vector<TraceRecord<T>>& records,
+                   const Options& options,
+                   double clock_overhead) {
+    int64_t checksum = 0;
+    auto consume_sample = [&checksum](const T& element) {
+        checksum += static_cast<int64_t>(element);
+    };
+    
+    std::vector<double> replay_times;
+    
+    try {
+        for (size_t i = 0; i < options.repetitions; ++i) {
+            Distribution dist(options.seed);
+            Clock::time_point start = Clock::now();
+    
+            for (const TraceRecord<T>& record : records) {
+                record.apply(dist, consume_sample);
+            }
+    
+            Clock::time_point end = Clock::now();
+            replay_times.push_back(get_nanoseconds(start, end));
+        }
+    
+        std::vector<std::vector<double>> latencies(OPERATION_COUNT);
+        Distribution dist(options.seed);
+    
+        for (const TraceRecord<T>& record : records) {
+            Clock::time_point start = Clock::now();
+            record.apply(dist, consume_sample);
+            Clock::time_point end = Clock::now();
+            latencies[static_cast<size_t>(record.operation) - 1].push_back(
+                std::max(0.0,
+                         get_nanoseconds(start, end) - clock_overhead));
+        }
+    
+        sink = checksum;
+        std::sort(replay_times.begin(), replay_times.end());
+        double replay_time = get_percentile(replay_times, 50.0);
+    
+        std::cout << backend << ": "
+                  << replay_time / records.size() << " ns per operation, "
+                  << records.size() / replay_time * 1e3
+                  << " million operations per second, checksum "
+                  << checksum << ".\n";
+    
+        for (size_t i = 0; i < OPERATION_COUNT; ++i) {
+            print_histogram(OPERATION_NAMES[i], latencies[i]);
+        }
+    } catch (std::exception& err) {
+        std::cout << backend << ": skipped, " << err.what() << "\n";
+    }
+}
+
+static bool is_selected(const std::vector<std::string>& selection,
+                        const std::string& name) {
+    return selection.empty() ||
+           std::find(selection.begin(), selection.end(), name) !=
+           selection.end();
+}
+
+template<typename T>
+static void replay_all(std::istream& in,
+                       const Options& options) {
+    TraceReader<T> reader(in);
+    std::vector<TraceRecord<T>> records = reader.read_all();
+    std::vector<size_t> counts(OPERATION_COUNT, 0);
+    
+    for (const TraceRecord<T>& record : records) {
+        counts[static_cast<size_t>(record.operation) - 1]++;
+    }
+    
+    std::cout << records.size() << " operations:";
+    
+    for (size_t i = 0; i < OPERATION_COUNT; ++i) {
+        if (counts[i] > 0) {
+            std::cout << " " << OPERATION_NAMES[i] << " " << counts[i];
+        }
+    }
+    
+    std::cout << ".\n";
+    
+    if (records.empty()) {
+        return;
+    }
+    
+    double clock_overhead = measure_clock_overhead();
+    std::cout << std::fixed << std::setprecision(1);
+    
+    if (is_selected(options.backends, "Array")) {
+        replay<ArrayProbabilityDistribution<T>>(
+            "Array", records, options, clock_overhead);
+    }
+    
+    if (is_selected(options.backends, "LinkedList")) {
+        replay<LinkedListProbabilityDistribution<T>>(
+            "LinkedList", records, options, clock_overhead);
+    }
+    
+    if (is_selected(options.backends, "BinaryTree")) {
+        replay<BinaryTreeProbabilityDistribution<T>>(
+            "BinaryTree", records, options, clock_overhead);
+    }
+    
+    if (is_selected(options.backends, "Alias")) {
+        replay<AliasProbabilityDistribution<T>>(
+            "Alias", records, options, clock_overhead);
+    }
+    
+    if (is_selected(options.backends, "FenwickTree")) {
+        replay<FenwickTreeProbabilityDistribution<T>>(
+            "FenwickTree", records, options, clock_overhead);
+    }
+    
+    if (is_selected(options.backends, "ImplicitBinaryTree")) {
+        replay<ImplicitBinaryTreeProbabilityDistribution<T>>(
+            "ImplicitBinaryTree", records, options, clock_overhead);
+    }
+    
+    if (is_selected(options.backends, "Bucket")) {
+        replay<BucketProbabilityDistribution<T>>(
+            "Bucket", records, options, clock_overhead);
+    }
+    
+    if (is_selected(options.backends, "DenseId")) {
+        replay<DenseIdProbabilityDistribution<T>>(
+            "DenseId", records, options, clock_overhead);
+    }
+}
+
+static Options parse_options(int argc, char* argv[]) {
+    Options options;
+    
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+    
+        if (argument.compare(0, 2, "--") != 0) {
+            options.trace_file_name = argument;
+            continue;
+        }
+    
+        size_t equals = argument.find('=');
+    
+        if (equals == std::string::npos) {
+            throw std::invalid_argument{"Malformed option: " + argument};
+        }
+    
+        std::string name = argument.substr(2, equals - 2);
+        std::string value = argument.substr(equals + 1);
+    
+        if (name == "backends") {
+            std::stringstream ss(value);
+            std::string backend;
+    
+            while (std::getline(ss, backend, ',')) {
+                options.backends.push_back(backend);
+            }
+        } else if (name == "repetitions") {
+            options.repetitions = std::stoull(value);
+        } else if (name == "seed") {
+            options.seed = static_cast<uint32_t>(std::stoul(value));
+        } else {
+            throw std::invalid_argument{"Unknown option: --" + name};
+        }
+    }
+    
+    if (options.trace_file_name.empty() || options.repetitions == 0) {
+        throw std::invalid_argument{
+            "Usage: replay TRACE [--backends=A,B] [--repetitions=N] "
+            "[--seed=S]"
+        };
+    }
+    
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        Options options = parse_options(argc, argv);
+        std::ifstream file(options.trace_file_name, std::ios::binary);
+    
+        if (!file) {
+            throw std::runtime_error{
+                "Cannot open " + options.trace_file_name + "."
+            };
+        }
+    
+        uint32_t element_size = read_trace_header(file);
+        file.seekg(0);
+    
+        if (element_size == sizeof(int32_t)) {
+            replay_all<int32_t>(file, options);
+        } else if (element_size == sizeof(int64_t)) {
+            replay_all<int64_t>(file, options);
+        } else {
+            throw std::runtime_error{
+                "Only the traces of 4- and 8-byte integers are supported."
+            };
+        }
+    } catch (std::exception& err) {
+        std::cerr << err.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}